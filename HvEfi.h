@@ -26,6 +26,31 @@
         {0x098d423a, 0x6ca5, 0x4ad4, \
         {0x90, 0xfa, 0x72, 0xc3, 0xce, 0x22, 0xc8, 0xd0}}
 
+//
+// LINUX_EFI_HYPERVISOR_MEDIA_EX protocol, the optional extensions of the
+// LINUX_EFI_HYPERVISOR_MEDIA protocol. Installed by providers that support
+// any of them, next to the base protocol.
+//
+// The version changes only on incompatible changes. New members are
+// appended, the Size field tells which ones the provider knows about, so
+// a member is usable only if the version matches, the Size covers it and
+// it is not NULL, HV_EFI_MEDIA_EX_SUPPORTS().
+//
+
+#define LINUX_EFI_HYPERVISOR_MEDIA_EX_GUID \
+        {0x5d8a1b7e, 0x3c2f, 0x4e61, \
+        {0x9b, 0x07, 0xa4, 0x5e, 0x1d, 0x6c, 0x82, 0xf3}}
+
+#define LINUX_EFI_HYPERVISOR_MEDIA_EX_VERSION 0x00000100
+
+#define HV_EFI_MEDIA_EX_SUPPORTS(_ExProtocol, _Member) \
+        (((_ExProtocol) != NULL) && \
+         ((_ExProtocol)->Version == LINUX_EFI_HYPERVISOR_MEDIA_EX_VERSION) && \
+         ((_ExProtocol)->Size >= \
+          OFFSET_OF(LINUX_EFI_HYPERVISOR_MEDIA_EX_PROTOCOL, _Member) + \
+          sizeof((_ExProtocol)->_Member)) && \
+         ((_ExProtocol)->_Member != NULL))
+
 //
 // HV EFI memory descriptor extended attributes values
 //
@@ -33,6 +58,36 @@
 #define HV_EFI_MEMORY_EX_ATTR_HV        0x0000000000001 // Hypervisor pages
 #define HV_EFI_MEMORY_EX_ATTR_HVLOADER  0x0000000000002 // HV loader pages
 
+//
+// HV EFI memory map index version
+//
+
+#define HV_EFI_MEMORY_MAP_INDEX_VERSION 0x00000100
+
+//
+// HvlGetMemoryMapEx() flags
+//
+// COALESCE - Merge adjacent descriptors with the same type, attributes and
+//            extended attributes.
+// COMPACT  - Return HV_EFI_MEMORY_DESCRIPTOR_COMPACT descriptors, with
+//            DescriptorVersion HV_EFI_MEMORY_DESCRIPTOR_COMPACT_VERSION.
+//
+
+#define HV_EFI_MEMORY_MAP_COALESCE      0x00000001
+#define HV_EFI_MEMORY_MAP_COMPACT       0x00000002
+#define HV_EFI_MEMORY_MAP_FLAGS         (HV_EFI_MEMORY_MAP_COALESCE | \
+                                         HV_EFI_MEMORY_MAP_COMPACT)
+
+#define HV_EFI_MEMORY_DESCRIPTOR_COMPACT_VERSION  0x80000001
+
+//
+// HV EFI memory map change kinds, HV_EFI_MEMORY_MAP_CHANGE
+//
+
+#define HV_EFI_MEMORY_MAP_CHANGE_ADDED    1 // Descriptor inserted
+#define HV_EFI_MEMORY_MAP_CHANGE_REMOVED  2 // Descriptor at start removed
+#define HV_EFI_MEMORY_MAP_CHANGE_CHANGED  3 // Descriptor at start updated
+
 
 //
 // ---------------------------------------------------------------------- Types
@@ -51,6 +106,95 @@ typedef struct _HV_EFI_MEMORY_DESCRIPTOR_EX {
     UINT64  Pad;          //  Field size is 64 bits
 } HV_EFI_MEMORY_DESCRIPTOR_EX, *PHV_EFI_MEMORY_DESCRIPTOR_EX;
 
+//
+// HV EFI compact memory descriptor, HV_EFI_MEMORY_MAP_COMPACT.
+// An EFI_MEMORY_DESCRIPTOR with HV_EFI_MEMORY_DESCRIPTOR_EX, without
+// VirtualStart and the extension padding, 40 bytes rather than 56.
+//
+
+typedef struct _HV_EFI_MEMORY_DESCRIPTOR_COMPACT {
+    UINT64  PhysicalStart;
+    UINT64  NumberOfPages;
+    UINT64  Attribute;
+    UINT32  Type;
+    UINT32  Reserved;
+    UINT64  ExAttribute;  //  Field size is 64 bits
+} HV_EFI_MEMORY_DESCRIPTOR_COMPACT, *PHV_EFI_MEMORY_DESCRIPTOR_COMPACT;
+
+//
+// HV EFI runtime range, HvlRegisterRuntimeRanges().
+//
+
+typedef struct _HV_EFI_RUNTIME_RANGE {
+    UINT64  BasePage;
+    UINT64  PageCount;
+    UINT32  Result;     //  As returned by HvlRegisterRuntimeRange()
+    UINT32  Reserved;
+} HV_EFI_RUNTIME_RANGE, *PHV_EFI_RUNTIME_RANGE;
+
+//
+// HV EFI memory map change record, HvlGetMemoryMapChanges().
+// The memory map generation is the MapKey returned by HvlGetMemoryMap(),
+// it is bumped by every memory map update. Applying the changes of the
+// generations after G, in order, to the map of generation G, results in
+// the current map.
+//
+
+typedef struct _HV_EFI_MEMORY_MAP_CHANGE {
+    UINT64                            Generation; //  Generation of the change
+    UINT32                            Kind;       //  HV_EFI_MEMORY_MAP_CHANGE_*
+    UINT32                            Reserved;
+    HV_EFI_MEMORY_DESCRIPTOR_COMPACT  Descriptor;
+} HV_EFI_MEMORY_MAP_CHANGE, *PHV_EFI_MEMORY_MAP_CHANGE;
+
+//
+// HV EFI log record, HvlGetLogMessages().
+// The message text follows the record header, NULL terminated, UCS-2 or
+// UTF-8 encoded per the HvlGetLogMessages() flags. Records are
+// HV_EFI_LOG_RECORD_ALIGN aligned, the next record starts RecordSize
+// bytes after this one.
+//
+
+#define HV_EFI_LOG_UTF8           0x00000001
+#define HV_EFI_LOG_FLAGS          (HV_EFI_LOG_UTF8)
+
+#define HV_EFI_LOG_RECORD_ALIGN   sizeof(UINT32)
+
+typedef struct _HV_EFI_LOG_RECORD {
+    UINT32  RecordSize;     //  Size of the whole record, including padding
+    UINT32  TextSize;       //  Size of the text in bytes, excluding the NULL
+} HV_EFI_LOG_RECORD, *PHV_EFI_LOG_RECORD;
+
+//
+// HV EFI memory map index.
+// A sorted structure-of-arrays copy of the memory map, built once, so
+// address lookups are a binary search rather than a walk over variable
+// size descriptors. Single contiguous block:
+//   HV_EFI_MEMORY_MAP_INDEX
+//   UINT64  Start[Count]              - descriptor physical start, sorted.
+//   UINT64  Pages[Count]              - descriptor page count.
+//   UINT64  Attribute[Count]          - descriptor attributes.
+//   UINT64  ExAttribute[Count]        - descriptor extended attributes.
+//   UINT32  Type[Count]               - descriptor memory type.
+//   UINT32  ExRanges[ExRangeCount]    - indices of the HV and HV loader
+//                                       descriptors, sorted.
+// All offsets are in bytes from the start of the index, and 64 bit aligned.
+//
+
+typedef struct _HV_EFI_MEMORY_MAP_INDEX {
+    UINT32  Version;            //  HV_EFI_MEMORY_MAP_INDEX_VERSION
+    UINT32  Size;               //  Size of the whole index block
+    UINT64  MapKey;             //  Key of the memory map indexed
+    UINT32  Count;
+    UINT32  ExRangeCount;
+    UINT32  StartOffset;
+    UINT32  PagesOffset;
+    UINT32  AttributeOffset;
+    UINT32  ExAttributeOffset;
+    UINT32  TypeOffset;
+    UINT32  ExRangesOffset;
+} HV_EFI_MEMORY_MAP_INDEX, *PHV_EFI_MEMORY_MAP_INDEX;
+
 //
 // LINUX_EFI_HYPERVISOR_MEDIA_PROTOCOL methods
 //
@@ -85,6 +229,85 @@ CHAR16*
     IN OUT  size_t *NextMessage
     );
 
+//
+// Returns the memory map index, HV_EFI_MEMORY_MAP_INDEX.
+// Same buffer contract as HvlGetMemoryMap(), EFI_BUFFER_TOO_SMALL and the
+// required size are returned, if the caller buffer is too small.
+//
+
+typedef
+EFI_STATUS
+(EFIAPI *HV_EFI_GET_MEMORY_MAP_INDEX_ROUTINE) (
+    IN OUT  UINTN                   *IndexSize,
+    OUT     HV_EFI_MEMORY_MAP_INDEX *Index
+    );
+
+//
+// Returns the memory map, coalesced and/or compact, per Flags.
+// Same buffer contract as HvlGetMemoryMap(), DescriptorSize and
+// DescriptorVersion describe the returned descriptors.
+//
+
+typedef
+EFI_STATUS
+(EFIAPI *HV_EFI_GET_MEMORY_MAP_EX_ROUTINE) (
+    IN      UINT32                  Flags,
+    IN OUT  UINTN                   *EfiMemoryMapSize,
+    IN OUT  VOID                    *EfiMemoryMap,
+    OUT     UINTN                   *MapKey,
+    OUT     UINTN                   *DescriptorSize,
+    OUT     UINT32                  *DescriptorVersion
+    );
+
+//
+// Returns the memory map changes made after a generation, and the current
+// generation. Same buffer contract as HvlGetMemoryMap().
+// EFI_NOT_FOUND is returned if the changes of Generation are no longer
+// retained, the caller should then get the whole map again.
+//
+
+typedef
+EFI_STATUS
+(EFIAPI *HV_EFI_GET_MEMORY_MAP_CHANGES_ROUTINE) (
+    IN      UINTN                     Generation,
+    IN OUT  UINTN                     *ChangesSize,
+    OUT     HV_EFI_MEMORY_MAP_CHANGE  *Changes,
+    OUT     UINTN                     *CurrentGeneration
+    );
+
+//
+// Registers a number of runtime ranges in one call, with a single memory
+// map update. Ranges may be in any order, and may overlap. The result of
+// each range is returned in its Result field.
+// Returns EFI_SUCCESS if all ranges were registered, EFI_NOT_FOUND if
+// some were not.
+//
+
+typedef
+EFI_STATUS
+(EFIAPI *HV_EFI_REGISTER_RUNTIME_RANGES_ROUTINE) (
+    IN OUT  HV_EFI_RUNTIME_RANGE    *Ranges,
+    IN      UINTN                   RangeCount
+    );
+
+//
+// Copies as many log records, starting from *NextMessage, as fit in the
+// caller buffer, and advances *NextMessage past them.
+// *BufferSize returns the size of the records copied, and *MessageCount
+// their number, 0 at the end of the log. EFI_BUFFER_TOO_SMALL and the
+// size of the next record are returned, if it does not fit in the buffer.
+//
+
+typedef
+EFI_STATUS
+(EFIAPI *HV_EFI_GET_LOG_MESSAGES_ROUTINE) (
+    IN      UINT32                  Flags,
+    IN OUT  size_t                  *NextMessage,
+    IN OUT  UINTN                   *BufferSize,
+    OUT     VOID                    *Buffer,
+    OUT     UINTN                   *MessageCount
+    );
+
 typedef struct _LINUX_EFI_HYPERVISOR_MEDIA_PROTOCOL {
     HV_EFI_LAUNCH_HYPERVISOR_ROUTINE      HvlLaunchHv;
     HV_EFI_REGISTER_RUNTIME_RANGE_ROUTINE HvlRegisterRuntimeRange;
@@ -92,4 +315,19 @@ typedef struct _LINUX_EFI_HYPERVISOR_MEDIA_PROTOCOL {
     HV_EFI_GET_NEXT_LOG_MESSAGE_ROUTINE   HvlGetNextLogMessage;
 } LINUX_EFI_HYPERVISOR_MEDIA_PROTOCOL;
 
+//
+// LINUX_EFI_HYPERVISOR_MEDIA_EX_PROTOCOL, members are NULL if not supported
+// by the provider. Check with HV_EFI_MEDIA_EX_SUPPORTS() before use.
+//
+
+typedef struct _LINUX_EFI_HYPERVISOR_MEDIA_EX_PROTOCOL {
+    UINT32                                  Version;  //  ..._EX_VERSION
+    UINT32                                  Size;     //  Size of the protocol
+    HV_EFI_GET_MEMORY_MAP_INDEX_ROUTINE     HvlGetMemoryMapIndex;
+    HV_EFI_GET_MEMORY_MAP_EX_ROUTINE        HvlGetMemoryMapEx;
+    HV_EFI_GET_MEMORY_MAP_CHANGES_ROUTINE   HvlGetMemoryMapChanges;
+    HV_EFI_REGISTER_RUNTIME_RANGES_ROUTINE  HvlRegisterRuntimeRanges;
+    HV_EFI_GET_LOG_MESSAGES_ROUTINE         HvlGetLogMessages;
+} LINUX_EFI_HYPERVISOR_MEDIA_EX_PROTOCOL;
+
 #endif // !__HVEFI_H__
\ No newline at end of file
@@ -25,6 +25,7 @@
 #include <Guid/FileInfo.h>
 
 #include "HvLoaderEfi.h"
+#include "HvLoaderNuma.h"
 #include "HvLoaderP.h"
 
 
@@ -34,6 +35,11 @@
 
 EFI_GUID gEfiShimLockProtocolGuid = EFI_SHIM_LOCK_GUID;
 
+//
+// Root of the volume where HvLoader.efi resides, see HvlGetVolumeRoot().
+//
+EFI_FILE_HANDLE mHvlFsRoot = NULL;
+
 //
 // ------------------------------------------------------------------ Functions
 //
@@ -82,7 +88,8 @@ Done:
 
 /**
   Gets the hypervisor loader binary (DLL) file path from command line.
-  The DLL path should be the first command line option!
+  The DLL path should be the first command line option, or in HVL_TEST
+  builds, the second one following '--Bench[=N]'!
 
   Note:
     This function uses "unsafe" string functions such as StrLen(), and 
@@ -110,9 +117,13 @@ HvlGetHvLoaderDllPath (
   )
 {
 
-  UINT32  MaxPathSize;
-  CHAR16* Path;
-  UINT32  PathSize;
+  UINT32      MaxPathSize;
+  CHAR16*     Path;
+  UINT32      PathSize;
+#if HVL_TEST
+  UINTN       BenchLength;
+  EFI_STATUS  Status;
+#endif // HVL_TEST
 
   *Flags = 0;
 
@@ -151,10 +162,42 @@ HvlGetHvLoaderDllPath (
 
   CopyMem(*HvLoaderDllPath, Path, PathSize);
 
+#if HVL_TEST
+  //
+  // A benchmark run takes the loader DLL path from the option following
+  // '--Bench[=N]', or uses the default path.
+  //
+
+  BenchLength = StrLen(HVL_CMDLINE__BENCH_RUN);
+
+  if (!StrnCmp(*HvLoaderDllPath, HVL_CMDLINE__BENCH_RUN, BenchLength) &&
+      (((*HvLoaderDllPath)[BenchLength] == CHAR_NULL) ||
+       ((*HvLoaderDllPath)[BenchLength] == (CHAR16)'='))) {
+    SET_FLAGS(*Flags, HVL_PATH_FLAG__BENCH_RUN);
+    FreePool(*HvLoaderDllPath);
+
+    Status = HvlGetCmdLineOption(LoadedImage, 1, HvLoaderDllPath);
+    if (Status == EFI_NOT_FOUND) {
+      *HvLoaderDllPath = AllocateCopyPool(
+                           StrSize(HVL_DEF_LOADER_DLL_PATH),
+                           HVL_DEF_LOADER_DLL_PATH
+                           );
+
+      Status = (*HvLoaderDllPath == NULL) ? EFI_OUT_OF_RESOURCES : EFI_SUCCESS;
+    }
+
+    if (EFI_ERROR(Status)) {
+      return Status;
+    }
+  }
+#endif // HVL_TEST
+
   if (!StrCmp(*HvLoaderDllPath, HVL_DEF_LOADER_DLL_PATH)) {
     SET_FLAGS(*Flags, HVL_PATH_FLAG__DEF_PATH);
   } else if (!StrCmp(*HvLoaderDllPath, HVL_CMDLINE__TEST_RUN)) {
     SET_FLAGS(*Flags, HVL_PATH_FLAG__TEST_RUN);
+  } else if (!StrCmp(*HvLoaderDllPath, HVL_CMDLINE__TEST_MOCK)) {
+    SET_FLAGS(*Flags, HVL_PATH_FLAG__TEST_RUN | HVL_PATH_FLAG__TEST_MOCK);
   }
 
   return EFI_SUCCESS;
@@ -162,34 +205,34 @@ HvlGetHvLoaderDllPath (
 
 
 /**
-  Get file size.
+  Get file information.
 
   @param[in]  FileHandle Handle of the opened file.
-  @param[out] FileSize   Address of returned file size.
+  @param[out] FileInfo   Address of returned file information, to be freed
+                         by the caller.
 
-  @return EFI_SUCCESS    If file size was successfully acquired.
+  @return EFI_SUCCESS    If file information was successfully acquired.
   @return Others
 **/
 EFI_STATUS
-HvlGetFileSize (
-  IN  EFI_FILE_HANDLE DllFileHandle,
-  OUT UINTN           *DllFileSize
+HvlGetFileInfo (
+  IN  EFI_FILE_HANDLE FileHandle,
+  OUT EFI_FILE_INFO   **FileInfo
   )
 {
 
   UINTN         BufferSize;
-  EFI_FILE_INFO *DllFileInfo;
   EFI_STATUS    Status;
 
-  DllFileInfo = NULL;
+  *FileInfo = NULL;
 
   BufferSize = 0;
-  Status = DllFileHandle->GetInfo(
-                            DllFileHandle, 
-                            &gEfiFileInfoGuid, 
-                            &BufferSize, 
-                            NULL
-                            );
+  Status = FileHandle->GetInfo(
+                         FileHandle, 
+                         &gEfiFileInfoGuid, 
+                         &BufferSize, 
+                         NULL
+                         );
 
   if (Status != EFI_BUFFER_TOO_SMALL) {
     Print(
@@ -198,13 +241,17 @@ HvlGetFileSize (
       EFI_BUFFER_TOO_SMALL
       );
 
+    if (!EFI_ERROR(Status)) {
+      Status = EFI_PROTOCOL_ERROR;
+    }
+
     goto Done;
   }
 
-  DllFileInfo = AllocateZeroPool(BufferSize);
-  if (DllFileInfo == NULL) {
+  *FileInfo = AllocateZeroPool(BufferSize);
+  if (*FileInfo == NULL) {
     Print(
-      L"Error: Failed to allocated %d bytes, for DLL file information!\r\n",
+      L"Error: Failed to allocated %d bytes, for file information!\r\n",
       BufferSize
       );
 
@@ -212,30 +259,29 @@ HvlGetFileSize (
     goto Done;
   }
 
-  Status = DllFileHandle->GetInfo(
-                            DllFileHandle, 
-                            &gEfiFileInfoGuid, 
-                            &BufferSize, 
-                            DllFileInfo
-                            );
+  Status = FileHandle->GetInfo(
+                         FileHandle, 
+                         &gEfiFileInfoGuid, 
+                         &BufferSize, 
+                         *FileInfo
+                         );
 
   if (EFI_ERROR(Status)) {
     Print(
-      L"Error: Failed to get DLL file information, status %d!\r\n", 
+      L"Error: Failed to get file information, status %d!\r\n", 
       Status
       );
 
     goto Done;
   }
 
-  *DllFileSize = DllFileInfo->FileSize;
-
   Status = EFI_SUCCESS;
 
 Done:
 
-  if (DllFileInfo != NULL) {
-    FreePool(DllFileInfo);
+  if (EFI_ERROR(Status) && (*FileInfo != NULL)) {
+    FreePool(*FileInfo);
+    *FileInfo = NULL;
   }
 
   return Status;
@@ -243,34 +289,63 @@ Done:
 
 
 /**
-  Reads HV loader dll file to memory.
+  Get file size.
+
+  @param[in]  FileHandle Handle of the opened file.
+  @param[out] FileSize   Address of returned file size.
+
+  @return EFI_SUCCESS    If file size was successfully acquired.
+  @return Others
+**/
+EFI_STATUS
+HvlGetFileSize (
+  IN  EFI_FILE_HANDLE DllFileHandle,
+  OUT UINTN           *DllFileSize
+  )
+{
+
+  EFI_FILE_INFO *DllFileInfo;
+  EFI_STATUS    Status;
+
+  Status = HvlGetFileInfo(DllFileHandle, &DllFileInfo);
+  if (EFI_ERROR(Status)) {
+    return Status;
+  }
+
+  *DllFileSize = DllFileInfo->FileSize;
+
+  FreePool(DllFileInfo);
+
+  return EFI_SUCCESS;
+}
+
+
+/**
+  Gets the root of the volume where HvLoader.efi resides.
+  The volume root is opened once, and kept open until HvlCloseVolumeRoot()
+  is called.
 
   @param[in]  LoadedImage   The EFI_LOADED_IMAGE_PROTOCOL interface for 
                             this app.
-  @param[in]  DllFilePath   The hypervisor loader DLL file path.
-  @param[out] DllFileBuffer Address of returned HV loader DLL buffer.
-  @param[out] DllFileSize   Address of returned HV loader DLL buffer size.
+  @param[out] FsRoot        Address of returned volume root.
 
-  @return EFI_SUCCESS       If DLL file was successfully read to memory buffer.
-  @return Others            If DLL file was not found, or we ran out of 
-                            resources.
+  @return EFI_SUCCESS       If the volume root was opened.
+  @return Others            Otherwise.
 **/
 EFI_STATUS
-HvlLoadLoaderDll (
+HvlGetVolumeRoot (
   IN  EFI_LOADED_IMAGE_PROTOCOL *LoadedImage,
-  IN  CHAR16                    *DllFilePath,
-  OUT VOID*                     *DllFileBuffer,
-  OUT UINTN                     *DllFileSize
+  OUT EFI_FILE_HANDLE           *FsRoot
   )
 {
 
-  EFI_FILE_HANDLE                 DllFileHandle;
-  EFI_FILE_HANDLE                 FsRoot;
   EFI_STATUS                      Status;
   EFI_SIMPLE_FILE_SYSTEM_PROTOCOL *Vol;
 
-  DllFileHandle = NULL;
-  FsRoot = NULL;
+  if (mHvlFsRoot != NULL) {
+    *FsRoot = mHvlFsRoot;
+    return EFI_SUCCESS;
+  }
 
   //
   // Get the volume where hvloader.efi resides.
@@ -289,91 +364,237 @@ HvlLoadLoaderDll (
       Status
       );
 
-    goto Done;
+    return Status;
   }
 
   //
   // Get volume root.
   //
 
-  Status = Vol->OpenVolume(Vol, &FsRoot);
+  Status = Vol->OpenVolume(Vol, &mHvlFsRoot);
   if (EFI_ERROR(Status)) {
     Print(L"Error: Opening FS root failed, status %d!\r\n", Status);
-    goto Done;
+    mHvlFsRoot = NULL;
+    return Status;
+  }
+
+  *FsRoot = mHvlFsRoot;
+
+  return EFI_SUCCESS;
+}
+
+
+/**
+  Closes the volume root opened by HvlGetVolumeRoot().
+
+  @return None
+**/
+VOID
+HvlCloseVolumeRoot (
+  VOID
+  )
+{
+
+  if (mHvlFsRoot != NULL) {
+    mHvlFsRoot->Close(mHvlFsRoot);
+    mHvlFsRoot = NULL;
+  }
+}
+
+
+/**
+  Opens a file for reading, and gets its size.
+
+  @param[in]  LoadedImage   The EFI_LOADED_IMAGE_PROTOCOL interface for 
+                            this app.
+  @param[in]  FilePath      The file path, relative to the volume root.
+  @param[out] FileHandle    Address of returned file handle.
+  @param[out] FileSize      Address of returned file size.
+
+  @return EFI_SUCCESS       If the file was opened.
+  @return Others            Otherwise.
+**/
+EFI_STATUS
+HvlOpenFile (
+  IN  EFI_LOADED_IMAGE_PROTOCOL *LoadedImage,
+  IN  CONST CHAR16              *FilePath,
+  OUT EFI_FILE_HANDLE           *FileHandle,
+  OUT UINTN                     *FileSize
+  )
+{
+
+  EFI_FILE_HANDLE FsRoot;
+  EFI_STATUS      Status;
+
+  *FileHandle = NULL;
+
+  Status = HvlGetVolumeRoot(LoadedImage, &FsRoot);
+  if (EFI_ERROR(Status)) {
+    return Status;
   }
 
   //
-  // Open the loader DLL file. Path is relative to efi partition.
+  // Open the file. Path is relative to efi partition.
   //
 
   Status = FsRoot->Open(
                     FsRoot, 
-                    &DllFileHandle, 
-                    DllFilePath, 
+                    FileHandle, 
+                    (CHAR16 *)FilePath, 
                     EFI_FILE_MODE_READ, 
                     EFI_FILE_READ_ONLY
                     );
 
   if (EFI_ERROR(Status)) {
     Print(
-      L"Error: Failed to open DLL file %s, status %d!\r\n", 
-      DllFilePath, 
+      L"Error: Failed to open file %s, status %d!\r\n", 
+      FilePath, 
       Status
       );
 
-    goto Done;
+    *FileHandle = NULL;
+    return Status;
   }
 
   //
-  // Get DLL file size information.
+  // Get file size information.
   //
 
-  Status = HvlGetFileSize(DllFileHandle, DllFileSize);
+  Status = HvlGetFileSize(*FileHandle, FileSize);
   if (EFI_ERROR(Status)) {
     Print(
-      L"Error: Failed to get DLL file information, status %d!\r\n", 
+      L"Error: Failed to get file information, status %d!\r\n", 
       Status
       );
 
-    goto Done;
+    (*FileHandle)->Close(*FileHandle);
+    *FileHandle = NULL;
+    return Status;
   }
 
-  //
-  // Allocate a buffer and read the DLL file to memory.
-  //
+  return EFI_SUCCESS;
+}
 
-  *DllFileBuffer = AllocateZeroPool(*DllFileSize);
-  if (*DllFileBuffer == NULL) {
-    Print(
-      L"Error: Failed to allocate DLL file buffer, size %d!\r\n", 
-      DllFileSize
-      );
 
-    Status = EFI_OUT_OF_RESOURCES;
-    goto Done;
+/**
+  Gets the size and modification time of a file, so a file replaced in
+  place can be told apart from the one it replaced.
+  Unlike HvlOpenFile(), nothing is printed for a missing file.
+
+  @param[in]  LoadedImage       The EFI_LOADED_IMAGE_PROTOCOL interface for
+                                this app.
+  @param[in]  FilePath          The file path, relative to the volume root.
+  @param[out] FileSize          Address of returned file size.
+  @param[out] ModificationTime  Address of returned modification time.
+
+  @return EFI_SUCCESS           If the file information was acquired.
+  @return EFI_NOT_FOUND         If the file does not exist.
+  @return Others                Otherwise.
+**/
+EFI_STATUS
+HvlGetFileStamp (
+  IN  EFI_LOADED_IMAGE_PROTOCOL *LoadedImage,
+  IN  CONST CHAR16              *FilePath,
+  OUT UINT64                    *FileSize,
+  OUT EFI_TIME                  *ModificationTime
+  )
+{
+
+  EFI_FILE_HANDLE FileHandle;
+  EFI_FILE_INFO   *FileInfo;
+  EFI_FILE_HANDLE FsRoot;
+  EFI_STATUS      Status;
+
+  Status = HvlGetVolumeRoot(LoadedImage, &FsRoot);
+  if (EFI_ERROR(Status)) {
+    return Status;
   }
 
-  Status = DllFileHandle->Read(DllFileHandle, DllFileSize, *DllFileBuffer);
+  Status = FsRoot->Open(
+                    FsRoot,
+                    &FileHandle,
+                    (CHAR16 *)FilePath,
+                    EFI_FILE_MODE_READ,
+                    EFI_FILE_READ_ONLY
+                    );
+
   if (EFI_ERROR(Status)) {
-    Print(
-      L"Error: Failed to read DLL file, status %d size %d!\r\n", 
-      Status, 
-      DllFileSize
-      );
+    return Status;
+  }
 
-    goto Done;
+  Status = HvlGetFileInfo(FileHandle, &FileInfo);
+  FileHandle->Close(FileHandle);
+  if (EFI_ERROR(Status)) {
+    return Status;
   }
 
-  Status = EFI_SUCCESS;
+  *FileSize = FileInfo->FileSize;
+  CopyMem(ModificationTime, &FileInfo->ModificationTime, sizeof(EFI_TIME));
 
-Done:
+  FreePool(FileInfo);
 
-  if (DllFileHandle != NULL) {
-    DllFileHandle->Close(DllFileHandle);
+  return EFI_SUCCESS;
+}
+
+
+/**
+  Gets a copy of the EFI memory map.
+  The copy has room for a few more descriptors, so the caller may allocate
+  pages based on it, and the map may grow.
+
+  @param[out] EfiMemoryMap      The memory map, to be freed by the caller.
+  @param[out] EfiMemoryMapSize  The memory map size.
+  @param[out] DescriptorSize    The memory descriptor size.
+
+  @return EFI_SUCCESS           If the memory map was copied.
+  @return Others                Otherwise.
+**/
+EFI_STATUS
+HvlGetEfiMemoryMap (
+  OUT EFI_MEMORY_DESCRIPTOR **EfiMemoryMap,
+  OUT UINTN                 *EfiMemoryMapSize,
+  OUT UINTN                 *DescriptorSize
+  )
+{
+
+  UINT32      DescriptorVersion;
+  UINTN       MapKey;
+  EFI_STATUS  Status;
+
+  *EfiMemoryMap = NULL;
+  *EfiMemoryMapSize = 0;
+
+  Status = gBS->GetMemoryMap(
+                  EfiMemoryMapSize,
+                  NULL,
+                  &MapKey,
+                  DescriptorSize,
+                  &DescriptorVersion
+                  );
+
+  while (Status == EFI_BUFFER_TOO_SMALL) {
+    if (*EfiMemoryMap != NULL) {
+      FreePool(*EfiMemoryMap);
+    }
+
+    *EfiMemoryMapSize += 4 * (*DescriptorSize);
+    *EfiMemoryMap = AllocatePool(*EfiMemoryMapSize);
+    if (*EfiMemoryMap == NULL) {
+      return EFI_OUT_OF_RESOURCES;
+    }
+
+    Status = gBS->GetMemoryMap(
+                    EfiMemoryMapSize,
+                    *EfiMemoryMap,
+                    &MapKey,
+                    DescriptorSize,
+                    &DescriptorVersion
+                    );
   }
 
-  if(FsRoot != NULL) {
-    FsRoot->Close(FsRoot);
+  if (EFI_ERROR(Status) && (*EfiMemoryMap != NULL)) {
+    FreePool(*EfiMemoryMap);
+    *EfiMemoryMap = NULL;
   }
 
   return Status;
@@ -393,6 +614,7 @@ Done:
 
   @return EFI_SUCCESS     File content is verified, and TPM PCRs are extended
                           file's hash.
+  @return EFI_SECURITY_VIOLATION  File content failed verification.
   @return Others          Otherwise.
 **/
 EFI_STATUS
@@ -419,7 +641,7 @@ HvlShimVerify (
   Status = ShimLock->Verify(Contet, ContetSize);
   if (EFI_ERROR(Status)) {
     Print(L"Error: SHIM_LOCK verification failed, status %d!\r\n", Status);
-    return Status;
+    return EFI_SECURITY_VIOLATION;
   }
 
   return EFI_SUCCESS;
@@ -427,100 +649,246 @@ HvlShimVerify (
 
 
 /**
-  Loads and relocates a PE/COFF image.
+  Allocates the pages of a PE/COFF image, per its load options.
 
-  @param[in]  PeCoffImage     Point to a Pe/Coff image.
-  @param[out] LoadedImageInfo The loaded image information.
+  @param[in]  Options         The image load options.
+  @param[in]  Pages           The image page count.
+  @param[out] Address         The image pages address.
+  @param[out] ProximityDomain The proximity domain of the pages, or
+                              HVL_PROXIMITY_DOMAIN_NONE.
 
-  @return EFI_SUCCESS         If the image is loaded and relocated 
-                              successfully.
-  @return Others              If the image failed to load or relocate.
+  @return EFI_SUCCESS         If the pages were allocated.
+  @return Others              Otherwise.
 **/
 EFI_STATUS
-HvlLoadPeCoffImage (
-  IN  VOID                  *PeCoffImage,
-  OUT HVL_LOADED_IMAGE_INFO *LoadedImageInfo
+HvlAllocateImagePages (
+  IN  CONST HVL_IMAGE_LOAD_OPTIONS  *Options,
+  IN  UINTN                         Pages,
+  OUT EFI_PHYSICAL_ADDRESS          *Address,
+  OUT UINT32                        *ProximityDomain
   )
 {
 
-  PHYSICAL_ADDRESS              ImageBuffer;
-  PE_COFF_LOADER_IMAGE_CONTEXT  ImageContext;
-  UINTN                         ImagePages;
-  EFI_STATUS                    Status;
+  *ProximityDomain = HVL_PROXIMITY_DOMAIN_NONE;
 
-  ZeroMem(&ImageContext, sizeof(ImageContext));
-  ImageContext.Handle    = PeCoffImage;
-  ImageContext.ImageRead = PeCoffLoaderImageReadFromMemory;
+  switch (Options->Placement) {
+  case HVL_IMAGE_PLACE_BSP_NODE:
+    return HvlNumaAllocatePages(
+             Options->MemoryType,
+             Pages,
+             Address,
+             ProximityDomain
+             );
 
-  ImageBuffer = 0;
-  ImagePages  = 0;
+  case HVL_IMAGE_PLACE_ANY:
+    return gBS->AllocatePages(
+                  AllocateAnyPages,
+                  Options->MemoryType,
+                  Pages,
+                  Address
+                  );
 
-  Status = PeCoffLoaderGetImageInfo(&ImageContext);
-  if (EFI_ERROR (Status)) {
-    Print(L"Error: PeCoffLoaderGetImageInfo failed, status %d!\r\n", Status);
-    goto Done;
+  case HVL_IMAGE_PLACE_MAX_ADDRESS:
+    *Address = Options->Address;
+    return gBS->AllocatePages(
+                  AllocateMaxAddress,
+                  Options->MemoryType,
+                  Pages,
+                  Address
+                  );
+
+  case HVL_IMAGE_PLACE_ADDRESS:
+    *Address = Options->Address;
+    return gBS->AllocatePages(
+                  AllocateAddress,
+                  Options->MemoryType,
+                  Pages,
+                  Address
+                  );
+
+  default:
+    return EFI_INVALID_PARAMETER;
   }
+}
+
+
+/**
+  Frees the pages of a PE/COFF image, allocated by HvlAllocateImagePages().
+
+  @param[in]  Address     The image pages address.
+  @param[in]  Pages       The image page count.
+
+  @return None
+**/
+VOID
+HvlFreeImagePages (
+  IN  EFI_PHYSICAL_ADDRESS  Address,
+  IN  UINTN                 Pages
+  )
+{
+
+  gBS->FreePages(Address, Pages);
+}
+
+
+/**
+  Launches the HV loader DLL of a loader slot: reads, verifies, loads and
+  relocates the DLL, and calls its entry point.
+
+  @param[in]      ImageHandle   The firmware allocated handle for the EFI
+                                image.
+  @param[in]      SystemTable   A pointer to the EFI System Table.
+  @param[in]      LoadedImage   The EFI_LOADED_IMAGE_PROTOCOL interface for
+                                this app.
+  @param[in]      DllFilePath   The slot DLL file path.
+  @param[in,out]  DllImageInfo  The loaded image information, the loaded
+                                image is freed on failure.
+  @param[out]     Timing        The phase times, and DLL file size.
+  @param[out]     Phase         The HVL_LAUNCH_PHASE_* the launch ended in.
+
+  @return EFI_SUCCESS           If the hypervisor loader succeeded.
+  @return EFI_NOT_FOUND         If the slot DLL file was not found, in the
+                                HVL_LAUNCH_PHASE_READ phase.
+  @return Others                If the slot failed.
+**/
+EFI_STATUS
+HvlLaunchLoaderDll (
+  IN      EFI_HANDLE                ImageHandle,
+  IN      EFI_SYSTEM_TABLE          *SystemTable,
+  IN      EFI_LOADED_IMAGE_PROTOCOL *LoadedImage,
+  IN      CHAR16                    *DllFilePath,
+  IN OUT  HVL_LOADED_IMAGE_INFO     *DllImageInfo,
+  OUT     HVL_TIMING_RECORD         *Timing,
+  OUT     UINT32                    *Phase
+  )
+{
+
+  VOID                      *DllFileBuffer;
+  UINTN                     DllFileSize;
+  UINT64                    PhaseStart;
+  EFI_STATUS                Status;
+#if HVL_FOOTPRINT
+  HVL_FOOTPRINT_SNAPSHOT    Footprint;
+  EFI_STATUS                FootprintStatus;
+#endif // HVL_FOOTPRINT
+
+  DllFileBuffer = NULL;
+  Timing->DllSize = 0;
+  Timing->ReadUs = 0;
+  Timing->VerifyUs = 0;
+  Timing->LoadUs = 0;
+  Timing->EntryUs = 0;
 
   //
-  // Allocate Memory for the image.
-  // We use memory type of HVL_IMAGE_MEMORY_TYPE, and save it in the loaded
-  // image information. HV loader DLL can mark these pages as 
-  // EfiConventionalMemory so the guest kernel can reclaim those.
+  // Read HV loader DLL file to memory.
   //
 
-  ImagePages = EFI_SIZE_TO_PAGES(ImageContext.ImageSize);
+  *Phase = HVL_LAUNCH_PHASE_READ;
+  PhaseStart = HvlTimingStart();
+  Status = HvlLoadLoaderDll(
+              LoadedImage, 
+              DllFilePath, 
+              &DllFileBuffer, 
+              &DllFileSize
+              );
 
-  Status = gBS->AllocatePages (
-                  AllocateAnyPages,
-                  HVL_IMAGE_MEMORY_TYPE,
-                  ImagePages,
-                  &ImageBuffer
-                  );
+  Timing->ReadUs = HvlTimingElapsedUs(PhaseStart);
+
+  if (EFI_ERROR(Status)) {
+    if (Status != EFI_NOT_FOUND) {
+      Print(
+        L"Error: Failed to load DLL file to memory, status %d!\r\n",
+        Status
+        );
+    }
 
-  if (EFI_ERROR (Status)) {
-    Print(L"Error: AllocatePages failed, status %d!\r\n", Status);
     goto Done;
-  }
+  }    
 
-  ImageContext.ImageAddress = ImageBuffer;
+  //
+  // Verify the file is correctly signed, and extend the TPM PCRs with 
+  // file's hash.
+  //
+
+  Timing->DllSize = (UINT32)DllFileSize;
+
+  *Phase = HVL_LAUNCH_PHASE_VERIFY;
+  PhaseStart = HvlTimingStart();
+  Status = HvlShimVerify(DllFileBuffer, DllFileSize);
+  Timing->VerifyUs = HvlTimingElapsedUs(PhaseStart);
+
+  if (EFI_ERROR(Status)) {
+    Print(L"Error: DLL file verification failed, status %d!\r\n", Status);
+    goto Done;
+  }    
 
   //
-  // Load the image to our new buffer.
+  // Load HV loader DLL (PE/COFF) image from buffer.
   //
 
-  Status = PeCoffLoaderLoadImage(&ImageContext);
-  if (EFI_ERROR (Status)) {
-    Print(L"Error: PeCoffLoaderLoadImage failed, status %d!\r\n", Status);
+  *Phase = HVL_LAUNCH_PHASE_LOAD;
+  PhaseStart = HvlTimingStart();
+  Status = HvlLoadPeCoffImage(DllFileBuffer, NULL, DllImageInfo);
+  Timing->LoadUs = HvlTimingElapsedUs(PhaseStart);
+
+  if (EFI_ERROR(Status)) {
+    Print(L"Error: Failed to load PE/COFF image, status %d!\r\n", Status);
     goto Done;
   }
 
+  HvlLog(
+    L"HvLoader: loader image 0x%lx pages %d entry 0x%lx",
+    DllImageInfo->ImageAddress,
+    DllImageInfo->ImagePages,
+    DllImageInfo->EntryPoint
+    );
+
+#if HVL_FOOTPRINT
+  FootprintStatus = HvlFootprintSnapshot(&Footprint);
+#endif // HVL_FOOTPRINT
+
   //
-  // Relocate the image in our new buffer.
+  // Call the hypervisor loader entrypoint to load the hypervisor
+  // and register the hypervisor protocol to be used by the guest kernel.
   //
 
-  Status = PeCoffLoaderRelocateImage(&ImageContext);
-  if (EFI_ERROR (Status)) {
-    Print(L"Error: PeCoffLoaderRelocateImage failed, status %d!\r\n", Status);
-    goto Done;
+  *Phase = HVL_LAUNCH_PHASE_ENTRY;
+  PhaseStart = HvlTimingStart();
+  Status = ((HV_LOADER_IMAGE_ENTRY_POINT)DllImageInfo->EntryPoint)(
+                                            ImageHandle, 
+                                            SystemTable,
+                                            DllImageInfo
+                                            );
+
+  Timing->EntryUs = HvlTimingElapsedUs(PhaseStart);
+
+#if HVL_FOOTPRINT
+  if (!EFI_ERROR(FootprintStatus)) {
+    HvlFootprintReport(&Footprint, DllImageInfo);
   }
+#endif // HVL_FOOTPRINT
 
-  LoadedImageInfo->Version          = HVL_VERSION;
-  LoadedImageInfo->Size             = sizeof(*LoadedImageInfo);
-  LoadedImageInfo->Flags            = HVL_FLAG_ENV_EFI;
-  LoadedImageInfo->ImageAddress     = ImageContext.ImageAddress;
-  LoadedImageInfo->ImageSize        = ImageContext.ImageSize;
-  LoadedImageInfo->ImagePages       = ImagePages;
-  LoadedImageInfo->ImageMemoryType  = HVL_IMAGE_MEMORY_TYPE;
-  LoadedImageInfo->EntryPoint       = ImageContext.EntryPoint;
+  if (EFI_ERROR(Status)) {
+    if (Status == EFI_SECURITY_VIOLATION) {
+      Print(L"Error: Hypervisor failed security verification!\r\n");
+    } else {
+      Print(L"Error: HV loader failed, status %d!\r\n", Status);
+    }
+    goto Done;
+  }
 
   Status = EFI_SUCCESS;
 
 Done:
 
-  if (EFI_ERROR(Status)) {
-    if (ImageBuffer != 0) {
-      gBS->FreePages(ImageBuffer, ImagePages);
-    }
+  if (EFI_ERROR(Status) && (DllImageInfo->ImageAddress != 0)) {
+    HvlFreeImagePages(DllImageInfo->ImageAddress, DllImageInfo->ImagePages);
+    DllImageInfo->ImageAddress = 0;
+    DllImageInfo->ImagePages = 0;
+  }
+
+  if (DllFileBuffer != NULL) {
+    FreePool(DllFileBuffer);
   }
 
   return Status;
@@ -550,17 +918,21 @@ UefiMain (
   IN EFI_SYSTEM_TABLE  *SystemTable
   )
 {
+  HVL_CMDLINE_TABLE         *CmdLineTable;
   CHAR16                    *DllFilePath;
-  VOID                      *DllFileBuffer;
-  UINTN                     DllFileSize;
   UINT32                    DllPathFlags;
   HVL_LOADED_IMAGE_INFO     DllImageInfo;
+  UINTN                     Index;
+  UINT32                    LaunchPhase;
   EFI_LOADED_IMAGE_PROTOCOL *LoadedImage;
+  UINTN                     Slot;
+  HVL_SLOTS                 Slots;
   EFI_STATUS                Status;
+  HVL_TIMING_RECORD         Timing;
 
   Print(L"Hvloader.efi starting...\r\n");
   
-  DllFileBuffer       = NULL;
+  CmdLineTable        = NULL;
   DllFilePath         = NULL;
   DllPathFlags        = 0;
   ZeroMem(&DllImageInfo, sizeof(DllImageInfo));
@@ -594,80 +966,118 @@ UefiMain (
 
 #if HVL_TEST
   if (CHECK_FLAG(DllPathFlags, HVL_PATH_FLAG__TEST_RUN)) {
-    HvlTestRun();
+    Status = HvlTestRun(
+                CHECK_FLAG(DllPathFlags, HVL_PATH_FLAG__TEST_MOCK) != 0
+                );
+
+    goto Done;
+  }
+
+  if (CHECK_FLAG(DllPathFlags, HVL_PATH_FLAG__BENCH_RUN)) {
+    Status = HvlBenchRun(LoadedImage, DllFilePath);
     goto Done;
   }
 #endif // HVL_TEST
 
   //
-  // Read HV loader DLL file to memory.
+  // Tokenize the command line once, for the hypervisor loader to use.
   //
 
-  Status = HvlLoadLoaderDll(
-              LoadedImage, 
-              DllFilePath, 
-              &DllFileBuffer, 
-              &DllFileSize
-              );
+  Status = HvlBuildCmdLineTable(LoadedImage, &CmdLineTable);
+  if (EFI_ERROR(Status)) {
+    Print(L"Error: Failed to parse command line, status %d!\r\n", Status);
+    goto Done;
+  }
+
+  DllImageInfo.CommandLine = CmdLineTable;
 
   //
-  // If the given DLL file was not found, try the default path.
+  // Offer HvLoader.efi file I/O, allocation and logging services to the 
+  // hypervisor loader.
   //
 
-  if ((Status == EFI_NOT_FOUND) &&
-      (!CHECK_FLAG(DllPathFlags, HVL_PATH_FLAG__DEF_PATH))) {
-
-        Status = HvlLoadLoaderDll(
-                    LoadedImage, 
-                    HVL_DEF_LOADER_DLL_PATH, 
-                    &DllFileBuffer, 
-                    &DllFileSize
-                    );
-  }
-
-  if (EFI_ERROR(Status)) {
-    Print(L"Error: Failed to load DLL file to memory, status %d!\r\n", Status);
+  DllImageInfo.Services = HvlInitServices(LoadedImage);
+  if (DllImageInfo.Services == NULL) {
+    Print(L"Error: Failed to initialize loader services!\r\n");
+    Status = EFI_OUT_OF_RESOURCES;
     goto Done;
-  }    
+  }
 
   //
-  // Verify the file is correctly signed, and extend the TPM PCRs with 
-  // file's hash.
+  // Offer the HvLoader.efi image load pipeline to the launch chain, while
+  // the hypervisor loader runs.
   //
 
-  Status = HvlShimVerify(DllFileBuffer, DllFileSize);
+  Status = HvlInstallImageLoader(ImageHandle);
   if (EFI_ERROR(Status)) {
-    Print(L"Error: DLL file verification failed, status %d!\r\n", Status);
+    Print(L"Error: Failed to install image loader, status %d!\r\n", Status);
     goto Done;
-  }    
+  }
 
   //
-  // Load HV loader DLL (PE/COFF) image from buffer.
+  // Launch the HV loader DLL slots in order, until one succeeds.
+  // A failed slot moves straight to the next one, the error message delay
+  // is only taken once all slots failed.
+  // A slot that failed in its entry point ends the launch: the loaded image
+  // information, command line table, services and log ring were handed to
+  // that loader, and are not reused for another one.
   //
 
-  Status = HvlLoadPeCoffImage(DllFileBuffer, &DllImageInfo);
-  if (EFI_ERROR(Status)) {
-    Print(L"Error: Failed to load PE/COFF image, status %d!\r\n", Status);
-    goto Done;
+  HvlSlotsInit(LoadedImage, DllFilePath, &Slots);
+  ZeroMem(&Timing, sizeof(Timing));
+
+  LaunchPhase = HVL_LAUNCH_PHASE_READ;
+  Status = EFI_NOT_FOUND;
+  for (Index = 0; Index < Slots.Count; Index++) {
+    Slot = Slots.Order[Index];
+    Status = HvlLaunchLoaderDll(
+               ImageHandle,
+               SystemTable,
+               LoadedImage,
+               Slots.Paths[Slot],
+               &DllImageInfo,
+               &Timing,
+               &LaunchPhase
+               );
+
+    Timing.Slot = (UINT8)Slot;
+    Timing.Attempts = (UINT8)(Index + 1);
+
+    HvlSlotReport(&Slots, Slot, Status, LaunchPhase);
+    if (!EFI_ERROR(Status)) {
+      break;
+    }
+
+    Print(
+      L"Loader slot %s failed, status %d.\r\n",
+      Slots.Paths[Slot],
+      Status
+      );
+
+    if (LaunchPhase == HVL_LAUNCH_PHASE_ENTRY) {
+      break;
+    }
   }
 
+#if HVL_TIMING
   //
-  // Call the hypervisor loader entrypoint to load the hypervisor
-  // and register the hypervisor protocol to be used by the guest kernel.
+  // Keep this boot's phase times in the boot timing history.
   //
 
-  Status = ((HV_LOADER_IMAGE_ENTRY_POINT)DllImageInfo.EntryPoint)(
-                                            ImageHandle, 
-                                            SystemTable,
-                                            &DllImageInfo
-                                            );
+  if (EFI_ERROR(Status)) {
+    SET_FLAGS(Timing.Flags, HVL_TIMING_FLAG_FAILED);
+  }
+
+  HvlTimingSave(&Timing);
+#endif // HVL_TIMING
 
   if (EFI_ERROR(Status)) {
-    if (Status == EFI_SECURITY_VIOLATION) {
-      Print(L"Error: Hypervisor failed security verification!\r\n");
+    if (LaunchPhase == HVL_LAUNCH_PHASE_ENTRY) {
+      Print(L"Error: Loader entry point failed, status %d!\r\n", Status);
     } else {
-      Print(L"Error: HV loader failed, status %d!\r\n", Status);
+      Print(L"Error: All loader slots failed, status %d!\r\n", Status);
     }
+
     goto Done;
   }
 
@@ -687,22 +1097,23 @@ Done:
 
     Sleep(HVL_ERROR_MESSAGE_DELAY_MS);
 
-    if (DllImageInfo.ImageAddress != 0) {
-      gBS->FreePages(DllImageInfo.ImageAddress, DllImageInfo.ImagePages);
+    if (CmdLineTable != NULL) {
+      FreePool(CmdLineTable);
     }
+
+    HvlFreeServices();
   }
 
   //
   // General cleanup
   //
 
+  HvlUninstallImageLoader();
+  HvlCloseVolumeRoot();
+
   if (DllFilePath != NULL) {
     FreePool(DllFilePath);
   }
 
-  if (DllFileBuffer != NULL) {
-    FreePool(DllFileBuffer);
-  }
-  
   return Status;
-}
\ No newline at end of file
+}
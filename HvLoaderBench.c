@@ -0,0 +1,365 @@
+/** @file
+  This is a benchmark of the hypervisor loader DLL load pipeline.
+  It repeatedly reads, verifies, loads and relocates the loader DLL, without
+  calling its entry point, and reports per phase statistics.
+
+  This code is used for testing purposes only and is not part of production
+  images!
+
+  Note:
+    Phase timing uses TimerLib. The platform DSC should map TimerLib to a
+    real timer library instance (for example
+    UefiCpuPkg/Library/SecPeiDxeTimerLibCpu/SecPeiDxeTimerLibCpu.inf, see
+    README.md), the NULL template instance ASSERTs in DEBUG builds, and
+    reports all times as 0 otherwise.
+
+  Copyright (c) Microsoft Corporation.
+  Licensed under the MIT License.
+
+**/
+
+#include <stddef.h>
+#include <Uefi.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/TimerLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/UefiLib.h>
+#include <Protocol/LoadedImage.h>
+
+#include "HvLoaderEfi.h"
+#include "HvLoaderP.h"
+
+#if HVL_TEST
+#include "HvLoaderTest.h"
+
+//
+// -------------------------------------------------------------------- Defines
+//
+
+//
+// Benchmark phases.
+//
+#define HVL_BENCH_PHASE_READ    0
+#define HVL_BENCH_PHASE_VERIFY  1
+#define HVL_BENCH_PHASE_LOAD    2
+#define HVL_BENCH_PHASE_TOTAL   3
+#define HVL_BENCH_PHASE_COUNT   4
+
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+CHAR16 *mHvlBenchPhaseNames[HVL_BENCH_PHASE_COUNT] = {
+  L"Read",
+  L"Verify",
+  L"Load+Reloc",
+  L"Total"
+};
+
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+/**
+  Gets the benchmark iteration count from the '--Bench[=N]' option, the
+  first command line option.
+
+  @param[in]  LoadedImage The EFI_LOADED_IMAGE_PROTOCOL interface for
+                          this app.
+
+  @return The iteration count, HVL_BENCH_DEF_ITERATIONS if N is not given,
+          clipped to [1, HVL_BENCH_MAX_ITERATIONS].
+**/
+UINTN
+HvlBenchGetIterations (
+  IN  EFI_LOADED_IMAGE_PROTOCOL *LoadedImage
+  )
+{
+
+  CHAR16  *BenchOption;
+  UINTN   Iterations;
+  CHAR16  *Value;
+
+  if (EFI_ERROR(HvlGetCmdLineOption(LoadedImage, 0, &BenchOption))) {
+    return HVL_BENCH_DEF_ITERATIONS;
+  }
+
+  Iterations = HVL_BENCH_DEF_ITERATIONS;
+
+  Value = BenchOption + StrLen(HVL_CMDLINE__BENCH_RUN);
+  if (*Value == (CHAR16)'=') {
+    Iterations = StrDecimalToUintn(Value + 1);
+    if (Iterations == 0) {
+      Iterations = 1;
+    } else if (Iterations > HVL_BENCH_MAX_ITERATIONS) {
+      Iterations = HVL_BENCH_MAX_ITERATIONS;
+    }
+  }
+
+  FreePool(BenchOption);
+
+  return Iterations;
+}
+
+
+/**
+  Sorts an array of samples in ascending order.
+  Sample counts are bounded by HVL_BENCH_MAX_ITERATIONS, so insertion sort
+  is good enough.
+
+  @param[in,out]  Samples     The samples to sort.
+  @param[in]      SampleCount Number of samples.
+
+  @return None
+**/
+VOID
+HvlBenchSortSamples (
+  IN OUT  UINT64  *Samples,
+  IN      UINTN   SampleCount
+  )
+{
+
+  UINTN   Index;
+  UINTN   Position;
+  UINT64  Sample;
+
+  for (Index = 1; Index < SampleCount; Index++) {
+    Sample = Samples[Index];
+    Position = Index;
+
+    while ((Position > 0) && (Samples[Position - 1] > Sample)) {
+      Samples[Position] = Samples[Position - 1];
+      Position--;
+    }
+
+    Samples[Position] = Sample;
+  }
+}
+
+
+/**
+  Prints min, median and p99 statistics of a benchmark phase.
+
+  @param[in]      PhaseName   The phase name.
+  @param[in,out]  Samples     Phase samples in nSec, sorted on return.
+  @param[in]      SampleCount Number of samples.
+  @param[in]      Bytes       Number of bytes processed in each sample,
+                              or 0 for not reporting throughput.
+
+  @return None
+**/
+VOID
+HvlBenchPrintPhase (
+  IN      CHAR16  *PhaseName,
+  IN OUT  UINT64  *Samples,
+  IN      UINTN   SampleCount,
+  IN      UINTN   Bytes
+  )
+{
+
+  UINT64  Median;
+  UINT64  P99;
+  UINT64  Throughput;
+
+  HvlBenchSortSamples(Samples, SampleCount);
+
+  Median = Samples[(SampleCount - 1) / 2];
+  P99 = Samples[((SampleCount * 99) + 99) / 100 - 1];
+
+  //
+  // Throughput in bytes/sec, based on the median.
+  //
+
+  Throughput = 0;
+  if ((Bytes != 0) && (Median != 0)) {
+    Throughput = DivU64x64Remainder(MultU64x32(Bytes, 1000000), Median, NULL);
+    Throughput = MultU64x32(Throughput, 1000);
+  }
+
+  Print(
+    L"  %-10s min %8ld us median %8ld us p99 %8ld us %12ld B/s\r\n",
+    PhaseName,
+    DivU64x32(Samples[0], 1000),
+    DivU64x32(Median, 1000),
+    DivU64x32(P99, 1000),
+    Throughput
+    );
+}
+
+
+/**
+  Runs the HV loader DLL load pipeline benchmark.
+
+  The HV loader DLL is read, verified, loaded and relocated N times.
+  The loader entry point is never called, and all resources are freed between
+  runs.
+  If SHIM_LOCK protocol is not available (secure boot disabled, no shim), the
+  verify phase is skipped, so the benchmark can run under QEMU/OVMF.
+
+  @param[in]  LoadedImage   The EFI_LOADED_IMAGE_PROTOCOL interface for
+                            this app.
+  @param[in]  DllFilePath   The HV loader DLL path, from the command line.
+
+  @return EFI_SUCCESS       If all benchmark iterations completed.
+  @return Others            If any of the pipeline phases failed.
+**/
+EFI_STATUS
+HvlBenchRun (
+  IN  EFI_LOADED_IMAGE_PROTOCOL *LoadedImage,
+  IN  CHAR16                    *DllFilePath
+  )
+{
+
+  VOID                  *DllFileBuffer;
+  UINTN                 DllFileSize;
+  HVL_LOADED_IMAGE_INFO DllImageInfo;
+  UINTN                 Iteration;
+  UINTN                 Iterations;
+  UINT64                PhaseEnd;
+  UINT64                PhaseStart;
+  UINTN                 Phase;
+  UINT64                *Samples[HVL_BENCH_PHASE_COUNT];
+  VOID                  *ShimLock;
+  BOOLEAN               SkipVerify;
+  EFI_STATUS            Status;
+  UINT64                TotalStart;
+
+  Iterations = HvlBenchGetIterations(LoadedImage);
+  DllFileSize = 0;
+  ZeroMem(Samples, sizeof(Samples));
+
+  Print(
+    L"\r\nHvloader.efi benchmark starting, %s, %d iterations >>>\r\n",
+    DllFilePath,
+    Iterations
+    );
+
+  for (Phase = 0; Phase < HVL_BENCH_PHASE_COUNT; Phase++) {
+    Samples[Phase] = AllocateZeroPool(Iterations * sizeof(UINT64));
+    if (Samples[Phase] == NULL) {
+      Status = EFI_OUT_OF_RESOURCES;
+      goto Done;
+    }
+  }
+
+  SkipVerify = EFI_ERROR(gBS->LocateProtocol(
+                                &gEfiShimLockProtocolGuid,
+                                NULL,
+                                &ShimLock
+                                ));
+
+  if (SkipVerify) {
+    Print(L"No SHIM_LOCK protocol, skipping the verify phase.\r\n");
+  }
+
+  Status = EFI_SUCCESS;
+
+  for (Iteration = 0; Iteration < Iterations; Iteration++) {
+    DllFileBuffer = NULL;
+    ZeroMem(&DllImageInfo, sizeof(DllImageInfo));
+
+    //
+    // Read
+    //
+
+    TotalStart = GetPerformanceCounter();
+    PhaseStart = TotalStart;
+
+    Status = HvlLoadLoaderDll(
+                LoadedImage,
+                DllFilePath,
+                &DllFileBuffer,
+                &DllFileSize
+                );
+
+    PhaseEnd = GetPerformanceCounter();
+    Samples[HVL_BENCH_PHASE_READ][Iteration] =
+      GetTimeInNanoSecond(PhaseEnd - PhaseStart);
+
+    if (EFI_ERROR(Status)) {
+      goto IterationDone;
+    }
+
+    //
+    // Verify
+    //
+
+    if (!SkipVerify) {
+      PhaseStart = GetPerformanceCounter();
+      Status = HvlShimVerify(DllFileBuffer, (UINT32)DllFileSize);
+      PhaseEnd = GetPerformanceCounter();
+      Samples[HVL_BENCH_PHASE_VERIFY][Iteration] =
+        GetTimeInNanoSecond(PhaseEnd - PhaseStart);
+
+      if (EFI_ERROR(Status)) {
+        goto IterationDone;
+      }
+    }
+
+    //
+    // Load and relocate
+    //
+
+    PhaseStart = GetPerformanceCounter();
+    Status = HvlLoadPeCoffImage(DllFileBuffer, NULL, &DllImageInfo);
+    PhaseEnd = GetPerformanceCounter();
+    Samples[HVL_BENCH_PHASE_LOAD][Iteration] =
+      GetTimeInNanoSecond(PhaseEnd - PhaseStart);
+
+    Samples[HVL_BENCH_PHASE_TOTAL][Iteration] =
+      GetTimeInNanoSecond(PhaseEnd - TotalStart);
+
+IterationDone:
+
+    if (DllImageInfo.ImageAddress != 0) {
+      HvlFreeImagePages(DllImageInfo.ImageAddress, DllImageInfo.ImagePages);
+    }
+
+    if (DllFileBuffer != NULL) {
+      FreePool(DllFileBuffer);
+    }
+
+    if (EFI_ERROR(Status)) {
+      Print(
+        L"Error: Benchmark iteration %d failed, status %d!\r\n",
+        Iteration,
+        Status
+        );
+
+      goto Done;
+    }
+  }
+
+  Print(L"DLL file size %d bytes, %d iterations:\r\n", DllFileSize, Iterations);
+
+  for (Phase = 0; Phase < HVL_BENCH_PHASE_COUNT; Phase++) {
+    if ((Phase == HVL_BENCH_PHASE_VERIFY) && SkipVerify) {
+      continue;
+    }
+
+    HvlBenchPrintPhase(
+      mHvlBenchPhaseNames[Phase],
+      Samples[Phase],
+      Iterations,
+      DllFileSize
+      );
+  }
+
+Done:
+
+  Print(L"Hvloader.efi benchmark completed, status %d <<<\r\n", Status);
+
+  for (Phase = 0; Phase < HVL_BENCH_PHASE_COUNT; Phase++) {
+    if (Samples[Phase] != NULL) {
+      FreePool(Samples[Phase]);
+    }
+  }
+
+  return Status;
+}
+
+#endif // HVL_TEST
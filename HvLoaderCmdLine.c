@@ -0,0 +1,419 @@
+/** @file
+  HvLoader.efi command line tokenizer.
+  The command line is tokenized once into an HVL_CMDLINE_TABLE, passed to
+  the hypervisor loader, so configuration lookups are O(1) and there is a
+  single parsing implementation.
+
+  Copyright (c) Microsoft Corporation.
+  Licensed under the MIT License.
+
+**/
+
+#include <stddef.h>
+#include <Uefi.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/UefiLib.h>
+#include <Protocol/LoadedImage.h>
+
+#include "HvLoaderEfi.h"
+#include "HvLoaderP.h"
+
+
+//
+// -------------------------------------------------------------------- Defines
+//
+
+//
+// Minimum number of command line table hash buckets.
+//
+#define HVL_CMDLINE_MIN_BUCKETS   8
+#define HVL_CMDLINE_MAX_BUCKETS   0x8000
+
+//
+// Command line option separator, and key/value separator.
+//
+#define HVL_CMDLINE_SEPARATOR     ((CHAR16)' ')
+#define HVL_CMDLINE_ASSIGN        ((CHAR16)'=')
+
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+/**
+  Computes a command line key hash (FNV-1a 32 over CHAR16 units).
+
+  @param[in]  Key       The key.
+  @param[in]  KeyLength The key length in CHAR16 units.
+
+  @return The key hash.
+**/
+UINT32
+HvlCmdLineHash (
+  IN  CONST CHAR16  *Key,
+  IN  UINTN         KeyLength
+  )
+{
+
+  UINT32  Hash;
+  UINTN   Index;
+
+  Hash = HVL_CMDLINE_HASH_BASIS;
+  for (Index = 0; Index < KeyLength; Index++) {
+    Hash = (Hash ^ Key[Index]) * HVL_CMDLINE_HASH_PRIME;
+  }
+
+  return Hash;
+}
+
+
+/**
+  Looks up a command line option value, the way HVL_CMDLINE_TABLE documents
+  it for the hypervisor loader.
+
+  @param[in]  Table     The command line table.
+  @param[in]  Key       The option key, for example L"MSHV_ROOT".
+  @param[in]  KeyLength The key length in CHAR16 units.
+
+  @return The NULL terminated option value, an empty string for options
+          without a value, or NULL if the option is not found.
+**/
+CONST CHAR16 *
+HvlCmdLineLookup (
+  IN  CONST HVL_CMDLINE_TABLE *Table,
+  IN  CONST CHAR16            *Key,
+  IN  UINTN                   KeyLength
+  )
+{
+
+  CONST UINT16              *Buckets;
+  UINT32                    Hash;
+  UINTN                     Index;
+  CONST HVL_CMDLINE_RECORD  *Record;
+  CONST HVL_CMDLINE_RECORD  *Records;
+  UINT16                    RecordIndex;
+  CONST CHAR16              *Strings;
+
+  if ((Table == NULL) || (Table->Signature != HVL_CMDLINE_SIGNATURE)) {
+    return NULL;
+  }
+
+  Records = (CONST HVL_CMDLINE_RECORD *)
+              ((CONST UINT8 *)Table + Table->RecordsOffset);
+  Buckets = (CONST UINT16 *)((CONST UINT8 *)Table + Table->BucketsOffset);
+  Strings = (CONST CHAR16 *)((CONST UINT8 *)Table + Table->StringsOffset);
+
+  Hash = HvlCmdLineHash(Key, KeyLength);
+  RecordIndex = Buckets[Hash & (Table->BucketCount - 1)];
+
+  while (RecordIndex != HVL_CMDLINE_END) {
+    Record = &Records[RecordIndex];
+
+    if ((Record->KeyHash == Hash) && (Record->KeyLength == KeyLength)) {
+      for (Index = 0; Index < KeyLength; Index++) {
+        if (Strings[Record->KeyOffset + Index] != Key[Index]) {
+          break;
+        }
+      }
+
+      if (Index == KeyLength) {
+        return &Strings[Record->ValueOffset];
+      }
+    }
+
+    RecordIndex = Record->Next;
+  }
+
+  return NULL;
+}
+
+
+/**
+  Gets the next command line option.
+
+  @param[in]      CmdLine       The command line.
+  @param[in]      CmdLineLength The command line length in CHAR16 units.
+  @param[in,out]  Position      The current position, updated to the end of
+                                the returned option.
+  @param[out]     Option        The returned option start position.
+
+  @return The option length in CHAR16 units, 0 if there are no more options.
+**/
+UINTN
+HvlCmdLineNextOption (
+  IN      CONST CHAR16  *CmdLine,
+  IN      UINTN         CmdLineLength,
+  IN OUT  UINTN         *Position,
+  OUT     UINTN         *Option
+  )
+{
+
+  while ((*Position < CmdLineLength) &&
+         (CmdLine[*Position] == HVL_CMDLINE_SEPARATOR)) {
+    (*Position)++;
+  }
+
+  *Option = *Position;
+
+  while ((*Position < CmdLineLength) &&
+         (CmdLine[*Position] != HVL_CMDLINE_SEPARATOR)) {
+    (*Position)++;
+  }
+
+  return *Position - *Option;
+}
+
+
+/**
+  Tokenizes the HvLoader.efi command line into an HVL_CMDLINE_TABLE.
+  Each space separated option becomes a record, split into key and value
+  at the first '='.
+
+  @param[in]  LoadedImage   The EFI_LOADED_IMAGE_PROTOCOL interface for
+                            this app.
+  @param[out] CmdLineTable  The returned command line table, allocated from
+                            pool.
+
+  @return EFI_SUCCESS           If the command line was tokenized.
+  @return EFI_UNSUPPORTED       If the command line has too many options.
+  @return EFI_OUT_OF_RESOURCES  If the table could not be allocated.
+**/
+EFI_STATUS
+HvlBuildCmdLineTable (
+  IN  EFI_LOADED_IMAGE_PROTOCOL *LoadedImage,
+  OUT HVL_CMDLINE_TABLE         **CmdLineTable
+  )
+{
+
+  UINT16              *Buckets;
+  UINTN               BucketCount;
+  UINTN               BucketsOffset;
+  CONST CHAR16        *CmdLine;
+  UINTN               CmdLineLength;
+  UINTN               Index;
+  UINTN               KeyLength;
+  UINTN               Option;
+  UINTN               OptionCount;
+  UINTN               OptionLength;
+  UINTN               Position;
+  HVL_CMDLINE_RECORD  *Record;
+  HVL_CMDLINE_RECORD  *Records;
+  UINTN               RecordsOffset;
+  UINTN               Size;
+  CHAR16              *Strings;
+  UINTN               StringsLength;
+  UINTN               StringsOffset;
+  HVL_CMDLINE_TABLE   *Table;
+
+  *CmdLineTable = NULL;
+
+  CmdLine = LoadedImage->LoadOptions;
+  CmdLineLength = 0;
+  if (CmdLine != NULL) {
+    CmdLineLength = StrnLenS(
+                      CmdLine,
+                      LoadedImage->LoadOptionsSize / sizeof(CHAR16)
+                      );
+  }
+
+  if (CmdLineLength > MAX_UINT16) {
+    Print(L"Error: Command line is too long %d!\r\n", CmdLineLength);
+    return EFI_UNSUPPORTED;
+  }
+
+  //
+  // Count options, each needs a record, and room for NULL terminated key
+  // and value.
+  //
+
+  OptionCount = 0;
+  StringsLength = 0;
+  Position = 0;
+
+  while ((OptionLength = HvlCmdLineNextOption(
+                            CmdLine,
+                            CmdLineLength,
+                            &Position,
+                            &Option
+                            )) != 0) {
+    OptionCount++;
+    StringsLength += OptionLength + 2;
+  }
+
+  if (OptionCount >= HVL_CMDLINE_END) {
+    Print(L"Error: Too many command line options %d!\r\n", OptionCount);
+    return EFI_UNSUPPORTED;
+  }
+
+  BucketCount = HVL_CMDLINE_MIN_BUCKETS;
+  while ((BucketCount < OptionCount * 2) &&
+         (BucketCount < HVL_CMDLINE_MAX_BUCKETS)) {
+    BucketCount *= 2;
+  }
+
+  RecordsOffset = ALIGN_VALUE(sizeof(HVL_CMDLINE_TABLE), sizeof(UINT64));
+  BucketsOffset = RecordsOffset +
+                  ALIGN_VALUE(
+                    OptionCount * sizeof(HVL_CMDLINE_RECORD),
+                    sizeof(UINT64)
+                    );
+
+  StringsOffset = BucketsOffset +
+                  ALIGN_VALUE(BucketCount * sizeof(UINT16), sizeof(UINT64));
+
+  Size = StringsOffset + (StringsLength * sizeof(CHAR16));
+
+  Table = AllocateZeroPool(Size);
+  if (Table == NULL) {
+    Print(
+      L"Error: Failed to allocate command line table, size %d!\r\n",
+      Size
+      );
+
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Table->Signature     = HVL_CMDLINE_SIGNATURE;
+  Table->Size          = (UINT32)Size;
+  Table->RecordCount   = (UINT16)OptionCount;
+  Table->BucketCount   = (UINT16)BucketCount;
+  Table->RecordsOffset = (UINT32)RecordsOffset;
+  Table->BucketsOffset = (UINT32)BucketsOffset;
+  Table->StringsOffset = (UINT32)StringsOffset;
+
+  Records = (HVL_CMDLINE_RECORD *)((UINT8 *)Table + Table->RecordsOffset);
+  Buckets = (UINT16 *)((UINT8 *)Table + Table->BucketsOffset);
+  Strings = (CHAR16 *)((UINT8 *)Table + Table->StringsOffset);
+
+  SetMem(Buckets, BucketCount * sizeof(UINT16), 0xFF);
+
+  //
+  // Split options into NULL terminated keys and values, and hash the keys.
+  // Records are pushed at the head of their bucket, so a key that shows up
+  // more than once resolves to its last occurrence.
+  //
+
+  StringsLength = 0;
+  Position = 0;
+
+  for (Index = 0; Index < OptionCount; Index++) {
+    OptionLength = HvlCmdLineNextOption(
+                      CmdLine,
+                      CmdLineLength,
+                      &Position,
+                      &Option
+                      );
+
+    KeyLength = 0;
+    while ((KeyLength < OptionLength) &&
+           (CmdLine[Option + KeyLength] != HVL_CMDLINE_ASSIGN)) {
+      KeyLength++;
+    }
+
+    Record = &Records[Index];
+    Record->KeyOffset = (UINT32)StringsLength;
+    Record->KeyLength = (UINT16)KeyLength;
+    Record->KeyHash = HvlCmdLineHash(&CmdLine[Option], KeyLength);
+
+    CopyMem(
+      &Strings[StringsLength],
+      &CmdLine[Option],
+      KeyLength * sizeof(CHAR16)
+      );
+
+    StringsLength += KeyLength + 1;
+
+    //
+    // Skip the '=', if any.
+    //
+
+    if (KeyLength < OptionLength) {
+      KeyLength++;
+    }
+
+    Record->ValueOffset = (UINT32)StringsLength;
+    Record->ValueLength = (UINT16)(OptionLength - KeyLength);
+
+    CopyMem(
+      &Strings[StringsLength],
+      &CmdLine[Option + KeyLength],
+      Record->ValueLength * sizeof(CHAR16)
+      );
+
+    StringsLength += Record->ValueLength + 1;
+
+    Record->Next = Buckets[Record->KeyHash & (BucketCount - 1)];
+    Buckets[Record->KeyHash & (BucketCount - 1)] = (UINT16)Index;
+  }
+
+  *CmdLineTable = Table;
+
+  return EFI_SUCCESS;
+}
+
+
+/**
+  Gets a copy of a command line option, by its position.
+
+  @param[in]  LoadedImage   The EFI_LOADED_IMAGE_PROTOCOL interface for
+                            this app.
+  @param[in]  OptionIndex   The option position, 0 for the first option.
+  @param[out] Option        The returned NULL terminated option, allocated
+                            from pool.
+
+  @return EFI_SUCCESS           If the option was returned.
+  @return EFI_NOT_FOUND         If the command line has fewer options.
+  @return EFI_OUT_OF_RESOURCES  If the option could not be allocated.
+**/
+EFI_STATUS
+HvlGetCmdLineOption (
+  IN  EFI_LOADED_IMAGE_PROTOCOL *LoadedImage,
+  IN  UINTN                     OptionIndex,
+  OUT CHAR16                    **Option
+  )
+{
+
+  CONST CHAR16  *CmdLine;
+  UINTN         CmdLineLength;
+  UINTN         Index;
+  UINTN         OptionLength;
+  UINTN         OptionStart;
+  UINTN         Position;
+
+  *Option = NULL;
+
+  CmdLine = LoadedImage->LoadOptions;
+  CmdLineLength = 0;
+  if (CmdLine != NULL) {
+    CmdLineLength = StrnLenS(
+                      CmdLine,
+                      LoadedImage->LoadOptionsSize / sizeof(CHAR16)
+                      );
+  }
+
+  Position = 0;
+  Index = 0;
+
+  while ((OptionLength = HvlCmdLineNextOption(
+                            CmdLine,
+                            CmdLineLength,
+                            &Position,
+                            &OptionStart
+                            )) != 0) {
+    if (Index++ != OptionIndex) {
+      continue;
+    }
+
+    *Option = AllocateZeroPool((OptionLength + 1) * sizeof(CHAR16));
+    if (*Option == NULL) {
+      return EFI_OUT_OF_RESOURCES;
+    }
+
+    CopyMem(*Option, &CmdLine[OptionStart], OptionLength * sizeof(CHAR16));
+    return EFI_SUCCESS;
+  }
+
+  return EFI_NOT_FOUND;
+}
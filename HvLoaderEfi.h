@@ -16,9 +16,20 @@
 //
 
 //
-// HVL interface version
+// HVL interface versions
+// 0x0100 - Initial version.
+// 0x0101 - HVL_LOADED_IMAGE_INFO.CommandLine.
+// 0x0200 - HVL_LOADED_IMAGE_INFO.Services, HVL_LOADER_SERVICES.
+// 0x0201 - HVL_LOADED_IMAGE_INFO.ProximityDomain.
 //
-#define   HVL_VERSION       0x00000100
+// A hypervisor loader should check both Version and Size of 
+// HVL_LOADED_IMAGE_INFO, before accessing fields added after HVL_VERSION_1_0.
+//
+#define   HVL_VERSION_1_0   0x00000100
+#define   HVL_VERSION_1_1   0x00000101
+#define   HVL_VERSION_2_0   0x00000200
+#define   HVL_VERSION_2_1   0x00000201
+#define   HVL_VERSION       HVL_VERSION_2_1
 
 //
 // HVL loaded image flags
@@ -26,11 +37,434 @@
 #define   HVL_FLAG_ENV_EFI  0x00000001
 #define   HVL_FLAG_ENV_OS   0x00000002
 
+//
+// Loaded image proximity domain, if the image was not placed on a NUMA node
+//
+#define   HVL_PROXIMITY_DOMAIN_NONE   0xFFFFFFFF
+
+//
+// Command line table signature
+//
+#define   HVL_CMDLINE_SIGNATURE   SIGNATURE_32('H', 'V', 'C', 'L')
+
+//
+// Command line table end of bucket chain record index
+//
+#define   HVL_CMDLINE_END         0xFFFF
+
+//
+// Command line table key hash (FNV-1a 32) parameters.
+// The hash of a key starts at HVL_CMDLINE_HASH_BASIS, and each CHAR16 unit
+// of the key, in order, updates it as Hash = (Hash ^ Unit) *
+// HVL_CMDLINE_HASH_PRIME, modulo 2^32.
+//
+#define   HVL_CMDLINE_HASH_BASIS  0x811C9DC5
+#define   HVL_CMDLINE_HASH_PRIME  0x01000193
+
+//
+// Loader services table version.
+// The version changes only on incompatible changes. New services are
+// appended to HVL_LOADER_SERVICES, and its Size field tells which ones
+// HvLoader.efi provides, so a service is usable only if the version matches
+// and the Size covers it, HVL_SERVICES_SUPPORTS().
+//
+#define   HVL_SERVICES_VERSION    0x00000100
+
+#define   HVL_SERVICES_SUPPORTS(_Services, _Member) \
+          (((_Services) != NULL) && \
+           ((_Services)->Version == HVL_SERVICES_VERSION) && \
+           ((_Services)->Size >= \
+            OFFSET_OF(HVL_LOADER_SERVICES, _Member) + \
+            sizeof((_Services)->_Member)))
+
+//
+// Image loader protocol GUID, and interface version
+//
+#define   HVL_IMAGE_LOADER_PROTOCOL_GUID \
+          {0xb690ba2c, 0xfa03, 0x4d93, \
+          {0x8f, 0x1d, 0x56, 0x9b, 0xe4, 0xf3, 0x2c, 0xc2}}
+
+#define   HVL_IMAGE_LOADER_VERSION  0x00000100
+
+//
+// Image placement, HVL_IMAGE_LOAD_OPTIONS.Placement
+//
+#define   HVL_IMAGE_PLACE_BSP_NODE      0   // BSP NUMA node, then any
+#define   HVL_IMAGE_PLACE_ANY           1   // Any address
+#define   HVL_IMAGE_PLACE_MAX_ADDRESS   2   // At or below Address
+#define   HVL_IMAGE_PLACE_ADDRESS       3   // At Address
+
+//
+// Sparse image container signature, and format version
+//
+#define   HVL_SPARSE_SIGNATURE    SIGNATURE_32('H', 'V', 'S', 'P')
+#define   HVL_SPARSE_VERSION      0x00000100
+
+//
+// Sparse image container page map, checks if image page _page is stored
+//
+#define   HVL_SPARSE_PAGE_STORED(_map, _page) \
+          ((((_map)[(_page) / 8]) >> ((_page) % 8)) & 1)
+
+//
+// Boot timing history variable name, vendor GUID, format version and
+// record ring size. The variable is non-volatile, and runtime accessible,
+// so the OS can read it, for example from efivarfs.
+//
+#define   HVL_TIMING_VARIABLE     L"HvLoaderTiming"
+
+#define   HVL_TIMING_GUID \
+          {0x7c2a9e41, 0x5d3b, 0x4f86, \
+          {0xa1, 0x0e, 0x2b, 0x9c, 0x64, 0xd7, 0x18, 0x53}}
+
+#define   HVL_TIMING_VERSION      0x00000100
+#define   HVL_TIMING_RECORDS      32
+
+//
+// Boot timing record flags, HVL_TIMING_RECORD.Flags
+//
+#define   HVL_TIMING_FLAG_FAILED  0x0001  // All loader slots failed
+
+//
+// Shared log ring geometry
+//
+#define   HVL_LOG_ENTRY_LENGTH    128   // CHAR16 units, including NULL
+#define   HVL_LOG_ENTRY_COUNT     256
+
 
 //
 // ---------------------------------------------------------------------- Types
 //
 
+//
+// Command line record.
+// A command line option of the form KEY=VALUE, or KEY for options without
+// a value. Key and value are NULL terminated CHAR16 strings in the table
+// string pool.
+//
+typedef struct {
+  //
+  // Key hash, FNV-1a 32, see HVL_CMDLINE_HASH_BASIS.
+  //
+  UINT32                KeyHash;
+
+  //
+  // Key and value CHAR16 offsets in the string pool.
+  //
+  UINT32                KeyOffset;
+  UINT32                ValueOffset;
+
+  //
+  // Key and value lengths in CHAR16 units, excluding the NULL terminator.
+  //
+  UINT16                KeyLength;
+  UINT16                ValueLength;
+
+  //
+  // Next record index in the same hash bucket, or HVL_CMDLINE_END.
+  //
+  UINT16                Next;
+  UINT16                Reserved;
+
+} HVL_CMDLINE_RECORD;
+
+//
+// Command line table.
+// The HvLoader.efi command line (load options), tokenized once into a
+// single contiguous block:
+//   HVL_CMDLINE_TABLE
+//   HVL_CMDLINE_RECORD  Records[RecordCount]  - in command line order, so
+//                                               record 0 is the loader DLL
+//                                               path, if given.
+//   UINT16              Buckets[BucketCount]  - first record index of each
+//                                               hash bucket.
+//   CHAR16              Strings[]             - NULL terminated keys and
+//                                               values.
+// The table RecordsOffset, BucketsOffset and StringsOffset are in bytes
+// from the start of the table, the record KeyOffset and ValueOffset are
+// CHAR16 indices into Strings.
+// A key is looked up by walking the records of bucket
+// KeyHash & (BucketCount - 1), through Next, for a record with the same
+// hash, length and key. A key that shows up more than once, resolves to its
+// last occurrence.
+//
+typedef struct {
+  //
+  // HVL_CMDLINE_SIGNATURE
+  //
+  UINT32                Signature;
+
+  //
+  // Size of the whole table block.
+  //
+  UINT32                Size;
+
+  //
+  // Number of records, and number of hash buckets (power of 2).
+  //
+  UINT16                RecordCount;
+  UINT16                BucketCount;
+
+  //
+  // Records, buckets and string pool offsets.
+  //
+  UINT32                RecordsOffset;
+  UINT32                BucketsOffset;
+  UINT32                StringsOffset;
+
+} HVL_CMDLINE_TABLE;
+
+//
+// Sparse image container.
+// An image file with its all-zero pages omitted:
+//   HVL_SPARSE_HEADER
+//   UINT8         PageMap[(PageCount + 7) / 8]
+//   UINT8         Pages[]
+// Bit (N % 8) of PageMap[N / 8] is set if image page N is stored.
+// Stored pages follow HeaderSize bytes of header and page map, in ascending
+// page order. Each stored page is EFI_PAGE_SIZE bytes, except the last image
+// page, which holds the rest of the image.
+// Image signatures are defined over the expanded image file.
+//
+typedef struct {
+  //
+  // HVL_SPARSE_SIGNATURE, and HVL_SPARSE_VERSION.
+  //
+  UINT32                Signature;
+  UINT32                Version;
+
+  //
+  // Header and page map size, the file offset of the first stored page.
+  //
+  UINT32                HeaderSize;
+
+  //
+  // Expanded image size in bytes, and pages.
+  //
+  UINT32                ImageSize;
+  UINT32                PageCount;
+
+  //
+  // Number of stored pages.
+  //
+  UINT32                StoredPages;
+
+} HVL_SPARSE_HEADER;
+
+//
+// Boot timing record.
+// HvLoader.efi phase times of a boot, in uSec, for the last loader slot
+// launched.
+//
+typedef struct {
+  //
+  // Boot sequence number, starting at 1.
+  //
+  UINT32                Sequence;
+
+  //
+  // Last loader slot launched, number of slots launched, and
+  // HVL_TIMING_FLAG_XXX flags.
+  //
+  UINT8                 Slot;
+  UINT8                 Attempts;
+  UINT16                Flags;
+
+  //
+  // Loader DLL file size in bytes, after sparse container expansion.
+  //
+  UINT32                DllSize;
+
+  //
+  // Read, verify, load and relocate, and loader entry point phase times.
+  //
+  UINT32                ReadUs;
+  UINT32                VerifyUs;
+  UINT32                LoadUs;
+  UINT32                EntryUs;
+
+} HVL_TIMING_RECORD;
+
+//
+// Boot timing history, HVL_TIMING_VARIABLE content.
+// A ring of the last RecordCount boot timing records:
+//   HVL_TIMING_HISTORY
+//   HVL_TIMING_RECORD   Records[RecordCount]
+// The record of boot sequence number N is at Records[N % RecordCount].
+//
+typedef struct {
+  //
+  // HVL_TIMING_VERSION.
+  //
+  UINT32                Version;
+
+  //
+  // Number of records, and record size in bytes.
+  //
+  UINT16                RecordCount;
+  UINT16                RecordSize;
+
+  //
+  // Sequence number of the next boot record.
+  //
+  UINT32                NextSequence;
+  UINT32                Reserved;
+
+} HVL_TIMING_HISTORY;
+
+//
+// Shared log ring.
+// Fixed size entries, each holding a NULL terminated CHAR16 message:
+//   HVL_LOG_RING
+//   CHAR16        Entries[EntryCount][EntryLength]
+// Message number N is at entry (N % EntryCount). Messages
+// [max(0, NextMessage - EntryCount), NextMessage) are available.
+//
+typedef struct {
+  //
+  // Entry length in CHAR16 units, including the NULL terminator.
+  //
+  UINT32                EntryLength;
+
+  //
+  // Number of entries.
+  //
+  UINT32                EntryCount;
+
+  //
+  // Number of messages logged so far.
+  //
+  UINT64                NextMessage;
+
+} HVL_LOG_RING;
+
+//
+// Page allocation request, HVL_ALLOCATE_PAGES.
+//
+typedef struct {
+  //
+  // Requested memory type and page count.
+  //
+  EFI_MEMORY_TYPE       MemoryType;
+  UINTN                 Pages;
+
+  //
+  // Returned allocation address.
+  //
+  EFI_PHYSICAL_ADDRESS  Address;
+
+} HVL_PAGE_REQUEST;
+
+struct _EFI_FILE_PROTOCOL;
+
+/**
+  Reads a file from the HvLoader.efi volume into pages.
+  A sparse image container (HVL_SPARSE_HEADER) is expanded to the image
+  file it holds, and FileSize is the image file size.
+
+  @param[in]      FilePath    The file path, relative to the volume root.
+  @param[in]      MemoryType  The memory type of allocated pages.
+  @param[in,out]  Address     On input the caller pages address, or 0 to
+                              allocate pages of MemoryType. On output the
+                              pages address.
+  @param[in,out]  Pages       On input the caller pages count. On output the
+                              pages count, or the required pages count, if
+                              the caller pages are too small.
+  @param[out]     FileSize    The file size (bytes).
+
+  @retval EFI_SUCCESS           The file was read.
+  @retval EFI_BUFFER_TOO_SMALL  The caller pages are too small.
+  @retval Others                The file was not found or could not be read.
+**/
+typedef
+EFI_STATUS
+(EFIAPI *HVL_READ_FILE) (
+  IN      CONST CHAR16          *FilePath,
+  IN      EFI_MEMORY_TYPE       MemoryType,
+  IN OUT  EFI_PHYSICAL_ADDRESS  *Address,
+  IN OUT  UINTN                 *Pages,
+  OUT     UINTN                 *FileSize
+  );
+
+/**
+  Allocates pages for a number of requests.
+  Requests of the same memory type are served from a single contiguous
+  allocation. Either all requests are allocated or none.
+  Each request's pages may be freed individually with FreePages().
+
+  @param[in,out]  Requests      The page requests.
+  @param[in]      RequestCount  Number of requests.
+
+  @retval EFI_SUCCESS           All requests were allocated.
+  @retval Others                No request was allocated.
+**/
+typedef
+EFI_STATUS
+(EFIAPI *HVL_ALLOCATE_PAGES) (
+  IN OUT  HVL_PAGE_REQUEST      *Requests,
+  IN      UINTN                 RequestCount
+  );
+
+/**
+  Gets the root of the HvLoader.efi volume, already opened by HvLoader.efi.
+  The root is owned by HvLoader.efi and should not be closed.
+
+  @param[out] Root              The volume root.
+
+  @retval EFI_SUCCESS           The volume root is returned.
+  @retval Others                The volume could not be opened.
+**/
+typedef
+EFI_STATUS
+(EFIAPI *HVL_GET_VOLUME_ROOT) (
+  OUT     struct _EFI_FILE_PROTOCOL **Root
+  );
+
+/**
+  Logs a message to the shared log ring.
+  Messages longer than HVL_LOG_ENTRY_LENGTH - 1 are truncated.
+
+  @param[in]  Message           The message.
+
+  @return None
+**/
+typedef
+VOID
+(EFIAPI *HVL_LOG) (
+  IN      CONST CHAR16          *Message
+  );
+
+//
+// Loader services table (HVL_VERSION_2_0).
+// HvLoader.efi services offered to the hypervisor loader, so it can reuse
+// HvLoader.efi file I/O and allocation.
+//
+// Note:
+//   The services are implemented in HvLoader.efi, and are only valid while
+//   the hypervisor loader entry point runs. The log ring remains valid
+//   until ExitBootServices().
+//   Check a service with HVL_SERVICES_SUPPORTS() before use.
+//
+typedef struct {
+  //
+  // HVL_SERVICES_VERSION, and size of this struct, as provided by
+  // HvLoader.efi.
+  //
+  UINT32                Version;
+  UINT32                Size;
+
+  HVL_READ_FILE         ReadFile;
+  HVL_ALLOCATE_PAGES    AllocatePages;
+  HVL_GET_VOLUME_ROOT   GetVolumeRoot;
+  HVL_LOG               Log;
+
+  //
+  // The shared log ring.
+  //
+  HVL_LOG_RING          *LogRing;
+
+} HVL_LOADER_SERVICES;
+
 //
 // Loaded image information
 //
@@ -75,9 +509,113 @@ typedef struct {
   //
   EFI_PHYSICAL_ADDRESS  EntryPoint;
 
+  //
+  // Tokenized HvLoader.efi command line (HVL_VERSION_1_1).
+  // Remains valid after the loader entry point returns, until 
+  // ExitBootServices().
+  //
+  HVL_CMDLINE_TABLE     *CommandLine;
+
+  //
+  // Loader services (HVL_VERSION_2_0).
+  //
+  HVL_LOADER_SERVICES   *Services;
+
+  //
+  // ACPI SRAT proximity domain the image was placed on, or
+  // HVL_PROXIMITY_DOMAIN_NONE (HVL_VERSION_2_1).
+  //
+  UINT32                ProximityDomain;
+
 } HVL_LOADED_IMAGE_INFO;
 
 
+//
+// Image load options, HVL_LOAD_IMAGE.
+// Without options, images are placed like the hypervisor loader image:
+// HVL_IMAGE_PLACE_ANY, or HVL_IMAGE_PLACE_BSP_NODE if HvLoader.efi was built
+// with NUMA placement, in memory of type EfiLoaderCode.
+//
+typedef struct {
+  //
+  // HVL_IMAGE_PLACE_*, and the address for HVL_IMAGE_PLACE_MAX_ADDRESS and
+  // HVL_IMAGE_PLACE_ADDRESS.
+  //
+  UINT32                Placement;
+  EFI_PHYSICAL_ADDRESS  Address;
+
+  //
+  // Image memory type.
+  //
+  EFI_MEMORY_TYPE       MemoryType;
+
+} HVL_IMAGE_LOAD_OPTIONS;
+
+/**
+  Reads, verifies, loads and relocates a PE/COFF image, with the same
+  pipeline HvLoader.efi uses for the hypervisor loader.
+  The image is verified with EFI_SHIM_LOCK_GUID_PROTOCOL, which also extends
+  the TPM PCRs with its hash, before it is loaded.
+
+  @param[in]  FilePath      The image file path, relative to the HvLoader.efi
+                            volume root, or NULL if Buffer is given.
+  @param[in]  Buffer        The image file content, or NULL if FilePath is
+                            given.
+  @param[in]  BufferSize    The image file content size (bytes).
+  @param[in]  Options       The load options, optional.
+  @param[out] ImageInfo     The loaded image information. CommandLine and
+                            Services are NULL.
+
+  @retval EFI_SUCCESS             The image was loaded.
+  @retval EFI_INVALID_PARAMETER   Neither or both of FilePath and Buffer are
+                                  given, or bad options.
+  @retval EFI_SECURITY_VIOLATION  The image failed verification.
+  @retval Others                  The image could not be read, verified or
+                                  loaded.
+**/
+typedef
+EFI_STATUS
+(EFIAPI *HVL_LOAD_IMAGE) (
+  IN      CONST CHAR16                  *FilePath OPTIONAL,
+  IN      VOID                          *Buffer OPTIONAL,
+  IN      UINTN                         BufferSize,
+  IN      CONST HVL_IMAGE_LOAD_OPTIONS  *Options OPTIONAL,
+  OUT     HVL_LOADED_IMAGE_INFO         *ImageInfo
+  );
+
+/**
+  Unloads an image loaded by HVL_LOAD_IMAGE, and frees its pages.
+
+  @param[in,out]  ImageInfo     The loaded image information.
+
+  @retval EFI_SUCCESS           The image was unloaded.
+  @retval EFI_INVALID_PARAMETER The image is not loaded.
+**/
+typedef
+EFI_STATUS
+(EFIAPI *HVL_UNLOAD_IMAGE) (
+  IN OUT  HVL_LOADED_IMAGE_INFO         *ImageInfo
+  );
+
+//
+// Image loader protocol, HVL_IMAGE_LOADER_PROTOCOL_GUID.
+// Installed on the HvLoader.efi image handle while the hypervisor loader
+// entry point runs, so every PE/COFF image of the launch chain can be
+// loaded by the HvLoader.efi pipeline.
+//
+typedef struct {
+  //
+  // HVL_IMAGE_LOADER_VERSION, and size of this struct.
+  //
+  UINT32                Version;
+  UINT32                Size;
+
+  HVL_LOAD_IMAGE        LoadImage;
+  HVL_UNLOAD_IMAGE      UnloadImage;
+
+} HVL_IMAGE_LOADER_PROTOCOL;
+
+
 /**
   This is the external hypervisor loader image entry point.
 
@@ -0,0 +1,438 @@
+/** @file
+  HvLoader.efi launch memory footprint (HVL_FOOTPRINT).
+  Snapshots the EFI memory map before and after the hypervisor loader entry
+  point, totals the pages of the hypervisor memory map by type and
+  extended attributes, and reports the footprint as machine readable
+  records, one per line:
+
+    HVL_FOOTPRINT,BEGIN,<record version>
+    HVL_FOOTPRINT,EFI,<type>,<pages before>,<pages after>,<pages delta>
+    HVL_FOOTPRINT,HV,<type>,<extended attributes>,<pages>
+    HVL_FOOTPRINT,RESIDENT,<type>,<pages>
+    HVL_FOOTPRINT,IMAGE,<type>,<pages>,<proximity domain>
+    HVL_FOOTPRINT,SUMMARY,<resident delta>,<HV pages>,<HV loader pages>,
+                          <resident HV loader pages>
+    HVL_FOOTPRINT,END
+
+  RESIDENT records flag HV loader pages left in a memory type the OS does
+  not reclaim, so they are taken from the host for good. The IMAGE
+  proximity domain is hex, 0xffffffff if the image was not NUMA placed.
+
+  Copyright (c) Microsoft Corporation.
+  Licensed under the MIT License.
+
+**/
+
+#include <stddef.h>
+#include <Uefi.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/PrintLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/UefiLib.h>
+#include <Protocol/LoadedImage.h>
+
+#include "HvLoaderEfi.h"
+#include "HvLoaderP.h"
+
+#if HVL_FOOTPRINT
+#include "HvEfi.h"
+
+
+//
+// -------------------------------------------------------------------- Defines
+//
+
+//
+// Footprint record version.
+//
+#define HVL_FOOTPRINT_VERSION     1
+
+//
+// Hypervisor memory map extended attribute classes, totaled by the footprint.
+//
+#define HVL_FOOTPRINT_EX_CLASSES \
+        ((HV_EFI_MEMORY_EX_ATTR_HV | HV_EFI_MEMORY_EX_ATTR_HVLOADER) + 1)
+
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+EFI_GUID mHvlFootprintHvMediaGuid = LINUX_EFI_HYPERVISOR_MEDIA_GUID;
+
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+/**
+  Gets the footprint bucket of a memory type.
+
+  @param[in]  Type    The memory type.
+
+  @return The footprint bucket.
+**/
+UINTN
+HvlFootprintBucket (
+  IN  UINT32  Type
+  )
+{
+
+  return (Type < EfiMaxMemoryType) ? Type : EfiMaxMemoryType;
+}
+
+
+/**
+  Checks if pages of a memory type stay resident, once the OS is running.
+  Loader, boot services and conventional pages are reclaimed by the OS.
+
+  @param[in]  Type    The memory type.
+
+  @return TRUE        If the pages are not reclaimed by the OS.
+  @return FALSE       Otherwise.
+**/
+BOOLEAN
+HvlFootprintIsResident (
+  IN  UINT32  Type
+  )
+{
+
+  switch (Type) {
+  case EfiLoaderCode:
+  case EfiLoaderData:
+  case EfiBootServicesCode:
+  case EfiBootServicesData:
+  case EfiConventionalMemory:
+    return FALSE;
+
+  default:
+    return TRUE;
+  }
+}
+
+
+/**
+  Emits a footprint record, on the console and in the shared log ring.
+
+  @param[in]  Format    The record format string, without the record prefix.
+  @param[in]  ...       The record arguments.
+
+  @return None
+**/
+VOID
+EFIAPI
+HvlFootprintRecord (
+  IN  CONST CHAR16  *Format,
+  ...
+  )
+{
+
+  VA_LIST Marker;
+  CHAR16  Record[HVL_LOG_ENTRY_LENGTH];
+  UINTN   Length;
+
+  Length = UnicodeSPrint(
+             Record,
+             sizeof(Record),
+             L"%s,",
+             HVL_FOOTPRINT_RECORD
+             );
+
+  VA_START(Marker, Format);
+  UnicodeVSPrint(
+    Record + Length,
+    sizeof(Record) - (Length * sizeof(CHAR16)),
+    Format,
+    Marker
+    );
+
+  VA_END(Marker);
+
+  Print(L"%s\r\n", Record);
+  HvlLog(L"%s", Record);
+}
+
+
+/**
+  Snapshots the EFI memory map page totals, by memory type.
+
+  @param[out] Footprint     The footprint snapshot.
+
+  @return EFI_SUCCESS       If the snapshot was taken.
+  @return Others            Otherwise.
+**/
+EFI_STATUS
+HvlFootprintSnapshot (
+  OUT HVL_FOOTPRINT_SNAPSHOT *Footprint
+  )
+{
+
+  EFI_MEMORY_DESCRIPTOR *Descriptor;
+  UINTN                 DescriptorSize;
+  EFI_MEMORY_DESCRIPTOR *EfiMemoryMap;
+  UINTN                 EfiMemoryMapSize;
+  UINTN                 Offset;
+  EFI_STATUS            Status;
+
+  ZeroMem(Footprint, sizeof(*Footprint));
+
+  Status = HvlGetEfiMemoryMap(
+             &EfiMemoryMap,
+             &EfiMemoryMapSize,
+             &DescriptorSize
+             );
+
+  if (EFI_ERROR(Status)) {
+    return Status;
+  }
+
+  for (Offset = 0; Offset < EfiMemoryMapSize; Offset += DescriptorSize) {
+    Descriptor = (EFI_MEMORY_DESCRIPTOR *)((UINT8 *)EfiMemoryMap + Offset);
+    Footprint->Pages[HvlFootprintBucket(Descriptor->Type)] +=
+      Descriptor->NumberOfPages;
+  }
+
+  FreePool(EfiMemoryMap);
+
+  return EFI_SUCCESS;
+}
+
+
+/**
+  Totals the hypervisor memory map pages, by memory type and extended
+  attributes class.
+
+  @param[out] Pages         The page totals.
+
+  @return EFI_SUCCESS       If the hypervisor memory map was totaled.
+  @return Others            If the hypervisor is not launched, or the memory
+                            map is not available.
+**/
+EFI_STATUS
+HvlFootprintHvTotals (
+  OUT UINT64  Pages[HVL_FOOTPRINT_TYPES][HVL_FOOTPRINT_EX_CLASSES]
+  )
+{
+
+  EFI_MEMORY_DESCRIPTOR               *Descriptor;
+  UINTN                               DescriptorSize;
+  UINT32                              DescriptorVersion;
+  HV_EFI_MEMORY_DESCRIPTOR_EX         *DescriptorEx;
+  EFI_MEMORY_DESCRIPTOR               *EfiMemoryMap;
+  UINTN                               EfiMemoryMapSize;
+  LINUX_EFI_HYPERVISOR_MEDIA_PROTOCOL *HvEfiProtocol;
+  UINTN                               MapKey;
+  UINTN                               Offset;
+  EFI_STATUS                          Status;
+
+  ZeroMem(
+    Pages,
+    HVL_FOOTPRINT_TYPES * HVL_FOOTPRINT_EX_CLASSES * sizeof(UINT64)
+    );
+
+  Status = gBS->LocateProtocol(
+                  &mHvlFootprintHvMediaGuid,
+                  NULL,
+                  (VOID **)&HvEfiProtocol
+                  );
+
+  if (EFI_ERROR(Status)) {
+    return Status;
+  }
+
+  EfiMemoryMap = NULL;
+  EfiMemoryMapSize = 0;
+
+  Status = HvEfiProtocol->HvlGetMemoryMap(
+                            &EfiMemoryMapSize,
+                            NULL,
+                            &MapKey,
+                            &DescriptorSize,
+                            &DescriptorVersion
+                            );
+
+  while (Status == EFI_BUFFER_TOO_SMALL) {
+    if (EfiMemoryMap != NULL) {
+      FreePool(EfiMemoryMap);
+    }
+
+    EfiMemoryMap = AllocatePool(EfiMemoryMapSize);
+    if (EfiMemoryMap == NULL) {
+      return EFI_OUT_OF_RESOURCES;
+    }
+
+    Status = HvEfiProtocol->HvlGetMemoryMap(
+                              &EfiMemoryMapSize,
+                              EfiMemoryMap,
+                              &MapKey,
+                              &DescriptorSize,
+                              &DescriptorVersion
+                              );
+  }
+
+  if (EFI_ERROR(Status) ||
+      (DescriptorSize <
+        (sizeof(EFI_MEMORY_DESCRIPTOR) +
+         sizeof(HV_EFI_MEMORY_DESCRIPTOR_EX)))) {
+    Status = EFI_ERROR(Status) ? Status : EFI_UNSUPPORTED;
+    goto Done;
+  }
+
+  for (Offset = 0; Offset < EfiMemoryMapSize; Offset += DescriptorSize) {
+    Descriptor = (EFI_MEMORY_DESCRIPTOR *)((UINT8 *)EfiMemoryMap + Offset);
+    DescriptorEx = (HV_EFI_MEMORY_DESCRIPTOR_EX *)
+                     ((UINT8 *)Descriptor + DescriptorSize -
+                      sizeof(HV_EFI_MEMORY_DESCRIPTOR_EX));
+
+    Pages[HvlFootprintBucket(Descriptor->Type)]
+         [DescriptorEx->ExAttribute & (HVL_FOOTPRINT_EX_CLASSES - 1)] +=
+      Descriptor->NumberOfPages;
+  }
+
+Done:
+
+  if (EfiMemoryMap != NULL) {
+    FreePool(EfiMemoryMap);
+  }
+
+  return Status;
+}
+
+
+/**
+  Reports the launch memory footprint, see the file header for the record
+  format. Should be called after the hypervisor loader entry point returns.
+
+  @param[in]  Before        The footprint snapshot taken before the
+                            hypervisor loader entry point was called.
+  @param[in]  DllImageInfo  The hypervisor loader image information.
+
+  @return None
+**/
+VOID
+HvlFootprintReport (
+  IN  CONST HVL_FOOTPRINT_SNAPSHOT *Before,
+  IN  CONST HVL_LOADED_IMAGE_INFO  *DllImageInfo
+  )
+{
+
+  HVL_FOOTPRINT_SNAPSHOT  After;
+  UINTN                   Class;
+  INT64                   Delta;
+  UINT64                  HvLoaderPages;
+  UINT64                  HvPages;
+  UINT64                  (*HvTotals)[HVL_FOOTPRINT_EX_CLASSES];
+  INT64                   ResidentDelta;
+  UINT64                  ResidentPages;
+  EFI_STATUS              Status;
+  UINTN                   Type;
+
+  HvLoaderPages = 0;
+  HvPages = 0;
+  ResidentDelta = 0;
+  ResidentPages = 0;
+
+  Status = HvlFootprintSnapshot(&After);
+  if (EFI_ERROR(Status)) {
+    Print(L"Error: Footprint snapshot failed, status %d!\r\n", Status);
+    return;
+  }
+
+  HvTotals = AllocatePool(
+               HVL_FOOTPRINT_TYPES * HVL_FOOTPRINT_EX_CLASSES * sizeof(UINT64)
+               );
+
+  if (HvTotals == NULL) {
+    return;
+  }
+
+  HvlFootprintRecord(L"BEGIN,%d", HVL_FOOTPRINT_VERSION);
+
+  for (Type = 0; Type < HVL_FOOTPRINT_TYPES; Type++) {
+    if ((Before->Pages[Type] == 0) && (After.Pages[Type] == 0)) {
+      continue;
+    }
+
+    Delta = (INT64)(After.Pages[Type] - Before->Pages[Type]);
+    if (HvlFootprintIsResident((UINT32)Type)) {
+      ResidentDelta += Delta;
+    }
+
+    HvlFootprintRecord(
+      L"EFI,%d,%ld,%ld,%ld",
+      Type,
+      Before->Pages[Type],
+      After.Pages[Type],
+      Delta
+      );
+  }
+
+  //
+  // The hypervisor memory map is only available if the hypervisor loader
+  // installed LINUX_EFI_HYPERVISOR_MEDIA_PROTOCOL.
+  //
+
+  Status = HvlFootprintHvTotals(HvTotals);
+  if (!EFI_ERROR(Status)) {
+    for (Type = 0; Type < HVL_FOOTPRINT_TYPES; Type++) {
+      for (Class = 1; Class < HVL_FOOTPRINT_EX_CLASSES; Class++) {
+        if (HvTotals[Type][Class] == 0) {
+          continue;
+        }
+
+        HvlFootprintRecord(
+          L"HV,%d,0x%x,%ld",
+          Type,
+          Class,
+          HvTotals[Type][Class]
+          );
+
+        if (CHECK_FLAG(Class, HV_EFI_MEMORY_EX_ATTR_HV)) {
+          HvPages += HvTotals[Type][Class];
+        }
+
+        if (CHECK_FLAG(Class, HV_EFI_MEMORY_EX_ATTR_HVLOADER)) {
+          HvLoaderPages += HvTotals[Type][Class];
+        }
+      }
+
+      if (!HvlFootprintIsResident((UINT32)Type)) {
+        continue;
+      }
+
+      for (Class = 1; Class < HVL_FOOTPRINT_EX_CLASSES; Class++) {
+        if (CHECK_FLAG(Class, HV_EFI_MEMORY_EX_ATTR_HVLOADER) &&
+            !CHECK_FLAG(Class, HV_EFI_MEMORY_EX_ATTR_HV) &&
+            (HvTotals[Type][Class] != 0)) {
+          HvlFootprintRecord(L"RESIDENT,%d,%ld", Type, HvTotals[Type][Class]);
+          ResidentPages += HvTotals[Type][Class];
+        }
+      }
+    }
+  }
+
+  if (DllImageInfo->ImageAddress != 0) {
+    HvlFootprintRecord(
+      L"IMAGE,%d,%ld,0x%x",
+      DllImageInfo->ImageMemoryType,
+      (UINT64)DllImageInfo->ImagePages,
+      DllImageInfo->ProximityDomain
+      );
+  }
+
+  HvlFootprintRecord(
+    L"SUMMARY,%ld,%ld,%ld,%ld",
+    ResidentDelta,
+    HvPages,
+    HvLoaderPages,
+    ResidentPages
+    );
+
+  HvlFootprintRecord(L"END");
+
+  FreePool(HvTotals);
+}
+
+#endif // HVL_FOOTPRINT
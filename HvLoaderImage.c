@@ -0,0 +1,570 @@
+/** @file
+  HvLoader.efi image read and load pipeline.
+  Reads an image file, expanding sparse image containers, and loads and
+  relocates PE/COFF images with PeCoffLib.
+
+  The pipeline is shared by the EFI build, and the OS environment
+  (HVL_ENV_OS) build, Os/HvLoaderOs.c, which provides the file access, page
+  allocation and console primitives it uses.
+
+  Copyright (c) Microsoft Corporation.
+  Licensed under the MIT License.
+
+**/
+
+#include <stddef.h>
+#include <Uefi.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/PeCoffLib.h>
+#include <Library/UefiLib.h>
+#include <Protocol/LoadedImage.h>
+
+#include "HvLoaderEfi.h"
+#include "HvLoaderP.h"
+
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// Load options of the hypervisor loader image, and of images loaded without
+// options by HVL_IMAGE_LOADER_PROTOCOL.
+//
+CONST HVL_IMAGE_LOAD_OPTIONS mHvlDefaultLoadOptions = {
+#if HVL_NUMA
+  HVL_IMAGE_PLACE_BSP_NODE,
+#else // HVL_NUMA
+  HVL_IMAGE_PLACE_ANY,
+#endif // !HVL_NUMA
+  0,
+  HVL_IMAGE_MEMORY_TYPE
+};
+
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+/**
+  Reads file data to memory, using as few, and as large, sequential reads
+  as the file system allows.
+
+  @param[in]  FileHandle    Handle of the opened file.
+  @param[in]  Size          Number of bytes to read.
+  @param[out] Buffer        The buffer to read to.
+
+  @return EFI_SUCCESS       If all data was read.
+  @return Others            Otherwise.
+**/
+EFI_STATUS
+HvlReadFileData (
+  IN  EFI_FILE_HANDLE FileHandle,
+  IN  UINTN           Size,
+  OUT VOID            *Buffer
+  )
+{
+
+  UINTN       Offset;
+  UINTN       ReadSize;
+  EFI_STATUS  Status;
+
+  Offset = 0;
+
+  while (Offset < Size) {
+    ReadSize = Size - Offset;
+    Status = FileHandle->Read(
+                          FileHandle, 
+                          &ReadSize, 
+                          (UINT8 *)Buffer + Offset
+                          );
+
+    if (EFI_ERROR(Status)) {
+      Print(
+        L"Error: Failed to read file, status %d offset %d!\r\n", 
+        Status, 
+        Offset
+        );
+
+      return Status;
+    }
+
+    if (ReadSize == 0) {
+      Print(L"Error: Unexpected end of file, offset %d!\r\n", Offset);
+      return EFI_END_OF_FILE;
+    }
+
+    Offset += ReadSize;
+  }
+
+  return EFI_SUCCESS;
+}
+
+
+/**
+  Reads a sparse image container to memory, expanding it to the image file
+  it holds. Only stored pages are read, omitted pages are zeroed.
+
+  @param[in]  FileHandle    Handle of the opened container file, positioned
+                            right after the container header.
+  @param[in]  FileSize      The container file size.
+  @param[in]  Header        The container header, validated by
+                            HvlOpenImageFile().
+  @param[out] ImageBuffer   The image buffer, Header->ImageSize bytes.
+
+  @return EFI_SUCCESS       If the image was read and expanded.
+  @return EFI_LOAD_ERROR    If the container is malformed.
+  @return Others            Otherwise.
+**/
+EFI_STATUS
+HvlReadSparseFile (
+  IN  EFI_FILE_HANDLE         FileHandle,
+  IN  UINTN                   FileSize,
+  IN  CONST HVL_SPARSE_HEADER *Header,
+  OUT VOID                    *ImageBuffer
+  )
+{
+
+  UINT8       *Image;
+  UINTN       Offset;
+  UINTN       Page;
+  UINT8       *PageMap;
+  UINTN       RunEnd;
+  UINTN       RunSize;
+  BOOLEAN     Stored;
+  UINTN       StoredPages;
+  UINTN       StoredSize;
+  EFI_STATUS  Status;
+
+  Image = ImageBuffer;
+
+  PageMap = AllocatePool(Header->HeaderSize - sizeof(*Header));
+  if (PageMap == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Status = HvlReadFileData(
+             FileHandle,
+             Header->HeaderSize - sizeof(*Header),
+             PageMap
+             );
+
+  if (EFI_ERROR(Status)) {
+    goto Done;
+  }
+
+  //
+  // The stored pages should account for the rest of the file, so a
+  // truncated or padded container is rejected before any page is read.
+  //
+
+  StoredPages = 0;
+  for (Page = 0; Page < Header->PageCount; Page++) {
+    StoredPages += HVL_SPARSE_PAGE_STORED(PageMap, Page);
+  }
+
+  StoredSize = StoredPages * EFI_PAGE_SIZE;
+  if (HVL_SPARSE_PAGE_STORED(PageMap, Header->PageCount - 1)) {
+    StoredSize -= (Header->PageCount * EFI_PAGE_SIZE) - Header->ImageSize;
+  }
+
+  if ((StoredPages != Header->StoredPages) ||
+      (StoredSize != FileSize - Header->HeaderSize)) {
+    Print(L"Error: Malformed sparse image container page map!\r\n");
+    Status = EFI_LOAD_ERROR;
+    goto Done;
+  }
+
+  //
+  // Expand runs of stored pages with a single read each, and zero the
+  // runs of omitted pages in between.
+  //
+
+  for (Page = 0; Page < Header->PageCount; Page = RunEnd) {
+    Stored = HVL_SPARSE_PAGE_STORED(PageMap, Page);
+    RunEnd = Page + 1;
+    while ((RunEnd < Header->PageCount) &&
+           (HVL_SPARSE_PAGE_STORED(PageMap, RunEnd) == Stored)) {
+      RunEnd++;
+    }
+
+    Offset = Page * EFI_PAGE_SIZE;
+    RunSize = MIN(RunEnd * EFI_PAGE_SIZE, Header->ImageSize) - Offset;
+
+    if (Stored) {
+      Status = HvlReadFileData(FileHandle, RunSize, Image + Offset);
+      if (EFI_ERROR(Status)) {
+        goto Done;
+      }
+
+    } else {
+      ZeroMem(Image + Offset, RunSize);
+    }
+  }
+
+  Status = EFI_SUCCESS;
+
+Done:
+
+  FreePool(PageMap);
+
+  return Status;
+}
+
+
+/**
+  Opens an image file for reading, and gets the size of the image it holds.
+  A sparse image container (HVL_SPARSE_HEADER) holds an image file, that
+  HvlReadImageFile() expands as it reads it.
+
+  @param[in]  LoadedImage   The EFI_LOADED_IMAGE_PROTOCOL interface for
+                            this app.
+  @param[in]  FilePath      The image file path.
+  @param[out] ImageFile     The open image file, to be closed by the caller
+                            with HvlCloseImageFile().
+
+  @return EFI_SUCCESS       If the image file was opened.
+  @return EFI_LOAD_ERROR    If the sparse image container is malformed.
+  @return Others            Otherwise.
+**/
+EFI_STATUS
+HvlOpenImageFile (
+  IN  EFI_LOADED_IMAGE_PROTOCOL *LoadedImage,
+  IN  CONST CHAR16              *FilePath,
+  OUT HVL_IMAGE_FILE            *ImageFile
+  )
+{
+
+  CONST HVL_SPARSE_HEADER *Header;
+  UINTN                   MapSize;
+  EFI_STATUS              Status;
+
+  ZeroMem(ImageFile, sizeof(*ImageFile));
+
+  Status = HvlOpenFile(
+             LoadedImage,
+             FilePath,
+             &ImageFile->FileHandle,
+             &ImageFile->FileSize
+             );
+
+  if (EFI_ERROR(Status)) {
+    return Status;
+  }
+
+  ImageFile->ImageSize = ImageFile->FileSize;
+
+  //
+  // Read what would be a sparse image container header.
+  //
+
+  Header = &ImageFile->Header;
+  if (ImageFile->FileSize < sizeof(*Header)) {
+    return EFI_SUCCESS;
+  }
+
+  ImageFile->HeaderSize = sizeof(*Header);
+  Status = HvlReadFileData(
+             ImageFile->FileHandle,
+             ImageFile->HeaderSize,
+             &ImageFile->Header
+             );
+
+  if (EFI_ERROR(Status)) {
+    goto Done;
+  }
+
+  if (Header->Signature != HVL_SPARSE_SIGNATURE) {
+    return EFI_SUCCESS;
+  }
+
+  MapSize = (Header->PageCount + 7) / 8;
+  if ((Header->Version != HVL_SPARSE_VERSION) ||
+      (Header->ImageSize == 0) ||
+      (Header->PageCount != EFI_SIZE_TO_PAGES(Header->ImageSize)) ||
+      (Header->HeaderSize < sizeof(*Header) + MapSize) ||
+      (Header->HeaderSize > ImageFile->FileSize)) {
+    Print(L"Error: Malformed sparse image container header!\r\n");
+    Status = EFI_LOAD_ERROR;
+    goto Done;
+  }
+
+  ImageFile->ImageSize = Header->ImageSize;
+
+  Status = EFI_SUCCESS;
+
+Done:
+
+  if (EFI_ERROR(Status)) {
+    HvlCloseImageFile(ImageFile);
+  }
+
+  return Status;
+}
+
+
+/**
+  Reads the image held by an open image file, expanding a sparse image
+  container.
+
+  @param[in]  ImageFile     The open image file.
+  @param[out] ImageBuffer   The image buffer, ImageFile->ImageSize bytes.
+
+  @return EFI_SUCCESS       If the image was read.
+  @return EFI_LOAD_ERROR    If the sparse image container is malformed.
+  @return Others            Otherwise.
+**/
+EFI_STATUS
+HvlReadImageFile (
+  IN  HVL_IMAGE_FILE  *ImageFile,
+  OUT VOID            *ImageBuffer
+  )
+{
+
+  EFI_STATUS  Status;
+
+  if ((ImageFile->HeaderSize != 0) &&
+      (ImageFile->Header.Signature == HVL_SPARSE_SIGNATURE)) {
+    Status = HvlReadSparseFile(
+               ImageFile->FileHandle,
+               ImageFile->FileSize,
+               &ImageFile->Header,
+               ImageBuffer
+               );
+
+    if (EFI_ERROR(Status)) {
+      Print(
+        L"Error: Failed to read sparse image file, status %d!\r\n",
+        Status
+        );
+    }
+
+    return Status;
+  }
+
+  //
+  // A plain image file, its first bytes were read as a header.
+  //
+
+  CopyMem(ImageBuffer, &ImageFile->Header, ImageFile->HeaderSize);
+  Status = HvlReadFileData(
+             ImageFile->FileHandle,
+             ImageFile->FileSize - ImageFile->HeaderSize,
+             (UINT8 *)ImageBuffer + ImageFile->HeaderSize
+             );
+
+  if (EFI_ERROR(Status)) {
+    Print(
+      L"Error: Failed to read image file, status %d size %d!\r\n",
+      Status,
+      ImageFile->FileSize
+      );
+  }
+
+  return Status;
+}
+
+
+/**
+  Closes an image file, opened by HvlOpenImageFile().
+
+  @param[in,out]  ImageFile   The image file.
+
+  @return None
+**/
+VOID
+HvlCloseImageFile (
+  IN OUT  HVL_IMAGE_FILE  *ImageFile
+  )
+{
+
+  if (ImageFile->FileHandle != NULL) {
+    ImageFile->FileHandle->Close(ImageFile->FileHandle);
+    ImageFile->FileHandle = NULL;
+  }
+}
+
+
+/**
+  Reads HV loader dll file to memory.
+  A sparse image container (HVL_SPARSE_HEADER) is expanded to the image file
+  it holds, as it is read.
+
+  @param[in]  LoadedImage   The EFI_LOADED_IMAGE_PROTOCOL interface for 
+                            this app.
+  @param[in]  DllFilePath   The hypervisor loader DLL file path.
+  @param[out] DllFileBuffer Address of returned HV loader DLL buffer.
+  @param[out] DllFileSize   Address of returned HV loader DLL buffer size.
+
+  @return EFI_SUCCESS       If DLL file was successfully read to memory buffer.
+  @return Others            If DLL file was not found, or we ran out of 
+                            resources.
+**/
+EFI_STATUS
+HvlLoadLoaderDll (
+  IN  EFI_LOADED_IMAGE_PROTOCOL *LoadedImage,
+  IN  CHAR16                    *DllFilePath,
+  OUT VOID*                     *DllFileBuffer,
+  OUT UINTN                     *DllFileSize
+  )
+{
+
+  HVL_IMAGE_FILE  DllFile;
+  EFI_STATUS      Status;
+
+  *DllFileBuffer = NULL;
+
+  //
+  // Open the loader DLL file, and get its size.
+  //
+
+  Status = HvlOpenImageFile(LoadedImage, DllFilePath, &DllFile);
+  if (EFI_ERROR(Status)) {
+    return Status;
+  }
+
+  //
+  // Allocate a buffer and read the DLL file to memory.
+  //
+
+  *DllFileSize = DllFile.ImageSize;
+  *DllFileBuffer = AllocatePool(*DllFileSize);
+  if (*DllFileBuffer == NULL) {
+    Print(
+      L"Error: Failed to allocate DLL file buffer, size %d!\r\n", 
+      *DllFileSize
+      );
+
+    Status = EFI_OUT_OF_RESOURCES;
+    goto Done;
+  }
+
+  Status = HvlReadImageFile(&DllFile, *DllFileBuffer);
+  if (EFI_ERROR(Status)) {
+    FreePool(*DllFileBuffer);
+    *DllFileBuffer = NULL;
+  }
+
+Done:
+
+  HvlCloseImageFile(&DllFile);
+
+  return Status;
+}
+
+
+/**
+  Loads and relocates a PE/COFF image.
+
+  @param[in]  PeCoffImage     Point to a Pe/Coff image.
+  @param[in]  Options         The image load options, optional.
+  @param[out] LoadedImageInfo The loaded image information.
+
+  @return EFI_SUCCESS         If the image is loaded and relocated 
+                              successfully.
+  @return Others              If the image failed to load or relocate.
+**/
+EFI_STATUS
+HvlLoadPeCoffImage (
+  IN  VOID                          *PeCoffImage,
+  IN  CONST HVL_IMAGE_LOAD_OPTIONS  *Options OPTIONAL,
+  OUT HVL_LOADED_IMAGE_INFO         *LoadedImageInfo
+  )
+{
+
+  PHYSICAL_ADDRESS              ImageBuffer;
+  PE_COFF_LOADER_IMAGE_CONTEXT  ImageContext;
+  UINTN                         ImagePages;
+  UINT32                        ProximityDomain;
+  EFI_STATUS                    Status;
+
+  ZeroMem(&ImageContext, sizeof(ImageContext));
+  ImageContext.Handle    = PeCoffImage;
+  ImageContext.ImageRead = PeCoffLoaderImageReadFromMemory;
+
+  ImageBuffer = 0;
+  ImagePages  = 0;
+
+  if (Options == NULL) {
+    Options = &mHvlDefaultLoadOptions;
+  }
+
+  Status = PeCoffLoaderGetImageInfo(&ImageContext);
+  if (EFI_ERROR (Status)) {
+    Print(L"Error: PeCoffLoaderGetImageInfo failed, status %d!\r\n", Status);
+    goto Done;
+  }
+
+  //
+  // Allocate Memory for the image.
+  // By default we use memory type of HVL_IMAGE_MEMORY_TYPE, and save it in
+  // the loaded image information. HV loader DLL can mark these pages as 
+  // EfiConventionalMemory so the guest kernel can reclaim those.
+  // The image is placed on the BSP NUMA node, if the system has an SRAT.
+  //
+
+  ImagePages = EFI_SIZE_TO_PAGES(ImageContext.ImageSize);
+
+  Status = HvlAllocateImagePages(
+             Options,
+             ImagePages,
+             &ImageBuffer,
+             &ProximityDomain
+             );
+
+  if (EFI_ERROR (Status)) {
+    ImageBuffer = 0;
+    Print(L"Error: AllocatePages failed, status %d!\r\n", Status);
+    goto Done;
+  }
+
+  ImageContext.ImageAddress = ImageBuffer;
+
+  //
+  // Load the image to our new buffer.
+  //
+
+  Status = PeCoffLoaderLoadImage(&ImageContext);
+  if (EFI_ERROR (Status)) {
+    Print(L"Error: PeCoffLoaderLoadImage failed, status %d!\r\n", Status);
+    goto Done;
+  }
+
+  //
+  // Relocate the image in our new buffer.
+  //
+
+  Status = PeCoffLoaderRelocateImage(&ImageContext);
+  if (EFI_ERROR (Status)) {
+    Print(L"Error: PeCoffLoaderRelocateImage failed, status %d!\r\n", Status);
+    goto Done;
+  }
+
+  LoadedImageInfo->Version          = HVL_VERSION;
+  LoadedImageInfo->Size             = sizeof(*LoadedImageInfo);
+#if HVL_ENV_OS
+  LoadedImageInfo->Flags            = HVL_FLAG_ENV_OS;
+#else
+  LoadedImageInfo->Flags            = HVL_FLAG_ENV_EFI;
+#endif // HVL_ENV_OS
+  LoadedImageInfo->ImageAddress     = ImageContext.ImageAddress;
+  LoadedImageInfo->ImageSize        = ImageContext.ImageSize;
+  LoadedImageInfo->ImagePages       = ImagePages;
+  LoadedImageInfo->ImageMemoryType  = Options->MemoryType;
+  LoadedImageInfo->EntryPoint       = ImageContext.EntryPoint;
+  LoadedImageInfo->ProximityDomain  = ProximityDomain;
+
+  Status = EFI_SUCCESS;
+
+Done:
+
+  if (EFI_ERROR(Status)) {
+    if (ImageBuffer != 0) {
+      HvlFreeImagePages(ImageBuffer, ImagePages);
+    }
+  }
+
+  return Status;
+}
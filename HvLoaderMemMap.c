@@ -0,0 +1,555 @@
+/** @file
+  HV_EFI_MEMORY_DESCRIPTOR_EX memory map library.
+  Builds a sorted structure-of-arrays index of an HV_EFI_MEMORY_DESCRIPTOR_EX
+  memory map, and answers address and HV range lookups with a binary search.
+  Copies the memory map, coalesced and/or in the compact descriptor format.
+
+  Copyright (c) Microsoft Corporation.
+  Licensed under the MIT License.
+
+**/
+
+#include <stddef.h>
+#include <Uefi.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+
+#include "HvLoaderMemMap.h"
+
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+/**
+  Sorts the index arrays by physical start.
+  Memory maps are normally sorted, or close to it, so an insertion sort is
+  used.
+
+  @param[in,out]  Index   The memory map index.
+
+  @return None
+**/
+VOID
+HvlMemMapIndexSort (
+  IN OUT  HV_EFI_MEMORY_MAP_INDEX *Index
+  )
+{
+
+  UINT64  *Attribute;
+  UINT64  *ExAttribute;
+  UINTN   Inner;
+  UINTN   Outer;
+  UINT64  *Pages;
+  UINT64  *Start;
+  UINT32  *Type;
+  UINT64  SavedAttribute;
+  UINT64  SavedExAttribute;
+  UINT64  SavedPages;
+  UINT64  SavedStart;
+  UINT32  SavedType;
+
+  Start = HvlMemMapIndexStart(Index);
+  Pages = HvlMemMapIndexPages(Index);
+  Attribute = HvlMemMapIndexAttribute(Index);
+  ExAttribute = HvlMemMapIndexExAttribute(Index);
+  Type = HvlMemMapIndexType(Index);
+
+  for (Outer = 1; Outer < Index->Count; Outer++) {
+    if (Start[Outer - 1] <= Start[Outer]) {
+      continue;
+    }
+
+    SavedStart = Start[Outer];
+    SavedPages = Pages[Outer];
+    SavedAttribute = Attribute[Outer];
+    SavedExAttribute = ExAttribute[Outer];
+    SavedType = Type[Outer];
+
+    Inner = Outer;
+    while ((Inner > 0) && (Start[Inner - 1] > SavedStart)) {
+      Start[Inner] = Start[Inner - 1];
+      Pages[Inner] = Pages[Inner - 1];
+      Attribute[Inner] = Attribute[Inner - 1];
+      ExAttribute[Inner] = ExAttribute[Inner - 1];
+      Type[Inner] = Type[Inner - 1];
+      Inner--;
+    }
+
+    Start[Inner] = SavedStart;
+    Pages[Inner] = SavedPages;
+    Attribute[Inner] = SavedAttribute;
+    ExAttribute[Inner] = SavedExAttribute;
+    Type[Inner] = SavedType;
+  }
+}
+
+
+/**
+  Builds an HV_EFI_MEMORY_MAP_INDEX of a memory map.
+
+  @param[in]      EfiMemoryMap      The memory map, descriptors followed by
+                                    HV_EFI_MEMORY_DESCRIPTOR_EX.
+  @param[in]      EfiMemoryMapSize  The memory map size.
+  @param[in]      DescriptorSize    The memory descriptor size.
+  @param[in]      MapKey            The memory map key.
+  @param[out]     Index             The caller buffer for the index.
+  @param[in,out]  IndexSize         On input the caller buffer size. On
+                                    output the index size, or the required
+                                    size, if the buffer is too small.
+
+  @return EFI_SUCCESS           If the index was built.
+  @return EFI_BUFFER_TOO_SMALL  If the caller buffer is too small.
+  @return EFI_INVALID_PARAMETER If the memory map is not valid.
+  @return EFI_UNSUPPORTED       If the memory map is too large.
+**/
+EFI_STATUS
+HvlMemMapIndexBuild (
+  IN      CONST EFI_MEMORY_DESCRIPTOR *EfiMemoryMap,
+  IN      UINTN                       EfiMemoryMapSize,
+  IN      UINTN                       DescriptorSize,
+  IN      UINTN                       MapKey,
+  OUT     HV_EFI_MEMORY_MAP_INDEX     *Index,
+  IN OUT  UINTN                       *IndexSize
+  )
+{
+
+  UINTN                             Count;
+  CONST EFI_MEMORY_DESCRIPTOR       *Descriptor;
+  CONST HV_EFI_MEMORY_DESCRIPTOR_EX *DescriptorEx;
+  UINT32                            *ExRanges;
+  UINTN                             ExRangeCount;
+  UINTN                             Entry;
+  UINTN                             Offset;
+  UINTN                             Size;
+
+  if ((IndexSize == NULL) ||
+      ((EfiMemoryMap == NULL) && (EfiMemoryMapSize != 0)) ||
+      (DescriptorSize < sizeof(EFI_MEMORY_DESCRIPTOR) +
+                        sizeof(HV_EFI_MEMORY_DESCRIPTOR_EX)) ||
+      ((EfiMemoryMapSize % DescriptorSize) != 0)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  Count = EfiMemoryMapSize / DescriptorSize;
+  if (Count > MAX_UINT32 / (4 * sizeof(UINT64) + sizeof(UINT32) * 2)) {
+    return EFI_UNSUPPORTED;
+  }
+
+  ExRangeCount = 0;
+  Descriptor = EfiMemoryMap;
+  for (Entry = 0; Entry < Count; Entry++) {
+    DescriptorEx = (CONST HV_EFI_MEMORY_DESCRIPTOR_EX *)
+                    ((CONST UINT8 *)Descriptor + DescriptorSize -
+                      sizeof(HV_EFI_MEMORY_DESCRIPTOR_EX));
+
+    if ((DescriptorEx->ExAttribute & HVL_MEMMAP_EX_ATTR_RANGES) != 0) {
+      ExRangeCount++;
+    }
+
+    Descriptor = (CONST EFI_MEMORY_DESCRIPTOR *)
+                  ((CONST UINT8 *)Descriptor + DescriptorSize);
+  }
+
+  Offset = ALIGN_VALUE(sizeof(HV_EFI_MEMORY_MAP_INDEX), sizeof(UINT64));
+  Size = Offset +
+         (4 * Count * sizeof(UINT64)) +
+         ALIGN_VALUE(Count * sizeof(UINT32), sizeof(UINT64)) +
+         ALIGN_VALUE(ExRangeCount * sizeof(UINT32), sizeof(UINT64));
+
+  if (*IndexSize < Size) {
+    *IndexSize = Size;
+    return EFI_BUFFER_TOO_SMALL;
+  }
+
+  if (Index == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  Index->Version = HV_EFI_MEMORY_MAP_INDEX_VERSION;
+  Index->Size = (UINT32)Size;
+  Index->MapKey = MapKey;
+  Index->Count = (UINT32)Count;
+  Index->ExRangeCount = (UINT32)ExRangeCount;
+  Index->StartOffset = (UINT32)Offset;
+  Index->PagesOffset = (UINT32)(Offset + (Count * sizeof(UINT64)));
+  Index->AttributeOffset = (UINT32)(Offset + (2 * Count * sizeof(UINT64)));
+  Index->ExAttributeOffset = (UINT32)(Offset + (3 * Count * sizeof(UINT64)));
+  Index->TypeOffset = (UINT32)(Offset + (4 * Count * sizeof(UINT64)));
+  Index->ExRangesOffset = Index->TypeOffset +
+                          (UINT32)ALIGN_VALUE(
+                                    Count * sizeof(UINT32),
+                                    sizeof(UINT64)
+                                    );
+
+  Descriptor = EfiMemoryMap;
+  for (Entry = 0; Entry < Count; Entry++) {
+    DescriptorEx = (CONST HV_EFI_MEMORY_DESCRIPTOR_EX *)
+                    ((CONST UINT8 *)Descriptor + DescriptorSize -
+                      sizeof(HV_EFI_MEMORY_DESCRIPTOR_EX));
+
+    HvlMemMapIndexStart(Index)[Entry] = Descriptor->PhysicalStart;
+    HvlMemMapIndexPages(Index)[Entry] = Descriptor->NumberOfPages;
+    HvlMemMapIndexAttribute(Index)[Entry] = Descriptor->Attribute;
+    HvlMemMapIndexExAttribute(Index)[Entry] = DescriptorEx->ExAttribute;
+    HvlMemMapIndexType(Index)[Entry] = Descriptor->Type;
+
+    Descriptor = (CONST EFI_MEMORY_DESCRIPTOR *)
+                  ((CONST UINT8 *)Descriptor + DescriptorSize);
+  }
+
+  HvlMemMapIndexSort(Index);
+
+  ExRanges = HvlMemMapIndexExRanges(Index);
+  ExRangeCount = 0;
+  for (Entry = 0; Entry < Count; Entry++) {
+    if ((HvlMemMapIndexExAttribute(Index)[Entry] &
+          HVL_MEMMAP_EX_ATTR_RANGES) != 0) {
+      ExRanges[ExRangeCount++] = (UINT32)Entry;
+    }
+  }
+
+  *IndexSize = Size;
+
+  return EFI_SUCCESS;
+}
+
+
+/**
+  Finds the memory descriptor that covers a physical address.
+
+  @param[in]  Index   The memory map index.
+  @param[in]  Address The physical address.
+
+  @return The index entry covering Address, or Index->Count if Address is
+          not covered by the memory map.
+**/
+UINTN
+HvlMemMapIndexLookup (
+  IN  CONST HV_EFI_MEMORY_MAP_INDEX   *Index,
+  IN  EFI_PHYSICAL_ADDRESS            Address
+  )
+{
+
+  UINTN         High;
+  UINTN         Low;
+  UINTN         Middle;
+  CONST UINT64  *Start;
+
+  Start = HvlMemMapIndexStart(Index);
+  Low = 0;
+  High = Index->Count;
+
+  //
+  // Find the first entry starting above Address, the entry before it is
+  // the only one that may cover Address.
+  //
+
+  while (Low < High) {
+    Middle = Low + ((High - Low) / 2);
+    if (Start[Middle] <= Address) {
+      Low = Middle + 1;
+    } else {
+      High = Middle;
+    }
+  }
+
+  if ((Low == 0) ||
+      (Address - Start[Low - 1] >=
+        EFI_PAGES_TO_SIZE(HvlMemMapIndexPages(Index)[Low - 1]))) {
+    return Index->Count;
+  }
+
+  return Low - 1;
+}
+
+
+/**
+  Finds the next HV or HV loader range, that ends above a physical address.
+
+  @param[in]  Index       The memory map index.
+  @param[in]  Address     The physical address.
+  @param[in]  ExAttribute The extended attributes of interest, any of
+                          HVL_MEMMAP_EX_ATTR_RANGES.
+
+  @return The ExRanges position of the range, or Index->ExRangeCount if
+          there are no more ranges.
+**/
+UINTN
+HvlMemMapIndexNextExRange (
+  IN  CONST HV_EFI_MEMORY_MAP_INDEX   *Index,
+  IN  EFI_PHYSICAL_ADDRESS            Address,
+  IN  UINT64                          ExAttribute
+  )
+{
+
+  UINT32        Entry;
+  CONST UINT32  *ExRanges;
+  UINTN         High;
+  UINTN         Low;
+  UINTN         Middle;
+
+  ExRanges = HvlMemMapIndexExRanges(Index);
+  Low = 0;
+  High = Index->ExRangeCount;
+
+  while (Low < High) {
+    Middle = Low + ((High - Low) / 2);
+    Entry = ExRanges[Middle];
+
+    if (HvlMemMapIndexStart(Index)[Entry] +
+        EFI_PAGES_TO_SIZE(HvlMemMapIndexPages(Index)[Entry]) <= Address) {
+      Low = Middle + 1;
+    } else {
+      High = Middle;
+    }
+  }
+
+  while ((Low < Index->ExRangeCount) &&
+         ((HvlMemMapIndexExAttribute(Index)[ExRanges[Low]] &
+            ExAttribute) == 0)) {
+    Low++;
+  }
+
+  return Low;
+}
+
+
+/**
+  Copies a memory map run, into the HvlMemMapCopy() output format.
+
+  @param[in]  Descriptor      The first descriptor of the run.
+  @param[in]  DescriptorSize  The memory descriptor size.
+  @param[in]  Pages           The run page count.
+  @param[in]  Flags           HV_EFI_MEMORY_MAP_* flags.
+  @param[out] Output          The output descriptor.
+
+  @return None
+**/
+VOID
+HvlMemMapCopyRun (
+  IN  CONST EFI_MEMORY_DESCRIPTOR *Descriptor,
+  IN  UINTN                       DescriptorSize,
+  IN  UINT64                      Pages,
+  IN  UINT32                      Flags,
+  OUT VOID                        *Output
+  )
+{
+
+  HV_EFI_MEMORY_DESCRIPTOR_COMPACT  *Compact;
+
+  if ((Flags & HV_EFI_MEMORY_MAP_COMPACT) == 0) {
+    CopyMem(Output, Descriptor, DescriptorSize);
+    ((EFI_MEMORY_DESCRIPTOR *)Output)->NumberOfPages = Pages;
+    return;
+  }
+
+  Compact = Output;
+  Compact->PhysicalStart = Descriptor->PhysicalStart;
+  Compact->NumberOfPages = Pages;
+  Compact->Attribute = Descriptor->Attribute;
+  Compact->Type = Descriptor->Type;
+  Compact->Reserved = 0;
+  Compact->ExAttribute = ((CONST HV_EFI_MEMORY_DESCRIPTOR_EX *)
+                           ((CONST UINT8 *)Descriptor +
+                             DescriptorSize -
+                             sizeof(HV_EFI_MEMORY_DESCRIPTOR_EX))
+                           )->ExAttribute;
+}
+
+
+/**
+  Walks a memory map in runs of descriptors to be merged, and copies the
+  runs that fit in the output buffer.
+
+  @param[in]  EfiMemoryMap      The memory map.
+  @param[in]  EfiMemoryMapSize  The memory map size.
+  @param[in]  DescriptorSize    The memory descriptor size.
+  @param[in]  Flags             HV_EFI_MEMORY_MAP_* flags.
+  @param[in]  OutputSize        The output descriptor size.
+  @param[in]  OutputCount       Number of output descriptors that fit in
+                                the output buffer.
+  @param[out] Output            The output buffer, or NULL to only count
+                                the runs.
+
+  @return The number of runs.
+**/
+UINTN
+HvlMemMapCopyRuns (
+  IN  CONST EFI_MEMORY_DESCRIPTOR *EfiMemoryMap,
+  IN  UINTN                       EfiMemoryMapSize,
+  IN  UINTN                       DescriptorSize,
+  IN  UINT32                      Flags,
+  IN  UINTN                       OutputSize,
+  IN  UINTN                       OutputCount,
+  OUT VOID                        *Output OPTIONAL
+  )
+{
+
+  CONST EFI_MEMORY_DESCRIPTOR       *Descriptor;
+  CONST HV_EFI_MEMORY_DESCRIPTOR_EX *DescriptorEx;
+  CONST EFI_MEMORY_DESCRIPTOR       *Run;
+  UINTN                             RunCount;
+  CONST HV_EFI_MEMORY_DESCRIPTOR_EX *RunEx;
+  UINT64                            RunPages;
+  CONST UINT8                       *TableEnd;
+
+  Run = NULL;
+  RunEx = NULL;
+  RunCount = 0;
+  RunPages = 0;
+
+  Descriptor = EfiMemoryMap;
+  TableEnd = (CONST UINT8 *)EfiMemoryMap + EfiMemoryMapSize;
+
+  while ((CONST UINT8 *)Descriptor != TableEnd) {
+    DescriptorEx = (CONST HV_EFI_MEMORY_DESCRIPTOR_EX *)
+                    ((CONST UINT8 *)Descriptor + DescriptorSize -
+                      sizeof(HV_EFI_MEMORY_DESCRIPTOR_EX));
+
+    if ((Run != NULL) &&
+        ((Flags & HV_EFI_MEMORY_MAP_COALESCE) != 0) &&
+        (Run->Type == Descriptor->Type) &&
+        (Run->Attribute == Descriptor->Attribute) &&
+        (RunEx->ExAttribute == DescriptorEx->ExAttribute) &&
+        (Run->PhysicalStart + EFI_PAGES_TO_SIZE(RunPages) ==
+          Descriptor->PhysicalStart)) {
+
+      RunPages += Descriptor->NumberOfPages;
+
+    } else {
+      if ((Run != NULL) && (Output != NULL) && (RunCount <= OutputCount)) {
+        HvlMemMapCopyRun(
+          Run,
+          DescriptorSize,
+          RunPages,
+          Flags,
+          (UINT8 *)Output + ((RunCount - 1) * OutputSize)
+          );
+      }
+
+      Run = Descriptor;
+      RunEx = DescriptorEx;
+      RunPages = Descriptor->NumberOfPages;
+      RunCount++;
+    }
+
+    Descriptor = (CONST EFI_MEMORY_DESCRIPTOR *)
+                  ((CONST UINT8 *)Descriptor + DescriptorSize);
+  }
+
+  if ((Run != NULL) && (Output != NULL) && (RunCount <= OutputCount)) {
+    HvlMemMapCopyRun(
+      Run,
+      DescriptorSize,
+      RunPages,
+      Flags,
+      (UINT8 *)Output + ((RunCount - 1) * OutputSize)
+      );
+  }
+
+  return RunCount;
+}
+
+
+/**
+  Copies a memory map, coalesced and/or in the compact descriptor format.
+  Coalescing merges adjacent descriptors with the same type, attributes
+  and extended attributes.
+
+  @param[in]      EfiMemoryMap      The memory map, descriptors followed by
+                                    HV_EFI_MEMORY_DESCRIPTOR_EX.
+  @param[in]      EfiMemoryMapSize  The memory map size.
+  @param[in]      DescriptorSize    The memory descriptor size.
+  @param[in]      Flags             HV_EFI_MEMORY_MAP_* flags.
+  @param[out]     Buffer            The caller buffer for the copy.
+  @param[in,out]  BufferSize        On input the caller buffer size. On
+                                    output the copy size, or the required
+                                    size, if the buffer is too small.
+  @param[out]     OutputSize        The copy descriptor size.
+  @param[out]     OutputVersion     The copy descriptor version.
+
+  @return EFI_SUCCESS           If the memory map was copied.
+  @return EFI_BUFFER_TOO_SMALL  If the caller buffer is too small.
+  @return EFI_INVALID_PARAMETER If the memory map or flags are not valid.
+**/
+EFI_STATUS
+HvlMemMapCopy (
+  IN      CONST EFI_MEMORY_DESCRIPTOR *EfiMemoryMap,
+  IN      UINTN                       EfiMemoryMapSize,
+  IN      UINTN                       DescriptorSize,
+  IN      UINT32                      Flags,
+  OUT     VOID                        *Buffer,
+  IN OUT  UINTN                       *BufferSize,
+  OUT     UINTN                       *OutputSize,
+  OUT     UINT32                      *OutputVersion
+  )
+{
+
+  UINTN   RequiredSize;
+
+  if ((BufferSize == NULL) || (OutputSize == NULL) ||
+      (OutputVersion == NULL) ||
+      ((Flags & ~HV_EFI_MEMORY_MAP_FLAGS) != 0) ||
+      ((EfiMemoryMap == NULL) && (EfiMemoryMapSize != 0)) ||
+      (DescriptorSize < sizeof(EFI_MEMORY_DESCRIPTOR) +
+                        sizeof(HV_EFI_MEMORY_DESCRIPTOR_EX)) ||
+      ((EfiMemoryMapSize % DescriptorSize) != 0)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  if ((Flags & HV_EFI_MEMORY_MAP_COMPACT) != 0) {
+    *OutputSize = sizeof(HV_EFI_MEMORY_DESCRIPTOR_COMPACT);
+    *OutputVersion = HV_EFI_MEMORY_DESCRIPTOR_COMPACT_VERSION;
+  } else {
+    *OutputSize = DescriptorSize;
+    *OutputVersion = EFI_MEMORY_DESCRIPTOR_VERSION;
+  }
+
+  //
+  // Without coalescing, the copy size is known without walking the map.
+  // With coalescing, the runs are counted first. The caller buffer is only
+  // written once the copy is known to fit.
+  //
+
+  if ((Flags & HV_EFI_MEMORY_MAP_COALESCE) == 0) {
+    RequiredSize = (EfiMemoryMapSize / DescriptorSize) * (*OutputSize);
+  } else {
+    RequiredSize = HvlMemMapCopyRuns(
+                     EfiMemoryMap,
+                     EfiMemoryMapSize,
+                     DescriptorSize,
+                     Flags,
+                     *OutputSize,
+                     0,
+                     NULL
+                     ) * (*OutputSize);
+  }
+
+  if (*BufferSize < RequiredSize) {
+    *BufferSize = RequiredSize;
+    return EFI_BUFFER_TOO_SMALL;
+  }
+
+  if ((Buffer == NULL) && (RequiredSize != 0)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  if (Flags == 0) {
+    CopyMem(Buffer, EfiMemoryMap, RequiredSize);
+  } else if (RequiredSize != 0) {
+    HvlMemMapCopyRuns(
+      EfiMemoryMap,
+      EfiMemoryMapSize,
+      DescriptorSize,
+      Flags,
+      *OutputSize,
+      RequiredSize / *OutputSize,
+      Buffer
+      );
+  }
+
+  *BufferSize = RequiredSize;
+
+  return EFI_SUCCESS;
+}
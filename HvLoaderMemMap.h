@@ -0,0 +1,90 @@
+/** @file
+  Definitions of the HV_EFI_MEMORY_DESCRIPTOR_EX memory map library, shared
+  by the memory map consumers and the mock LINUX_EFI_HYPERVISOR_MEDIA_PROTOCOL
+  provider.
+
+  Copyright (c) Microsoft Corporation.
+  Licensed under the MIT License.
+
+**/
+
+#ifndef __HVLOADER_MEMMAP_H__
+#define __HVLOADER_MEMMAP_H__
+
+#include "HvEfi.h"
+
+//
+// -------------------------------------------------------------------- Defines
+//
+
+//
+// Get an HV_EFI_MEMORY_MAP_INDEX array.
+//
+#define HvlMemMapIndexArray(_index, _type, _array) \
+        ((_type *)((UINT8 *)(_index) + (_index)->_array##Offset))
+
+#define HvlMemMapIndexStart(_index) \
+        HvlMemMapIndexArray(_index, UINT64, Start)
+
+#define HvlMemMapIndexPages(_index) \
+        HvlMemMapIndexArray(_index, UINT64, Pages)
+
+#define HvlMemMapIndexAttribute(_index) \
+        HvlMemMapIndexArray(_index, UINT64, Attribute)
+
+#define HvlMemMapIndexExAttribute(_index) \
+        HvlMemMapIndexArray(_index, UINT64, ExAttribute)
+
+#define HvlMemMapIndexType(_index) \
+        HvlMemMapIndexArray(_index, UINT32, Type)
+
+#define HvlMemMapIndexExRanges(_index) \
+        HvlMemMapIndexArray(_index, UINT32, ExRanges)
+
+//
+// Extended attributes of the descriptors listed in ExRanges.
+//
+#define HVL_MEMMAP_EX_ATTR_RANGES \
+        (HV_EFI_MEMORY_EX_ATTR_HV | HV_EFI_MEMORY_EX_ATTR_HVLOADER)
+
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+EFI_STATUS
+HvlMemMapIndexBuild (
+  IN      CONST EFI_MEMORY_DESCRIPTOR *EfiMemoryMap,
+  IN      UINTN                       EfiMemoryMapSize,
+  IN      UINTN                       DescriptorSize,
+  IN      UINTN                       MapKey,
+  OUT     HV_EFI_MEMORY_MAP_INDEX     *Index,
+  IN OUT  UINTN                       *IndexSize
+  );
+
+UINTN
+HvlMemMapIndexLookup (
+  IN  CONST HV_EFI_MEMORY_MAP_INDEX   *Index,
+  IN  EFI_PHYSICAL_ADDRESS            Address
+  );
+
+UINTN
+HvlMemMapIndexNextExRange (
+  IN  CONST HV_EFI_MEMORY_MAP_INDEX   *Index,
+  IN  EFI_PHYSICAL_ADDRESS            Address,
+  IN  UINT64                          ExAttribute
+  );
+
+EFI_STATUS
+HvlMemMapCopy (
+  IN      CONST EFI_MEMORY_DESCRIPTOR *EfiMemoryMap,
+  IN      UINTN                       EfiMemoryMapSize,
+  IN      UINTN                       DescriptorSize,
+  IN      UINT32                      Flags,
+  OUT     VOID                        *Buffer,
+  IN OUT  UINTN                       *BufferSize,
+  OUT     UINTN                       *OutputSize,
+  OUT     UINT32                      *OutputVersion
+  );
+
+#endif // !__HVLOADER_MEMMAP_H__
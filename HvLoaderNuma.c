@@ -0,0 +1,536 @@
+/** @file
+  HvLoader.efi NUMA placement policy.
+  Parses the ACPI SRAT, and SLIT if present, finds the proximity domain of
+  the BSP, and places allocations in the free memory of the nearest domain
+  that can hold them, falling back to any memory.
+
+  Copyright (c) Microsoft Corporation.
+  Licensed under the MIT License.
+
+**/
+
+#include <stddef.h>
+#include <Uefi.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/UefiLib.h>
+#include <Protocol/LoadedImage.h>
+
+#include "HvLoaderEfi.h"
+#include "HvLoaderNuma.h"
+#include "HvLoaderP.h"
+
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// The NUMA topology, NULL if not available.
+//
+HVL_NUMA_TOPOLOGY *mHvlNumaTopology = NULL;
+BOOLEAN mHvlNumaInitialized = FALSE;
+
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+/**
+  Gets the ACPI SLIT distance between two proximity domains.
+
+  @param[in]  Topology  The NUMA topology.
+  @param[in]  From      The source proximity domain.
+  @param[in]  To        The target proximity domain.
+
+  @return The SLIT distance, or the ACPI default if unknown.
+**/
+UINT8
+HvlNumaDistance (
+  IN  CONST HVL_NUMA_TOPOLOGY   *Topology,
+  IN  UINT32                    From,
+  IN  UINT32                    To
+  )
+{
+
+  if ((Topology->Distances != NULL) &&
+      (From < Topology->LocalityCount) &&
+      (To < Topology->LocalityCount)) {
+    return Topology->Distances[(From * Topology->LocalityCount) + To];
+  }
+
+  return (From == To) ? HVL_NUMA_LOCAL_DISTANCE : HVL_NUMA_REMOTE_DISTANCE;
+}
+
+
+/**
+  Sorts the proximity domains with memory by distance from the BSP domain,
+  and then by domain number. The BSP domain comes first, even if the SLIT
+  does not make it the nearest.
+
+  @param[in,out]  Topology  The NUMA topology.
+
+  @return None
+**/
+VOID
+HvlNumaSortDomains (
+  IN OUT  HVL_NUMA_TOPOLOGY *Topology
+  )
+{
+
+  UINTN   Distances[HVL_NUMA_MAX_DOMAINS];
+  UINT32  Domain;
+  UINTN   Distance;
+  UINTN   Inner;
+  UINTN   Outer;
+
+  for (Outer = 0; Outer < Topology->DomainCount; Outer++) {
+    Domain = Topology->Domains[Outer];
+    Distances[Outer] = (Domain == Topology->BspDomain) ?
+                       0 :
+                       HvlNumaDistance(Topology, Topology->BspDomain, Domain);
+  }
+
+  for (Outer = 1; Outer < Topology->DomainCount; Outer++) {
+    Domain = Topology->Domains[Outer];
+    Distance = Distances[Outer];
+
+    for (Inner = Outer; Inner > 0; Inner--) {
+      if ((Distances[Inner - 1] < Distance) ||
+          ((Distances[Inner - 1] == Distance) &&
+           (Topology->Domains[Inner - 1] < Domain))) {
+        break;
+      }
+
+      Topology->Domains[Inner] = Topology->Domains[Inner - 1];
+      Distances[Inner] = Distances[Inner - 1];
+    }
+
+    Topology->Domains[Inner] = Domain;
+    Distances[Inner] = Distance;
+  }
+}
+
+
+/**
+  Parses the ACPI SRAT and SLIT into a NUMA topology.
+  Disabled SRAT entries are ignored, and a SLIT that is too short is
+  ignored.
+
+  @param[in]  Srat        The ACPI SRAT.
+  @param[in]  Slit        The ACPI SLIT, optional.
+  @param[in]  BspApicId   The APIC ID of the BSP, xAPIC or x2APIC.
+  @param[out] Topology    The NUMA topology.
+
+  @return EFI_SUCCESS           If the topology was parsed.
+  @return EFI_NOT_FOUND         If the BSP domain or memory ranges were not
+                                found.
+  @return EFI_INVALID_PARAMETER If the SRAT is malformed.
+**/
+EFI_STATUS
+HvlNumaParse (
+  IN  CONST EFI_ACPI_DESCRIPTION_HEADER *Srat,
+  IN  CONST EFI_ACPI_DESCRIPTION_HEADER *Slit OPTIONAL,
+  IN  UINT32                            BspApicId,
+  OUT HVL_NUMA_TOPOLOGY                 *Topology
+  )
+{
+
+  CONST EFI_ACPI_4_0_PROCESSOR_LOCAL_APIC_SAPIC_AFFINITY_STRUCTURE  *Apic;
+  UINT32                                                            Domain;
+  CONST UINT8                                                       *Entry;
+  UINTN                                                             Index;
+  UINT64                                                            Localities;
+  CONST EFI_ACPI_4_0_MEMORY_AFFINITY_STRUCTURE                      *Memory;
+  UINTN                                                             Next;
+  UINTN                                                             Offset;
+  HVL_NUMA_RANGE                                                    *Range;
+  CONST EFI_ACPI_4_0_SYSTEM_LOCALITY_DISTANCE_INFORMATION_TABLE_HEADER
+                                                                    *SlitHeader;
+  CONST EFI_ACPI_4_0_PROCESSOR_LOCAL_X2APIC_AFFINITY_STRUCTURE      *X2Apic;
+
+  ZeroMem(Topology, sizeof(*Topology));
+  Topology->BspDomain = HVL_PROXIMITY_DOMAIN_NONE;
+
+  if (Srat->Length <
+      sizeof(EFI_ACPI_4_0_SYSTEM_RESOURCE_AFFINITY_TABLE_HEADER)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  Offset = sizeof(EFI_ACPI_4_0_SYSTEM_RESOURCE_AFFINITY_TABLE_HEADER);
+
+  while ((Offset + 2) <= Srat->Length) {
+    Entry = (CONST UINT8 *)Srat + Offset;
+    if ((Entry[1] < 2) || ((Offset + Entry[1]) > Srat->Length)) {
+      return EFI_INVALID_PARAMETER;
+    }
+
+    switch (Entry[0]) {
+    case EFI_ACPI_4_0_PROCESSOR_LOCAL_APIC_SAPIC_AFFINITY:
+      Apic = (CONST VOID *)Entry;
+      if ((Entry[1] >= sizeof(*Apic)) &&
+          CHECK_FLAG(
+            Apic->Flags,
+            EFI_ACPI_4_0_PROCESSOR_LOCAL_APIC_SAPIC_ENABLED
+            ) &&
+          (Apic->ApicId == BspApicId)) {
+        Topology->BspDomain = Apic->ProximityDomain7To0 |
+                              (Apic->ProximityDomain31To8[0] << 8) |
+                              (Apic->ProximityDomain31To8[1] << 16) |
+                              ((UINT32)Apic->ProximityDomain31To8[2] << 24);
+      }
+
+      break;
+
+    case EFI_ACPI_4_0_PROCESSOR_LOCAL_X2APIC_AFFINITY:
+      X2Apic = (CONST VOID *)Entry;
+      if ((Entry[1] >= sizeof(*X2Apic)) &&
+          CHECK_FLAG(
+            X2Apic->Flags,
+            EFI_ACPI_4_0_PROCESSOR_LOCAL_X2APIC_ENABLED
+            ) &&
+          (X2Apic->X2ApicId == BspApicId)) {
+        Topology->BspDomain = X2Apic->ProximityDomain;
+      }
+
+      break;
+
+    case EFI_ACPI_4_0_MEMORY_AFFINITY:
+      Memory = (CONST VOID *)Entry;
+      if ((Entry[1] < sizeof(*Memory)) ||
+          !CHECK_FLAG(Memory->Flags, EFI_ACPI_4_0_MEMORY_ENABLED) ||
+          (Topology->RangeCount == HVL_NUMA_MAX_RANGES)) {
+        break;
+      }
+
+      Range = &Topology->Ranges[Topology->RangeCount];
+      Range->Base = LShiftU64(Memory->AddressBaseHigh, 32) |
+                    Memory->AddressBaseLow;
+      Range->Length = LShiftU64(Memory->LengthHigh, 32) | Memory->LengthLow;
+      Range->Domain = Memory->ProximityDomain;
+      if (Range->Length != 0) {
+        Topology->RangeCount++;
+      }
+
+      break;
+
+    default:
+      break;
+    }
+
+    Offset += Entry[1];
+  }
+
+  SlitHeader = (CONST VOID *)Slit;
+  if ((SlitHeader != NULL) &&
+      (SlitHeader->Header.Length >= sizeof(*SlitHeader))) {
+    Localities = SlitHeader->NumberOfSystemLocalities;
+    if ((Localities <= MAX_UINT16) &&
+        ((SlitHeader->Header.Length - sizeof(*SlitHeader)) >=
+          (Localities * Localities))) {
+      Topology->LocalityCount = Localities;
+      Topology->Distances = (CONST UINT8 *)(SlitHeader + 1);
+    }
+  }
+
+  if ((Topology->BspDomain == HVL_PROXIMITY_DOMAIN_NONE) ||
+      (Topology->RangeCount == 0)) {
+    return EFI_NOT_FOUND;
+  }
+
+  for (Index = 0; Index < Topology->RangeCount; Index++) {
+    Domain = Topology->Ranges[Index].Domain;
+    for (Next = 0; Next < Topology->DomainCount; Next++) {
+      if (Topology->Domains[Next] == Domain) {
+        break;
+      }
+    }
+
+    if ((Next == Topology->DomainCount) &&
+        (Topology->DomainCount < HVL_NUMA_MAX_DOMAINS)) {
+      Topology->Domains[Topology->DomainCount++] = Domain;
+    }
+  }
+
+  HvlNumaSortDomains(Topology);
+
+  return EFI_SUCCESS;
+}
+
+
+/**
+  Selects an address for an allocation, in the free memory of the nearest
+  proximity domain to the BSP that can hold it.
+  The highest fitting address of the domain in the placement window,
+  [HVL_NUMA_MIN_ADDRESS, HVL_NUMA_MAX_ADDRESS), is selected, the way the
+  firmware allocates top down, without taking memory below 1 MB.
+
+  @param[in]  Topology          The NUMA topology.
+  @param[in]  EfiMemoryMap      The EFI memory map.
+  @param[in]  EfiMemoryMapSize  The EFI memory map size.
+  @param[in]  DescriptorSize    The memory descriptor size.
+  @param[in]  Pages             The allocation page count.
+  @param[out] Address           The selected address.
+  @param[out] Domain            The proximity domain of the address.
+
+  @return EFI_SUCCESS           If an address was selected.
+  @return EFI_NOT_FOUND         If no domain can hold the allocation.
+**/
+EFI_STATUS
+HvlNumaSelectRange (
+  IN  CONST HVL_NUMA_TOPOLOGY     *Topology,
+  IN  CONST EFI_MEMORY_DESCRIPTOR *EfiMemoryMap,
+  IN  UINTN                       EfiMemoryMapSize,
+  IN  UINTN                       DescriptorSize,
+  IN  UINTN                       Pages,
+  OUT EFI_PHYSICAL_ADDRESS        *Address,
+  OUT UINT32                      *Domain
+  )
+{
+
+  EFI_PHYSICAL_ADDRESS        Best;
+  CONST EFI_MEMORY_DESCRIPTOR *Descriptor;
+  UINTN                       DomainIndex;
+  EFI_PHYSICAL_ADDRESS        End;
+  BOOLEAN                     Found;
+  UINTN                       Offset;
+  CONST HVL_NUMA_RANGE        *Range;
+  UINTN                       RangeIndex;
+  UINT64                      Size;
+  EFI_PHYSICAL_ADDRESS        Start;
+
+  if (Pages == 0) {
+    return EFI_NOT_FOUND;
+  }
+
+  Size = EFI_PAGES_TO_SIZE((UINT64)Pages);
+
+  for (DomainIndex = 0;
+       DomainIndex < Topology->DomainCount;
+       DomainIndex++) {
+
+    Best = 0;
+    Found = FALSE;
+
+    for (RangeIndex = 0; RangeIndex < Topology->RangeCount; RangeIndex++) {
+      Range = &Topology->Ranges[RangeIndex];
+      if (Range->Domain != Topology->Domains[DomainIndex]) {
+        continue;
+      }
+
+      for (Offset = 0;
+           Offset < EfiMemoryMapSize;
+           Offset += DescriptorSize) {
+
+        Descriptor = (CONST VOID *)((CONST UINT8 *)EfiMemoryMap + Offset);
+        if (Descriptor->Type != EfiConventionalMemory) {
+          continue;
+        }
+
+        Start = MAX(Descriptor->PhysicalStart, Range->Base);
+        Start = MAX(Start, HVL_NUMA_MIN_ADDRESS);
+        End = MIN(
+                Descriptor->PhysicalStart +
+                  EFI_PAGES_TO_SIZE(Descriptor->NumberOfPages),
+                Range->Base + Range->Length
+                );
+
+        End = MIN(End, HVL_NUMA_MAX_ADDRESS);
+
+        Start = ALIGN_VALUE(Start, EFI_PAGE_SIZE);
+        End &= ~(UINT64)EFI_PAGE_MASK;
+
+        if ((End > Start) && ((End - Start) >= Size) &&
+            (!Found || ((End - Size) > Best))) {
+          Best = End - Size;
+          Found = TRUE;
+        }
+      }
+    }
+
+    if (Found) {
+      *Address = Best;
+      *Domain = Topology->Domains[DomainIndex];
+      return EFI_SUCCESS;
+    }
+  }
+
+  return EFI_NOT_FOUND;
+}
+
+
+/**
+  Gets the APIC ID of the BSP, HvLoader.efi runs on the BSP.
+  The x2APIC ID is used if CPUID leaf 0x0B is supported, otherwise the
+  initial xAPIC ID.
+
+  @return The BSP APIC ID.
+**/
+UINT32
+HvlNumaGetBspApicId (
+  VOID
+  )
+{
+
+  UINT32  Ebx;
+  UINT32  Edx;
+  UINT32  MaxLeaf;
+
+  AsmCpuid(0, &MaxLeaf, NULL, NULL, NULL);
+
+  if (MaxLeaf >= 0x0B) {
+    AsmCpuidEx(0x0B, 0, NULL, &Ebx, NULL, &Edx);
+    if (Ebx != 0) {
+      return Edx;
+    }
+  }
+
+  AsmCpuid(1, NULL, &Ebx, NULL, NULL);
+
+  return Ebx >> 24;
+}
+
+
+/**
+  Initializes the NUMA topology, from the ACPI tables.
+
+  @return None
+**/
+VOID
+HvlNumaInit (
+  VOID
+  )
+{
+
+  EFI_ACPI_DESCRIPTION_HEADER *Slit;
+  EFI_ACPI_DESCRIPTION_HEADER *Srat;
+  EFI_STATUS                  Status;
+
+  mHvlNumaInitialized = TRUE;
+
+  Srat = (VOID *)EfiLocateFirstAcpiTable(
+                   EFI_ACPI_4_0_SYSTEM_RESOURCE_AFFINITY_TABLE_SIGNATURE
+                   );
+
+  if (Srat == NULL) {
+    return;
+  }
+
+  Slit = (VOID *)EfiLocateFirstAcpiTable(
+                   EFI_ACPI_4_0_SYSTEM_LOCALITY_INFORMATION_TABLE_SIGNATURE
+                   );
+
+  mHvlNumaTopology = AllocatePool(sizeof(HVL_NUMA_TOPOLOGY));
+  if (mHvlNumaTopology == NULL) {
+    return;
+  }
+
+  Status = HvlNumaParse(
+             Srat,
+             Slit,
+             HvlNumaGetBspApicId(),
+             mHvlNumaTopology
+             );
+
+  if (EFI_ERROR(Status)) {
+    FreePool(mHvlNumaTopology);
+    mHvlNumaTopology = NULL;
+  }
+}
+
+
+/**
+  Allocates pages on the proximity domain of the BSP, or the nearest one
+  that can hold them. Falls back to AllocateAnyPages, if the system has no
+  SRAT, or no domain can hold the allocation.
+
+  @param[in]  MemoryType  The memory type.
+  @param[in]  Pages       The page count.
+  @param[out] Address     The allocated address.
+  @param[out] Domain      The proximity domain of the allocation, or
+                          HVL_PROXIMITY_DOMAIN_NONE, optional.
+
+  @return EFI_SUCCESS     If the pages were allocated.
+  @return Others          Otherwise.
+**/
+EFI_STATUS
+HvlNumaAllocatePages (
+  IN  EFI_MEMORY_TYPE       MemoryType,
+  IN  UINTN                 Pages,
+  OUT EFI_PHYSICAL_ADDRESS  *Address,
+  OUT UINT32                *Domain OPTIONAL
+  )
+{
+
+  UINTN                 DescriptorSize;
+  EFI_MEMORY_DESCRIPTOR *EfiMemoryMap;
+  UINTN                 EfiMemoryMapSize;
+  UINT32                SelectedDomain;
+  EFI_STATUS            Status;
+
+  if (!mHvlNumaInitialized) {
+    HvlNumaInit();
+  }
+
+  EfiMemoryMap = NULL;
+  SelectedDomain = HVL_PROXIMITY_DOMAIN_NONE;
+  Status = EFI_NOT_FOUND;
+
+  if (mHvlNumaTopology == NULL) {
+    goto Done;
+  }
+
+  Status = HvlGetEfiMemoryMap(
+             &EfiMemoryMap,
+             &EfiMemoryMapSize,
+             &DescriptorSize
+             );
+
+  if (EFI_ERROR(Status)) {
+    goto Done;
+  }
+
+  Status = HvlNumaSelectRange(
+             mHvlNumaTopology,
+             EfiMemoryMap,
+             EfiMemoryMapSize,
+             DescriptorSize,
+             Pages,
+             Address,
+             &SelectedDomain
+             );
+
+  if (EFI_ERROR(Status)) {
+    goto Done;
+  }
+
+  Status = gBS->AllocatePages(AllocateAddress, MemoryType, Pages, Address);
+  if (EFI_ERROR(Status)) {
+    SelectedDomain = HVL_PROXIMITY_DOMAIN_NONE;
+  }
+
+Done:
+
+  if (EfiMemoryMap != NULL) {
+    FreePool(EfiMemoryMap);
+  }
+
+  if (EFI_ERROR(Status)) {
+    Print(
+      L"Warning: NUMA placement of %d pages failed, status %d, "
+      L"using any pages!\r\n",
+      Pages,
+      Status
+      );
+
+    Status = gBS->AllocatePages(AllocateAnyPages, MemoryType, Pages, Address);
+  }
+
+  if (Domain != NULL) {
+    *Domain = SelectedDomain;
+  }
+
+  return Status;
+}
@@ -0,0 +1,121 @@
+/** @file
+  Definitions of the HvLoader.efi NUMA placement policy.
+
+  Copyright (c) Microsoft Corporation.
+  Licensed under the MIT License.
+
+**/
+
+#ifndef __HVLOADER_NUMA_H__
+#define __HVLOADER_NUMA_H__
+
+#include <IndustryStandard/Acpi.h>
+
+//
+// -------------------------------------------------------------------- Defines
+//
+
+//
+// Maximum number of SRAT memory ranges, and of proximity domains with
+// memory, kept by the placement policy.
+//
+#define HVL_NUMA_MAX_RANGES       256
+#define HVL_NUMA_MAX_DOMAINS      64
+
+//
+// ACPI SLIT distances, used if the SLIT is not present, or does not cover a
+// proximity domain.
+//
+#define HVL_NUMA_LOCAL_DISTANCE   10
+#define HVL_NUMA_REMOTE_DISTANCE  20
+
+//
+// Placement window, [HVL_NUMA_MIN_ADDRESS, HVL_NUMA_MAX_ADDRESS).
+// Memory below 1 MB is left to its real mode users, such as the AP and OS
+// trampolines, and placed images stay below 4 GB.
+//
+#define HVL_NUMA_MIN_ADDRESS      BASE_1MB
+#define HVL_NUMA_MAX_ADDRESS      BASE_4GB
+
+
+//
+// ---------------------------------------------------------------------- Types
+//
+
+//
+// SRAT memory range, [Base, Base + Length).
+//
+typedef struct {
+  EFI_PHYSICAL_ADDRESS  Base;
+  UINT64                Length;
+  UINT32                Domain;
+} HVL_NUMA_RANGE;
+
+//
+// NUMA topology, as seen from the BSP.
+//
+typedef struct {
+  //
+  // Proximity domain of the BSP.
+  //
+  UINT32          BspDomain;
+
+  //
+  // Enabled SRAT memory ranges.
+  //
+  UINTN           RangeCount;
+  HVL_NUMA_RANGE  Ranges[HVL_NUMA_MAX_RANGES];
+
+  //
+  // Proximity domains with memory, sorted by distance from the BSP domain.
+  //
+  UINTN           DomainCount;
+  UINT32          Domains[HVL_NUMA_MAX_DOMAINS];
+
+  //
+  // SLIT distance matrix, LocalityCount x LocalityCount, or NULL.
+  //
+  UINT64          LocalityCount;
+  CONST UINT8     *Distances;
+} HVL_NUMA_TOPOLOGY;
+
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+EFI_STATUS
+HvlNumaParse (
+  IN  CONST EFI_ACPI_DESCRIPTION_HEADER *Srat,
+  IN  CONST EFI_ACPI_DESCRIPTION_HEADER *Slit OPTIONAL,
+  IN  UINT32                            BspApicId,
+  OUT HVL_NUMA_TOPOLOGY                 *Topology
+  );
+
+UINT8
+HvlNumaDistance (
+  IN  CONST HVL_NUMA_TOPOLOGY   *Topology,
+  IN  UINT32                    From,
+  IN  UINT32                    To
+  );
+
+EFI_STATUS
+HvlNumaSelectRange (
+  IN  CONST HVL_NUMA_TOPOLOGY     *Topology,
+  IN  CONST EFI_MEMORY_DESCRIPTOR *EfiMemoryMap,
+  IN  UINTN                       EfiMemoryMapSize,
+  IN  UINTN                       DescriptorSize,
+  IN  UINTN                       Pages,
+  OUT EFI_PHYSICAL_ADDRESS        *Address,
+  OUT UINT32                      *Domain
+  );
+
+EFI_STATUS
+HvlNumaAllocatePages (
+  IN  EFI_MEMORY_TYPE       MemoryType,
+  IN  UINTN                 Pages,
+  OUT EFI_PHYSICAL_ADDRESS  *Address,
+  OUT UINT32                *Domain OPTIONAL
+  );
+
+#endif // !__HVLOADER_NUMA_H__
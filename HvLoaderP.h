@@ -27,6 +27,40 @@
 #define HVL_TEST          0
 #define HVL_TEST_VERBOSE  0
 
+//
+// HVL_FOOTPRINT build.
+// Set to 1 to snapshot the memory map before and after the hypervisor
+// loader entry point, and report the launch memory footprint as
+// HVL_FOOTPRINT_RECORD lines, on the console and in the shared log ring.
+//
+#define HVL_FOOTPRINT     0
+
+//
+// HVL_TIMING build.
+// Set to 1 to time the loader DLL launch phases, and keep them in the boot
+// timing history variable, see HvLoaderTiming.c. Requires the platform DSC
+// to map TimerLib to a real timer library instance, see README.md.
+//
+#define HVL_TIMING        0
+
+//
+// HVL_NUMA build.
+// Set to 1 to place the hypervisor loader image, the images loaded without
+// options, and the loader service allocations, on the NUMA node of the BSP,
+// see HvLoaderNuma.c. Otherwise they are placed anywhere, and NUMA
+// placement is only used when requested by HVL_IMAGE_PLACE_BSP_NODE.
+//
+#define HVL_NUMA          0
+
+//
+// HVL_ENV_OS build.
+// Set to 1 by the OS environment build of the image read and load pipeline,
+// see Os/HvLoaderOs.c.
+//
+#ifndef HVL_ENV_OS
+#define HVL_ENV_OS        0
+#endif
+
 //
 // Delay in mSec for displaying a fatal error message.
 //
@@ -37,11 +71,71 @@
 //
 #define HVL_DEF_LOADER_DLL_PATH   L"\\lxhvloader.dll"
 
+//
+// Last known good HV loader DLL path.
+//
+#define HVL_LKG_LOADER_DLL_PATH   L"\\lxhvloader.lkg.dll"
+
+//
+// HV loader DLL slots, in launch order:
+// the command line DLL path, the default path, and the last known good path.
+// A slot that failed HVL_SLOT_MAX_FAILURES consecutive launches is tried
+// after all other slots.
+//
+#define HVL_SLOT_PRIMARY          0
+#define HVL_SLOT_SECONDARY        1
+#define HVL_SLOT_LAST_KNOWN_GOOD  2
+#define HVL_SLOT_COUNT            3
+
+#define HVL_SLOT_MAX_FAILURES     2
+
+//
+// Slot state variable name, vendor GUID, and content version.
+// The variable is non-volatile, and boot services only.
+//
+#define HVL_SLOT_STATE_VARIABLE   L"HvLoaderSlotState"
+
+#define HVL_SLOT_STATE_GUID \
+        {0x3e6c1f52, 0x8b0d, 0x4c7a, \
+        {0x9a, 0x24, 0x71, 0xd5, 0x0e, 0xb3, 0x46, 0x9f}}
+
+#define HVL_SLOT_STATE_VERSION    2
+
+//
+// HV loader DLL launch phases, the phase a slot launch ended in.
+//
+#define HVL_LAUNCH_PHASE_READ     0
+#define HVL_LAUNCH_PHASE_VERIFY   1
+#define HVL_LAUNCH_PHASE_LOAD     2
+#define HVL_LAUNCH_PHASE_ENTRY    3
+
 //
 // Default HV loader DLL path.
 //
 #define HVL_CMDLINE__TEST_RUN     L"--Test"
 
+//
+// Test run command line option, using the mock 
+// LINUX_EFI_HYPERVISOR_MEDIA_PROTOCOL provider instead of the one installed
+// by the hypervisor loader.
+//
+#define HVL_CMDLINE__TEST_MOCK    L"--TestMock"
+
+//
+// Benchmark run command line option, '--Bench[=N] [<loader DLL path>]'.
+// Runs the read, verify, load and relocate pipeline N times, without calling
+// the loader entry point, and reports per phase statistics.
+// The loader DLL path defaults to HVL_DEF_LOADER_DLL_PATH.
+// Available in HVL_TEST builds only.
+//
+#define HVL_CMDLINE__BENCH_RUN    L"--Bench"
+
+//
+// Benchmark iteration count, default and upper limit.
+//
+#define HVL_BENCH_DEF_ITERATIONS  10
+#define HVL_BENCH_MAX_ITERATIONS  1000
+
 //
 // Useful macros for setting and checking flags.
 //
@@ -53,6 +147,8 @@
 // HV loader DLL path flags.
 //
 #define HVL_PATH_FLAG__DEF_PATH   0x00000001
+#define HVL_PATH_FLAG__TEST_MOCK  0x20000000
+#define HVL_PATH_FLAG__BENCH_RUN  0x40000000
 #define HVL_PATH_FLAG__TEST_RUN   0x80000000
 
 //
@@ -62,6 +158,18 @@
 //
 #define HVL_IMAGE_MEMORY_TYPE     EfiLoaderCode
 
+//
+// First OEM reserved memory type, the OEM and OS reserved types follow.
+//
+#define HVL_MEMORY_TYPE_OEM_RESERVED_MIN  0x70000000
+
+//
+// Footprint record prefix, and number of footprint memory type buckets:
+// the EFI memory types, and a last bucket for OEM and OS memory types.
+//
+#define HVL_FOOTPRINT_RECORD      L"HVL_FOOTPRINT"
+#define HVL_FOOTPRINT_TYPES       (EfiMaxMemoryType + 1)
+
 //
 // SHIM LOCK protocol GUID.
 //
@@ -105,6 +213,55 @@ typedef struct  {
 } EFI_SHIM_LOCK_GUID_PROTOCOL;
 
 
+//
+// An open image file, see HvlOpenImageFile().
+// Header holds the first HeaderSize bytes of the file, a sparse image
+// container header if its signature is HVL_SPARSE_SIGNATURE. ImageSize is
+// the size of the image file held, once expanded.
+//
+typedef struct {
+  EFI_FILE_HANDLE   FileHandle;
+  UINTN             FileSize;
+  UINTN             ImageSize;
+  UINTN             HeaderSize;
+  HVL_SPARSE_HEADER Header;
+} HVL_IMAGE_FILE;
+
+
+//
+// HV loader DLL slot state, HVL_SLOT_STATE_VARIABLE content.
+// A slot failure count is reset when the slot DLL file identity, a hash of
+// its path, size and modification time, changes.
+//
+typedef struct {
+  UINT32  Version;
+  UINT32  Identity[HVL_SLOT_COUNT];
+  UINT8   Failures[HVL_SLOT_COUNT];
+  UINT8   Reserved;
+} HVL_SLOT_STATE;
+
+//
+// HV loader DLL slots.
+// Paths of slots that duplicate an earlier slot are NULL. Order lists the
+// slots to launch, known bad slots last.
+//
+typedef struct {
+  CHAR16          *Paths[HVL_SLOT_COUNT];
+  UINTN           Order[HVL_SLOT_COUNT];
+  UINTN           Count;
+  HVL_SLOT_STATE  State;
+  HVL_SLOT_STATE  StoredState;
+} HVL_SLOTS;
+
+//
+// Memory footprint snapshot, HVL_FOOTPRINT.
+// Page totals of the EFI memory map, by memory type.
+//
+typedef struct {
+  UINT64  Pages[HVL_FOOTPRINT_TYPES];
+} HVL_FOOTPRINT_SNAPSHOT;
+
+
 //
 // -------------------------------------------------------------------- Globals
 //
@@ -116,9 +273,203 @@ extern EFI_GUID gEfiShimLockProtocolGuid;
 // ------------------------------------------------------------------ FUnctions
 //
 
+UINT32
+HvlCmdLineHash (
+  IN  CONST CHAR16  *Key,
+  IN  UINTN         KeyLength
+  );
+
+CONST CHAR16 *
+HvlCmdLineLookup (
+  IN  CONST HVL_CMDLINE_TABLE *Table,
+  IN  CONST CHAR16            *Key,
+  IN  UINTN                   KeyLength
+  );
+
+EFI_STATUS
+HvlBuildCmdLineTable (
+  IN  EFI_LOADED_IMAGE_PROTOCOL *LoadedImage,
+  OUT HVL_CMDLINE_TABLE         **CmdLineTable
+  );
+
+EFI_STATUS
+HvlGetCmdLineOption (
+  IN  EFI_LOADED_IMAGE_PROTOCOL *LoadedImage,
+  IN  UINTN                     OptionIndex,
+  OUT CHAR16                    **Option
+  );
+
+EFI_STATUS
+HvlGetVolumeRoot (
+  IN  EFI_LOADED_IMAGE_PROTOCOL *LoadedImage,
+  OUT EFI_FILE_HANDLE           *FsRoot
+  );
+
 VOID
-HvlTestRun (
+HvlCloseVolumeRoot (
   VOID
   );
 
+EFI_STATUS
+HvlOpenFile (
+  IN  EFI_LOADED_IMAGE_PROTOCOL *LoadedImage,
+  IN  CONST CHAR16              *FilePath,
+  OUT EFI_FILE_HANDLE           *FileHandle,
+  OUT UINTN                     *FileSize
+  );
+
+EFI_STATUS
+HvlGetFileStamp (
+  IN  EFI_LOADED_IMAGE_PROTOCOL *LoadedImage,
+  IN  CONST CHAR16              *FilePath,
+  OUT UINT64                    *FileSize,
+  OUT EFI_TIME                  *ModificationTime
+  );
+
+EFI_STATUS
+HvlReadFileData (
+  IN  EFI_FILE_HANDLE FileHandle,
+  IN  UINTN           Size,
+  OUT VOID            *Buffer
+  );
+
+HVL_LOADER_SERVICES *
+HvlInitServices (
+  IN  EFI_LOADED_IMAGE_PROTOCOL *LoadedImage
+  );
+
+VOID
+HvlFreeServices (
+  VOID
+  );
+
+VOID
+EFIAPI
+HvlLog (
+  IN  CONST CHAR16  *Format,
+  ...
+  );
+
+EFI_STATUS
+HvlGetEfiMemoryMap (
+  OUT EFI_MEMORY_DESCRIPTOR **EfiMemoryMap,
+  OUT UINTN                 *EfiMemoryMapSize,
+  OUT UINTN                 *DescriptorSize
+  );
+
+EFI_STATUS
+HvlOpenImageFile (
+  IN  EFI_LOADED_IMAGE_PROTOCOL *LoadedImage,
+  IN  CONST CHAR16              *FilePath,
+  OUT HVL_IMAGE_FILE            *ImageFile
+  );
+
+EFI_STATUS
+HvlReadImageFile (
+  IN  HVL_IMAGE_FILE  *ImageFile,
+  OUT VOID            *ImageBuffer
+  );
+
+VOID
+HvlCloseImageFile (
+  IN OUT  HVL_IMAGE_FILE  *ImageFile
+  );
+
+EFI_STATUS
+HvlLoadLoaderDll (
+  IN  EFI_LOADED_IMAGE_PROTOCOL *LoadedImage,
+  IN  CHAR16                    *DllFilePath,
+  OUT VOID*                     *DllFileBuffer,
+  OUT UINTN                     *DllFileSize
+  );
+
+EFI_STATUS
+HvlShimVerify (
+  IN  VOID    *Contet,
+  IN  UINT32  ContetSize
+  );
+
+EFI_STATUS
+HvlAllocateImagePages (
+  IN  CONST HVL_IMAGE_LOAD_OPTIONS  *Options,
+  IN  UINTN                         Pages,
+  OUT EFI_PHYSICAL_ADDRESS          *Address,
+  OUT UINT32                        *ProximityDomain
+  );
+
+VOID
+HvlFreeImagePages (
+  IN  EFI_PHYSICAL_ADDRESS  Address,
+  IN  UINTN                 Pages
+  );
+
+EFI_STATUS
+HvlLoadPeCoffImage (
+  IN  VOID                          *PeCoffImage,
+  IN  CONST HVL_IMAGE_LOAD_OPTIONS  *Options OPTIONAL,
+  OUT HVL_LOADED_IMAGE_INFO         *LoadedImageInfo
+  );
+
+EFI_STATUS
+HvlInstallImageLoader (
+  IN  EFI_HANDLE  ImageHandle
+  );
+
+VOID
+HvlUninstallImageLoader (
+  VOID
+  );
+
+VOID
+HvlSlotsInit (
+  IN  EFI_LOADED_IMAGE_PROTOCOL *LoadedImage,
+  IN  CHAR16                    *PrimaryPath,
+  OUT HVL_SLOTS                 *Slots
+  );
+
+VOID
+HvlSlotReport (
+  IN OUT  HVL_SLOTS   *Slots,
+  IN      UINTN       Slot,
+  IN      EFI_STATUS  LaunchStatus,
+  IN      UINT32      LaunchPhase
+  );
+
+UINT64
+HvlTimingStart (
+  VOID
+  );
+
+UINT32
+HvlTimingElapsedUs (
+  IN  UINT64  Start
+  );
+
+VOID
+HvlTimingSave (
+  IN OUT  HVL_TIMING_RECORD *Record
+  );
+
+EFI_STATUS
+HvlFootprintSnapshot (
+  OUT HVL_FOOTPRINT_SNAPSHOT *Footprint
+  );
+
+VOID
+HvlFootprintReport (
+  IN  CONST HVL_FOOTPRINT_SNAPSHOT *Before,
+  IN  CONST HVL_LOADED_IMAGE_INFO  *DllImageInfo
+  );
+
+EFI_STATUS
+HvlTestRun (
+  IN  BOOLEAN   UseMock
+  );
+
+EFI_STATUS
+HvlBenchRun (
+  IN  EFI_LOADED_IMAGE_PROTOCOL *LoadedImage,
+  IN  CHAR16                    *DllFilePath
+  );
+
 #endif // !__HVLOADERP_H__
\ No newline at end of file
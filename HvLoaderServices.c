@@ -0,0 +1,554 @@
+/** @file
+  HvLoader.efi loader services (HVL_VERSION_2_0).
+  The services let the hypervisor loader reuse HvLoader.efi file I/O and
+  page allocation, and log to a ring shared with HvLoader.efi.
+  The image loader protocol lets the launch chain reuse the HvLoader.efi
+  read, verify, load and relocate pipeline.
+
+  Copyright (c) Microsoft Corporation.
+  Licensed under the MIT License.
+
+**/
+
+#include <stddef.h>
+#include <Uefi.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/PrintLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/UefiLib.h>
+#include <Protocol/LoadedImage.h>
+
+#include "HvLoaderEfi.h"
+#include "HvLoaderNuma.h"
+#include "HvLoaderP.h"
+
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// The EFI_LOADED_IMAGE_PROTOCOL interface for this app.
+//
+EFI_LOADED_IMAGE_PROTOCOL *mHvlLoadedImage = NULL;
+
+//
+// The shared log ring.
+//
+HVL_LOG_RING *mHvlLogRing = NULL;
+
+//
+// The image loader protocol, and the handle it is installed on.
+//
+EFI_GUID gHvlImageLoaderProtocolGuid = HVL_IMAGE_LOADER_PROTOCOL_GUID;
+EFI_HANDLE mHvlImageLoaderHandle = NULL;
+
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+/**
+  HVL_READ_FILE service, see HvLoaderEfi.h.
+**/
+EFI_STATUS
+EFIAPI
+HvlServiceReadFile (
+  IN      CONST CHAR16          *FilePath,
+  IN      EFI_MEMORY_TYPE       MemoryType,
+  IN OUT  EFI_PHYSICAL_ADDRESS  *Address,
+  IN OUT  UINTN                 *Pages,
+  OUT     UINTN                 *FileSize
+  )
+{
+
+  BOOLEAN         Allocated;
+  HVL_IMAGE_FILE  ImageFile;
+  UINTN           RequiredPages;
+  EFI_STATUS      Status;
+
+  if ((FilePath == NULL) || (Address == NULL) || (Pages == NULL) ||
+      (FileSize == NULL)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  Allocated = FALSE;
+
+  //
+  // Sparse image containers are expanded, as for the hypervisor loader
+  // DLL, so the file size is the size of the image file held.
+  //
+
+  Status = HvlOpenImageFile(mHvlLoadedImage, FilePath, &ImageFile);
+  if (EFI_ERROR(Status)) {
+    return Status;
+  }
+
+  *FileSize = ImageFile.ImageSize;
+  RequiredPages = EFI_SIZE_TO_PAGES(*FileSize);
+
+  if (*Address == 0) {
+    Status = gBS->AllocatePages(
+                    AllocateAnyPages,
+                    MemoryType,
+                    RequiredPages,
+                    Address
+                    );
+
+    if (EFI_ERROR(Status)) {
+      Print(L"Error: AllocatePages failed, status %d!\r\n", Status);
+      *Address = 0;
+      goto Done;
+    }
+
+    Allocated = TRUE;
+
+  } else if (*Pages < RequiredPages) {
+    Status = EFI_BUFFER_TOO_SMALL;
+    goto Done;
+  }
+
+  Status = HvlReadImageFile(&ImageFile, (VOID *)(UINTN)*Address);
+
+  if (EFI_ERROR(Status) && Allocated) {
+    gBS->FreePages(*Address, RequiredPages);
+    *Address = 0;
+    RequiredPages = 0;
+  }
+
+Done:
+
+  if (Allocated || (Status == EFI_BUFFER_TOO_SMALL)) {
+    *Pages = RequiredPages;
+  }
+
+  HvlCloseImageFile(&ImageFile);
+
+  return Status;
+}
+
+
+/**
+  HVL_ALLOCATE_PAGES service, see HvLoaderEfi.h.
+**/
+EFI_STATUS
+EFIAPI
+HvlServiceAllocatePages (
+  IN OUT  HVL_PAGE_REQUEST      *Requests,
+  IN      UINTN                 RequestCount
+  )
+{
+
+  EFI_PHYSICAL_ADDRESS  Address;
+  UINTN                 Index;
+  EFI_MEMORY_TYPE       MemoryType;
+  UINTN                 Next;
+  UINTN                 Pages;
+  EFI_STATUS            Status;
+
+  if ((Requests == NULL) && (RequestCount != 0)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  for (Index = 0; Index < RequestCount; Index++) {
+    Requests[Index].Address = 0;
+  }
+
+  Status = EFI_SUCCESS;
+
+  //
+  // Allocate a single contiguous block per memory type, and carve it
+  // between the requests of that type. Blocks are placed like the loader
+  // image, on the BSP NUMA node in HVL_NUMA builds.
+  //
+
+  for (Index = 0; Index < RequestCount; Index++) {
+    if ((Requests[Index].Address != 0) || (Requests[Index].Pages == 0)) {
+      continue;
+    }
+
+    MemoryType = Requests[Index].MemoryType;
+    Pages = 0;
+
+    for (Next = Index; Next < RequestCount; Next++) {
+      if (Requests[Next].MemoryType == MemoryType) {
+        Pages += Requests[Next].Pages;
+      }
+    }
+
+#if HVL_NUMA
+    Status = HvlNumaAllocatePages(MemoryType, Pages, &Address, NULL);
+#else // HVL_NUMA
+    Status = gBS->AllocatePages(
+                    AllocateAnyPages,
+                    MemoryType,
+                    Pages,
+                    &Address
+                    );
+#endif // !HVL_NUMA
+    if (EFI_ERROR(Status)) {
+      Print(
+        L"Error: AllocatePages type %d pages %d failed, status %d!\r\n",
+        MemoryType,
+        Pages,
+        Status
+        );
+
+      break;
+    }
+
+    for (Next = Index; Next < RequestCount; Next++) {
+      if ((Requests[Next].MemoryType == MemoryType) &&
+          (Requests[Next].Pages != 0)) {
+        Requests[Next].Address = Address;
+        Address += EFI_PAGES_TO_SIZE(Requests[Next].Pages);
+      }
+    }
+  }
+
+  //
+  // All or nothing.
+  //
+
+  if (EFI_ERROR(Status)) {
+    for (Index = 0; Index < RequestCount; Index++) {
+      if (Requests[Index].Address != 0) {
+        gBS->FreePages(Requests[Index].Address, Requests[Index].Pages);
+        Requests[Index].Address = 0;
+      }
+    }
+  }
+
+  return Status;
+}
+
+
+/**
+  HVL_GET_VOLUME_ROOT service, see HvLoaderEfi.h.
+**/
+EFI_STATUS
+EFIAPI
+HvlServiceGetVolumeRoot (
+  OUT     struct _EFI_FILE_PROTOCOL **Root
+  )
+{
+
+  if (Root == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  return HvlGetVolumeRoot(mHvlLoadedImage, Root);
+}
+
+
+/**
+  HVL_LOG service, see HvLoaderEfi.h.
+**/
+VOID
+EFIAPI
+HvlServiceLog (
+  IN      CONST CHAR16          *Message
+  )
+{
+
+  CHAR16  *Entry;
+
+  if ((mHvlLogRing == NULL) || (Message == NULL)) {
+    return;
+  }
+
+  Entry = (CHAR16 *)(mHvlLogRing + 1) +
+          (UINTN)(mHvlLogRing->NextMessage % mHvlLogRing->EntryCount) *
+          mHvlLogRing->EntryLength;
+
+  StrnCpyS(
+    Entry,
+    mHvlLogRing->EntryLength,
+    Message,
+    mHvlLogRing->EntryLength - 1
+    );
+
+  mHvlLogRing->NextMessage++;
+}
+
+
+/**
+  Logs a formatted message to the shared log ring.
+
+  @param[in]  Format    The message format string.
+  @param[in]  ...       The message arguments.
+
+  @return None
+**/
+VOID
+EFIAPI
+HvlLog (
+  IN  CONST CHAR16  *Format,
+  ...
+  )
+{
+
+  CHAR16  Message[HVL_LOG_ENTRY_LENGTH];
+  VA_LIST Marker;
+
+  VA_START(Marker, Format);
+  UnicodeVSPrint(Message, sizeof(Message), Format, Marker);
+  VA_END(Marker);
+
+  HvlServiceLog(Message);
+}
+
+
+HVL_LOADER_SERVICES mHvlServices = {
+  HVL_SERVICES_VERSION,
+  sizeof(HVL_LOADER_SERVICES),
+  HvlServiceReadFile,
+  HvlServiceAllocatePages,
+  HvlServiceGetVolumeRoot,
+  HvlServiceLog,
+  NULL
+};
+
+
+/**
+  Initializes the loader services, and allocates the shared log ring.
+  The log ring is allocated from pool, so it outlives HvLoader.efi.
+
+  @param[in]  LoadedImage   The EFI_LOADED_IMAGE_PROTOCOL interface for
+                            this app.
+
+  @return The loader services table, or NULL if out of resources.
+**/
+HVL_LOADER_SERVICES *
+HvlInitServices (
+  IN  EFI_LOADED_IMAGE_PROTOCOL *LoadedImage
+  )
+{
+
+  mHvlLoadedImage = LoadedImage;
+
+  if (mHvlLogRing == NULL) {
+    mHvlLogRing = AllocateZeroPool(
+                    sizeof(HVL_LOG_RING) +
+                    (HVL_LOG_ENTRY_COUNT *
+                      HVL_LOG_ENTRY_LENGTH *
+                      sizeof(CHAR16))
+                    );
+
+    if (mHvlLogRing == NULL) {
+      return NULL;
+    }
+
+    mHvlLogRing->EntryLength = HVL_LOG_ENTRY_LENGTH;
+    mHvlLogRing->EntryCount = HVL_LOG_ENTRY_COUNT;
+  }
+
+  mHvlServices.LogRing = mHvlLogRing;
+
+  return &mHvlServices;
+}
+
+
+/**
+  Frees the shared log ring, on a failed launch.
+
+  @return None
+**/
+VOID
+HvlFreeServices (
+  VOID
+  )
+{
+
+  if (mHvlLogRing != NULL) {
+    FreePool(mHvlLogRing);
+    mHvlLogRing = NULL;
+  }
+
+  mHvlServices.LogRing = NULL;
+}
+
+
+/**
+  Checks if a memory type can hold an image loaded by HVL_LOAD_IMAGE.
+  These are the types AllocatePages() accepts: the UEFI types, except free
+  and persistent memory, and the OEM and OS reserved types.
+
+  @param[in]  MemoryType  The memory type.
+
+  @return TRUE            If the memory type is valid.
+  @return FALSE           Otherwise.
+**/
+BOOLEAN
+HvlIsImageMemoryType (
+  IN  EFI_MEMORY_TYPE MemoryType
+  )
+{
+
+  if ((UINT32)MemoryType >= HVL_MEMORY_TYPE_OEM_RESERVED_MIN) {
+    return TRUE;
+  }
+
+  return ((MemoryType < EfiMaxMemoryType) &&
+          (MemoryType != EfiConventionalMemory) &&
+          (MemoryType != EfiPersistentMemory));
+}
+
+
+/**
+  HVL_LOAD_IMAGE method, see HvLoaderEfi.h.
+**/
+EFI_STATUS
+EFIAPI
+HvlServiceLoadImage (
+  IN      CONST CHAR16                  *FilePath OPTIONAL,
+  IN      VOID                          *Buffer OPTIONAL,
+  IN      UINTN                         BufferSize,
+  IN      CONST HVL_IMAGE_LOAD_OPTIONS  *Options OPTIONAL,
+  OUT     HVL_LOADED_IMAGE_INFO         *ImageInfo
+  )
+{
+
+  VOID        *FileBuffer;
+  EFI_STATUS  Status;
+
+  if ((ImageInfo == NULL) || ((FilePath == NULL) == (Buffer == NULL))) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  if ((Options != NULL) &&
+      ((Options->Placement > HVL_IMAGE_PLACE_ADDRESS) ||
+       !HvlIsImageMemoryType(Options->MemoryType))) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  ZeroMem(ImageInfo, sizeof(*ImageInfo));
+  FileBuffer = NULL;
+
+  if (FilePath != NULL) {
+    Status = HvlLoadLoaderDll(
+                mHvlLoadedImage,
+                (CHAR16 *)FilePath,
+                &FileBuffer,
+                &BufferSize
+                );
+
+    if (EFI_ERROR(Status)) {
+      return Status;
+    }
+
+    Buffer = FileBuffer;
+  }
+
+  if (BufferSize > MAX_UINT32) {
+    Status = EFI_INVALID_PARAMETER;
+    goto Done;
+  }
+
+  //
+  // Verify the file content, before any processing is applied.
+  //
+
+  Status = HvlShimVerify(Buffer, (UINT32)BufferSize);
+  if (EFI_ERROR(Status)) {
+    goto Done;
+  }
+
+  Status = HvlLoadPeCoffImage(Buffer, Options, ImageInfo);
+
+Done:
+
+  if (FileBuffer != NULL) {
+    FreePool(FileBuffer);
+  }
+
+  return Status;
+}
+
+
+/**
+  HVL_UNLOAD_IMAGE method, see HvLoaderEfi.h.
+**/
+EFI_STATUS
+EFIAPI
+HvlServiceUnloadImage (
+  IN OUT  HVL_LOADED_IMAGE_INFO         *ImageInfo
+  )
+{
+
+  if ((ImageInfo == NULL) || (ImageInfo->ImageAddress == 0)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  HvlFreeImagePages(ImageInfo->ImageAddress, ImageInfo->ImagePages);
+  ImageInfo->ImageAddress = 0;
+  ImageInfo->ImagePages = 0;
+
+  return EFI_SUCCESS;
+}
+
+
+HVL_IMAGE_LOADER_PROTOCOL mHvlImageLoader = {
+  HVL_IMAGE_LOADER_VERSION,
+  sizeof(HVL_IMAGE_LOADER_PROTOCOL),
+  HvlServiceLoadImage,
+  HvlServiceUnloadImage
+};
+
+
+/**
+  Installs the image loader protocol on the HvLoader.efi image handle.
+  Should be called after HvlInitServices().
+
+  @param[in]  ImageHandle   The HvLoader.efi image handle.
+
+  @return EFI_SUCCESS       If the protocol was installed.
+  @return Others            Otherwise.
+**/
+EFI_STATUS
+HvlInstallImageLoader (
+  IN  EFI_HANDLE  ImageHandle
+  )
+{
+
+  EFI_STATUS  Status;
+
+  Status = gBS->InstallProtocolInterface(
+                  &ImageHandle,
+                  &gHvlImageLoaderProtocolGuid,
+                  EFI_NATIVE_INTERFACE,
+                  &mHvlImageLoader
+                  );
+
+  if (!EFI_ERROR(Status)) {
+    mHvlImageLoaderHandle = ImageHandle;
+  }
+
+  return Status;
+}
+
+
+/**
+  Uninstalls the image loader protocol, since it is implemented by
+  HvLoader.efi, and HvLoader.efi is about to exit.
+
+  @return None
+**/
+VOID
+HvlUninstallImageLoader (
+  VOID
+  )
+{
+
+  if (mHvlImageLoaderHandle != NULL) {
+    gBS->UninstallProtocolInterface(
+           mHvlImageLoaderHandle,
+           &gHvlImageLoaderProtocolGuid,
+           &mHvlImageLoader
+           );
+
+    mHvlImageLoaderHandle = NULL;
+  }
+}
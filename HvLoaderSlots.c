@@ -0,0 +1,288 @@
+/** @file
+  HvLoader.efi HV loader DLL slots.
+  The HV loader DLL is launched from an ordered list of slots, so a failed
+  slot falls through to the next one right away. Consecutive slot failures
+  are counted in a non-volatile variable, so a known bad slot is tried last
+  on later boots, and does not cost a load attempt while another slot works.
+  The count is kept per slot DLL file identity, so replacing the DLL, even
+  in place, gives the slot a fresh start.
+
+  Copyright (c) Microsoft Corporation.
+  Licensed under the MIT License.
+
+**/
+
+#include <stddef.h>
+#include <Uefi.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/UefiLib.h>
+#include <Library/UefiRuntimeServicesTableLib.h>
+#include <Protocol/LoadedImage.h>
+
+#include "HvLoaderEfi.h"
+#include "HvLoaderP.h"
+
+
+//
+// ---------------------------------------------------------------------- Types
+//
+
+//
+// Slot DLL file identity, hashed into HVL_SLOT_STATE.Identity.
+//
+typedef struct {
+  UINT32    PathHash;
+  UINT32    Reserved;
+  UINT64    FileSize;
+  EFI_TIME  ModificationTime;
+} HVL_SLOT_IDENTITY;
+
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+EFI_GUID gHvlSlotStateGuid = HVL_SLOT_STATE_GUID;
+
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+/**
+  Gets the slot state from the slot state variable.
+  A missing or malformed variable reads as a fresh state.
+
+  @param[out] State     The slot state.
+
+  @return None
+**/
+VOID
+HvlSlotGetState (
+  OUT HVL_SLOT_STATE  *State
+  )
+{
+
+  UINT32      Attributes;
+  UINTN       Size;
+  EFI_STATUS  Status;
+
+  Size = sizeof(*State);
+  Status = gRT->GetVariable(
+                  HVL_SLOT_STATE_VARIABLE,
+                  &gHvlSlotStateGuid,
+                  &Attributes,
+                  &Size,
+                  State
+                  );
+
+  if (EFI_ERROR(Status) ||
+      (Size != sizeof(*State)) ||
+      (State->Version != HVL_SLOT_STATE_VERSION)) {
+    ZeroMem(State, sizeof(*State));
+    State->Version = HVL_SLOT_STATE_VERSION;
+  }
+}
+
+
+/**
+  Gets the identity of a slot DLL file, a hash of its path, size and
+  modification time. A missing file is identified by its path only.
+
+  @param[in]  LoadedImage   The EFI_LOADED_IMAGE_PROTOCOL interface for
+                            this app.
+  @param[in]  Path          The slot DLL file path.
+  @param[out] Identity      The slot DLL file identity.
+
+  @return EFI_SUCCESS       If the identity was returned.
+  @return Others            If the file could not be inspected.
+**/
+EFI_STATUS
+HvlSlotGetIdentity (
+  IN  EFI_LOADED_IMAGE_PROTOCOL *LoadedImage,
+  IN  CONST CHAR16              *Path,
+  OUT UINT32                    *Identity
+  )
+{
+
+  HVL_SLOT_IDENTITY SlotIdentity;
+  EFI_STATUS        Status;
+
+  ZeroMem(&SlotIdentity, sizeof(SlotIdentity));
+  SlotIdentity.PathHash = HvlCmdLineHash(Path, StrLen(Path));
+
+  Status = HvlGetFileStamp(
+             LoadedImage,
+             Path,
+             &SlotIdentity.FileSize,
+             &SlotIdentity.ModificationTime
+             );
+
+  if (Status == EFI_NOT_FOUND) {
+    *Identity = SlotIdentity.PathHash;
+    return EFI_SUCCESS;
+  }
+
+  if (EFI_ERROR(Status)) {
+    return Status;
+  }
+
+  *Identity = CalculateCrc32(&SlotIdentity, sizeof(SlotIdentity));
+
+  return EFI_SUCCESS;
+}
+
+
+/**
+  Initializes the HV loader DLL slots, and their launch order.
+
+  @param[in]  LoadedImage   The EFI_LOADED_IMAGE_PROTOCOL interface for
+                            this app.
+  @param[in]  PrimaryPath   The primary slot path, from the command line.
+  @param[out] Slots         The slots.
+
+  @return None
+**/
+VOID
+HvlSlotsInit (
+  IN  EFI_LOADED_IMAGE_PROTOCOL *LoadedImage,
+  IN  CHAR16                    *PrimaryPath,
+  OUT HVL_SLOTS                 *Slots
+  )
+{
+
+  UINT32  Identity;
+  BOOLEAN KnownBad;
+  UINTN   Pass;
+  UINTN   Slot;
+
+  ZeroMem(Slots, sizeof(*Slots));
+
+  Slots->Paths[HVL_SLOT_PRIMARY] = PrimaryPath;
+  Slots->Paths[HVL_SLOT_SECONDARY] = HVL_DEF_LOADER_DLL_PATH;
+  Slots->Paths[HVL_SLOT_LAST_KNOWN_GOOD] = HVL_LKG_LOADER_DLL_PATH;
+
+  for (Slot = HVL_SLOT_SECONDARY; Slot < HVL_SLOT_COUNT; Slot++) {
+    if (!StrCmp(Slots->Paths[Slot], PrimaryPath)) {
+      Slots->Paths[Slot] = NULL;
+    }
+  }
+
+  HvlSlotGetState(&Slots->StoredState);
+  CopyMem(&Slots->State, &Slots->StoredState, sizeof(Slots->State));
+
+  //
+  // A slot DLL file change, for example a new HV loader DLL rollout to a
+  // new path or over the old file, resets the slot failure count.
+  // A file that cannot be inspected keeps its stored identity.
+  //
+
+  for (Slot = 0; Slot < HVL_SLOT_COUNT; Slot++) {
+    if ((Slots->Paths[Slot] == NULL) ||
+        EFI_ERROR(HvlSlotGetIdentity(
+                    LoadedImage,
+                    Slots->Paths[Slot],
+                    &Identity
+                    ))) {
+      continue;
+    }
+
+    if (Slots->State.Identity[Slot] != Identity) {
+      Slots->State.Identity[Slot] = Identity;
+      Slots->State.Failures[Slot] = 0;
+    }
+  }
+
+  //
+  // Launch order: the slots in order, known bad slots last.
+  //
+
+  for (Pass = 0; Pass < 2; Pass++) {
+    for (Slot = 0; Slot < HVL_SLOT_COUNT; Slot++) {
+      if (Slots->Paths[Slot] == NULL) {
+        continue;
+      }
+
+      KnownBad = (Slots->State.Failures[Slot] >= HVL_SLOT_MAX_FAILURES);
+      if (KnownBad != (Pass != 0)) {
+        continue;
+      }
+
+      if (KnownBad) {
+        Print(
+          L"Loader slot %s failed %d times, trying it last.\r\n",
+          Slots->Paths[Slot],
+          Slots->State.Failures[Slot]
+          );
+      }
+
+      Slots->Order[Slots->Count++] = Slot;
+    }
+  }
+}
+
+
+/**
+  Reports a slot launch result, and updates the slot state variable if the
+  slot state changed.
+  A missing slot DLL file, EFI_NOT_FOUND in the read phase, is not a slot
+  failure. EFI_NOT_FOUND from a later phase is.
+
+  @param[in,out]  Slots         The slots.
+  @param[in]      Slot          The launched slot.
+  @param[in]      LaunchStatus  The slot launch status.
+  @param[in]      LaunchPhase   The HVL_LAUNCH_PHASE_* the launch ended in.
+
+  @return None
+**/
+VOID
+HvlSlotReport (
+  IN OUT  HVL_SLOTS   *Slots,
+  IN      UINTN       Slot,
+  IN      EFI_STATUS  LaunchStatus,
+  IN      UINT32      LaunchPhase
+  )
+{
+
+  EFI_STATUS  Status;
+
+  if ((LaunchStatus == EFI_NOT_FOUND) &&
+      (LaunchPhase == HVL_LAUNCH_PHASE_READ)) {
+    return;
+  }
+
+  if (!EFI_ERROR(LaunchStatus)) {
+    Slots->State.Failures[Slot] = 0;
+  } else if (Slots->State.Failures[Slot] < MAX_UINT8) {
+    Slots->State.Failures[Slot]++;
+  }
+
+  //
+  // Only write the variable on change, a healthy boot does not write
+  // non-volatile storage.
+  //
+
+  if (CompareMem(
+        &Slots->State,
+        &Slots->StoredState,
+        sizeof(Slots->State)
+        ) == 0) {
+    return;
+  }
+
+  Status = gRT->SetVariable(
+                  HVL_SLOT_STATE_VARIABLE,
+                  &gHvlSlotStateGuid,
+                  EFI_VARIABLE_NON_VOLATILE | EFI_VARIABLE_BOOTSERVICE_ACCESS,
+                  sizeof(Slots->State),
+                  &Slots->State
+                  );
+
+  if (EFI_ERROR(Status)) {
+    Print(L"Error: Failed to save loader slot state, status %d!\r\n", Status);
+    return;
+  }
+
+  CopyMem(&Slots->StoredState, &Slots->State, sizeof(Slots->State));
+}
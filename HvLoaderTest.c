@@ -1,8 +1,8 @@
 /** @file
   This is a collection of units tests that can be used to verify hypervisor
-  loader functionality. 
-  
-  This code is used for testing purposes only and is not part of production 
+  loader functionality.
+
+  This code is used for testing purposes only and is not part of production
   images!
 
   Copyright (c) Microsoft Corporation.
@@ -19,6 +19,7 @@
 #include <Library/MemoryAllocationLib.h>
 #include <Library/PeCoffLib.h>
 #include <Library/PeCoffGetEntryPointLib.h>
+#include <Library/TimerLib.h>
 #include <Library/UefiApplicationEntryPoint.h>
 #include <Library/UefiBootServicesTableLib.h>
 #include <Library/UefiLib.h>
@@ -32,13 +33,76 @@
 
 #if HVL_TEST
 #include "HvEfi.h"
+#include "HvLoaderMemMap.h"
+#include "HvLoaderNuma.h"
+#include "HvLoaderTest.h"
 
 
 //
 // -------------------------------------------------------------------- Defines
 //
 
-#define Add2Ptr(_ptr,_inc) ((VOID*)((CHAR8*)(_ptr) + (_inc)))
+//
+// Number of timed calls for each of the protocol method benchmarks.
+//
+#define HVL_TEST_BENCH_ITERATIONS   100
+
+//
+// Number of runtime ranges registered by the HvlRegisterRuntimeRange
+// benchmark.
+//
+#define HVL_TEST_RUNTIME_RANGES     256
+
+//
+// Number of physical address lookups per timed call, for the memory map
+// index benchmark.
+//
+#define HVL_TEST_LOOKUPS            1024
+
+//
+// Caller buffer size, for the bulk log drain.
+//
+#define HVL_TEST_LOG_BUFFER_SIZE    (4 * EFI_PAGE_SIZE)
+
+
+//
+// Number of proximity domains of the synthetic ACPI SRAT and SLIT.
+//
+#define HVL_TEST_NUMA_DOMAINS       3
+
+//
+// Size of the synthetic xAPIC BSP proximity domain, in pages.
+//
+#define HVL_TEST_NUMA_BSP_PAGES     16
+
+
+//
+// ---------------------------------------------------------------------- Types
+//
+
+#pragma pack(1)
+
+//
+// Synthetic ACPI SRAT.
+// Two BSP entries, xAPIC ID 0 and x2APIC ID 0x100, a disabled processor,
+// an enabled memory range per domain, and a disabled memory range.
+//
+typedef struct {
+  EFI_ACPI_4_0_SYSTEM_RESOURCE_AFFINITY_TABLE_HEADER          Header;
+  EFI_ACPI_4_0_PROCESSOR_LOCAL_APIC_SAPIC_AFFINITY_STRUCTURE  Apic[2];
+  EFI_ACPI_4_0_PROCESSOR_LOCAL_X2APIC_AFFINITY_STRUCTURE      X2Apic;
+  EFI_ACPI_4_0_MEMORY_AFFINITY_STRUCTURE                      Memory[4];
+} HVL_TEST_SRAT;
+
+//
+// Synthetic ACPI SLIT.
+//
+typedef struct {
+  EFI_ACPI_4_0_SYSTEM_LOCALITY_DISTANCE_INFORMATION_TABLE_HEADER  Header;
+  UINT8 Distances[HVL_TEST_NUMA_DOMAINS][HVL_TEST_NUMA_DOMAINS];
+} HVL_TEST_SLIT;
+
+#pragma pack()
 
 
 //
@@ -46,8 +110,7 @@
 //
 
 EFI_GUID gLinuxEfiHypervisorMediaGuid = LINUX_EFI_HYPERVISOR_MEDIA_GUID;
-
-volatile int Busy = 1;
+EFI_GUID gLinuxEfiHypervisorMediaExGuid = LINUX_EFI_HYPERVISOR_MEDIA_EX_GUID;
 
 //
 // ------------------------------------------------------------------ Functions
@@ -55,188 +118,2759 @@ volatile int Busy = 1;
 
 
 /**
-  Run unit tests.
+  Gets a copy of the memory map from LINUX_EFI_HYPERVISOR_MEDIA_PROTOCOL.
 
-  @return None
+  @param[in]  HvEfiProtocol     The protocol interface.
+  @param[out] EfiMemoryMap      The returned memory map, to be freed by the
+                                caller.
+  @param[out] EfiMemoryMapSize  The returned memory map size.
+  @param[out] DescriptorSize    The returned memory descriptor size.
+  @param[out] MapKey            The returned memory map key (generation).
+
+  @return EFI_SUCCESS           If the memory map was acquired.
+  @return Others                Otherwise.
 **/
-VOID
-HvlTestRun (
-  VOID
+EFI_STATUS
+HvlTestGetMemoryMap (
+  IN  LINUX_EFI_HYPERVISOR_MEDIA_PROTOCOL *HvEfiProtocol,
+  OUT EFI_MEMORY_DESCRIPTOR               **EfiMemoryMap,
+  OUT UINTN                               *EfiMemoryMapSize,
+  OUT UINTN                               *DescriptorSize,
+  OUT UINTN                               *MapKey
   )
 {
 
-    UINTN DescriptorSize;
     UINT32 DescriptorVersion;
     EFI_STATUS EfiStatus;
-    EFI_MEMORY_DESCRIPTOR *EfiMemoryMap;
-    UINTN EfiMemoryMapSize;
-    LINUX_EFI_HYPERVISOR_MEDIA_PROTOCOL *HvEfiProtocol;
-    HV_EFI_GET_MEMORY_MAP_ROUTINE HvlGetMemoryMap;
-    UINTN MapKey;
 
-    Print(L"\r\nHvloader.efi test run starting >>>\r\n");
+    *EfiMemoryMap = NULL;
+    *EfiMemoryMapSize = 0;
 
-    EfiMemoryMap  = NULL;
+    EfiStatus = HvEfiProtocol->HvlGetMemoryMap(
+                  EfiMemoryMapSize,
+                  *EfiMemoryMap,
+                  MapKey,
+                  DescriptorSize,
+                  &DescriptorVersion
+                  );
 
-    EfiStatus = gBS->LocateProtocol(
-                    &gLinuxEfiHypervisorMediaGuid,
-                    NULL,
-                    (VOID **)&HvEfiProtocol
-                    );
+    if (EfiStatus != EFI_BUFFER_TOO_SMALL) {
+        Print(
+          L"Error: Unexpected EFI status %d, expected %d!\r\n",
+          EfiStatus, EFI_BUFFER_TOO_SMALL
+          );
 
-    if (EFI_ERROR(EfiStatus)) {
-        Print(L"Error: LocateProtocol failed, EFI status %d!\r\n", EfiStatus);
-        goto Done;
+        return EFI_PROTOCOL_ERROR;
     }
 
-    //
-    // Test LINUX_EFI_HYPERVISOR_MEDIA_PROTOCOL.HvlGetMemoryMap()
-    //
+    Print(
+      L"HvlpRunTests: Memory map size %d key 0x%X desc size %d "
+      L"desc ver 0x%x\r\n",
+      *EfiMemoryMapSize, *MapKey, *DescriptorSize, DescriptorVersion
+      );
 
-    HvlGetMemoryMap = HvEfiProtocol->HvlGetMemoryMap;
-    if (HvlGetMemoryMap == NULL) {
-        Print(L"Error: Bad HV EFI protocol, no GetMemoryMap method!\r\n");
-        EfiStatus = EFI_PROTOCOL_ERROR;
-        goto Done;
+    *EfiMemoryMap = AllocateZeroPool(*EfiMemoryMapSize);
+    if (*EfiMemoryMap == NULL) {
+        Print(L"Error: AllocatePool failed!\r\n");
+        return EFI_OUT_OF_RESOURCES;
     }
 
-    EfiMemoryMapSize = 0;
-    EfiStatus = HvlGetMemoryMap(
-                  &EfiMemoryMapSize, 
-                  EfiMemoryMap, 
-                  &MapKey,
-                  &DescriptorSize,
+    EfiStatus = HvEfiProtocol->HvlGetMemoryMap(
+                  EfiMemoryMapSize,
+                  *EfiMemoryMap,
+                  MapKey,
+                  DescriptorSize,
                   &DescriptorVersion
                   );
-    
-    if (EfiStatus != EFI_BUFFER_TOO_SMALL) {
+
+    if (EFI_ERROR(EfiStatus)) {
         Print(
-          L"Error: Unexpected EFI status %d, expected %d!\r\n", 
-          EfiStatus, EFI_BUFFER_TOO_SMALL
+          L"Error: HvlGetMemoryMap failed, status %d, required size %d !\r\n",
+          EfiStatus, *EfiMemoryMapSize
           );
 
-        goto Done;
+        FreePool(*EfiMemoryMap);
+        *EfiMemoryMap = NULL;
+        return EfiStatus;
     }
 
-    Print(
-      L"HvlpRunTests: Memory map size %d key 0x%X desc size %d "
-      L"desc ver 0x%x\r\n", 
-      EfiMemoryMapSize, MapKey, DescriptorSize, DescriptorVersion
-      );
+    return EFI_SUCCESS;
+}
 
-    EfiStatus = gBS->AllocatePool(
-                      EfiBootServicesData, 
-                      EfiMemoryMapSize, 
-                      (VOID **)&EfiMemoryMap
-                      );
 
-    if (EFI_ERROR(EfiStatus)) {
-        Print(L"Error: AllocatePool failed, status %d!\r\n", EfiStatus);
-        goto Done;
+/**
+  Validates the HV_EFI_MEMORY_DESCRIPTOR_EX memory map invariants:
+  - The descriptor size can hold an EFI_MEMORY_DESCRIPTOR and the
+    HV_EFI_MEMORY_DESCRIPTOR_EX extension, and the map size is a multiple
+    of it.
+  - Descriptors are page aligned, non empty, sorted and non-overlapping.
+
+  @param[in]  EfiMemoryMap      The memory map.
+  @param[in]  EfiMemoryMapSize  The memory map size.
+  @param[in]  DescriptorSize    The memory descriptor size.
+
+  @return EFI_SUCCESS           If the memory map is valid.
+  @return EFI_PROTOCOL_ERROR    Otherwise.
+**/
+EFI_STATUS
+HvlTestValidateMemoryMap (
+  IN  EFI_MEMORY_DESCRIPTOR *EfiMemoryMap,
+  IN  UINTN                 EfiMemoryMapSize,
+  IN  UINTN                 DescriptorSize
+  )
+{
+
+    EFI_MEMORY_DESCRIPTOR *Descriptor;
+    UINTN Index;
+    EFI_PHYSICAL_ADDRESS PrevEnd;
+    VOID *TableEnd;
+
+    if ((DescriptorSize < sizeof(EFI_MEMORY_DESCRIPTOR) +
+                          sizeof(HV_EFI_MEMORY_DESCRIPTOR_EX)) ||
+        ((DescriptorSize % sizeof(UINT64)) != 0) ||
+        ((EfiMemoryMapSize % DescriptorSize) != 0)) {
+
+        Print(
+          L"Error: Bad descriptor size %d, map size %d!\r\n",
+          DescriptorSize, EfiMemoryMapSize
+          );
+
+        return EFI_PROTOCOL_ERROR;
     }
 
-    ZeroMem(EfiMemoryMap, EfiMemoryMapSize);
+    Descriptor = EfiMemoryMap;
+    TableEnd = Add2Ptr(EfiMemoryMap, EfiMemoryMapSize);
+    PrevEnd = 0;
+    Index = 0;
+
+    while (Descriptor != TableEnd) {
+        if (((Descriptor->PhysicalStart & EFI_PAGE_MASK) != 0) ||
+            (Descriptor->NumberOfPages == 0)) {
+
+            Print(
+              L"Error: Descriptor %d addr %p np %ld is not valid!\r\n",
+              Index, Descriptor->PhysicalStart, Descriptor->NumberOfPages
+              );
+
+            return EFI_PROTOCOL_ERROR;
+        }
+
+        if ((Index != 0) && (Descriptor->PhysicalStart < PrevEnd)) {
+            Print(
+              L"Error: Descriptor %d addr %p is not sorted or overlaps "
+              L"previous end %p!\r\n",
+              Index, Descriptor->PhysicalStart, PrevEnd
+              );
+
+            return EFI_PROTOCOL_ERROR;
+        }
+
+        PrevEnd = Descriptor->PhysicalStart +
+                  EFI_PAGES_TO_SIZE(Descriptor->NumberOfPages);
+
+        Descriptor = Add2Ptr(Descriptor, DescriptorSize);
+        Index++;
+    }
+
+    Print(L"HvlpRunTests: Memory map of %d descriptors is valid\r\n", Index);
+
+    return EFI_SUCCESS;
+}
+
+
+/**
+  Prints HV and HV loader memory descriptors, or all descriptors in
+  HVL_TEST_VERBOSE builds.
+
+  @param[in]  EfiMemoryMap      The memory map.
+  @param[in]  EfiMemoryMapSize  The memory map size.
+  @param[in]  DescriptorSize    The memory descriptor size.
+
+  @return None
+**/
+VOID
+HvlTestPrintMemoryMap (
+  IN  EFI_MEMORY_DESCRIPTOR *EfiMemoryMap,
+  IN  UINTN                 EfiMemoryMapSize,
+  IN  UINTN                 DescriptorSize
+  )
+{
+
+    EFI_MEMORY_DESCRIPTOR *Descriptor;
+    HV_EFI_MEMORY_DESCRIPTOR_EX *DescriptorEx;
+    int Index;
+    VOID *TableEnd;
+
+    Descriptor = EfiMemoryMap;
+    TableEnd = Add2Ptr(EfiMemoryMap, EfiMemoryMapSize);
+    Index = 1;
+    while (Descriptor != TableEnd) {
+      DescriptorEx = HvlDescriptorEx(Descriptor, DescriptorSize);
+
+#if HVL_TEST_VERBOSE
+      Print(
+        L"%02d) type 0x%X addr %p, np %d attr 0x%x xattr 0x%p\r\n",
+        Index,
+        Descriptor->Type,
+        Descriptor->PhysicalStart,
+        Descriptor->NumberOfPages,
+        Descriptor->Attribute,
+        DescriptorEx->ExAttribute
+        );
+#else // HVL_TEST_VERBOSE
+      if (CHECK_FLAG(
+            DescriptorEx->ExAttribute,
+            HV_EFI_MEMORY_EX_ATTR_HVLOADER
+            )) {
+
+        Print(
+          L"Loader mem: type 0x%X addr %p, np %d attr 0x%x xattr 0x%p\r\n",
+          Descriptor->Type,
+          Descriptor->PhysicalStart,
+          Descriptor->NumberOfPages,
+          Descriptor->Attribute,
+          DescriptorEx->ExAttribute
+          );
+      }
+
+      if (CHECK_FLAG(
+            DescriptorEx->ExAttribute,
+            HV_EFI_MEMORY_EX_ATTR_HV
+            )) {
+
+        Print(
+          L"HV mem: type 0x%X addr %p, np %d attr 0x%x xattr 0x%p\r\n",
+          Descriptor->Type,
+          Descriptor->PhysicalStart,
+          Descriptor->NumberOfPages,
+          Descriptor->Attribute,
+          DescriptorEx->ExAttribute
+          );
+      }
+#endif // !HVL_TEST_VERBOSE
+     Descriptor = Add2Ptr(Descriptor, DescriptorSize);
+     Index++;
+    }
+}
+
+
+/**
+  Gets the memory map index from LINUX_EFI_HYPERVISOR_MEDIA_PROTOCOL, or
+  builds it from the memory map, if the provider does not support it.
+
+  @param[in]  HvEfiExProtocol   The extension protocol interface, or NULL.
+  @param[in]  EfiMemoryMap      The memory map.
+  @param[in]  EfiMemoryMapSize  The memory map size.
+  @param[in]  DescriptorSize    The memory descriptor size.
+  @param[out] Index             The returned memory map index, to be freed
+                                by the caller.
+
+  @return EFI_SUCCESS           If the memory map index was acquired.
+  @return Others                Otherwise.
+**/
+EFI_STATUS
+HvlTestGetMemoryMapIndex (
+  IN  LINUX_EFI_HYPERVISOR_MEDIA_EX_PROTOCOL *HvEfiExProtocol,
+  IN  EFI_MEMORY_DESCRIPTOR                  *EfiMemoryMap,
+  IN  UINTN                                  EfiMemoryMapSize,
+  IN  UINTN                                  DescriptorSize,
+  OUT HV_EFI_MEMORY_MAP_INDEX                **Index
+  )
+{
+
+    EFI_STATUS EfiStatus;
+    UINTN IndexSize;
+    UINTN Pass;
+
+    *Index = NULL;
+    IndexSize = 0;
+
+    for (Pass = 0; Pass < 2; Pass++) {
+        if (HV_EFI_MEDIA_EX_SUPPORTS(HvEfiExProtocol, HvlGetMemoryMapIndex)) {
+            EfiStatus = HvEfiExProtocol->HvlGetMemoryMapIndex(
+                          &IndexSize,
+                          *Index
+                          );
+
+        } else {
+            EfiStatus = HvlMemMapIndexBuild(
+                          EfiMemoryMap,
+                          EfiMemoryMapSize,
+                          DescriptorSize,
+                          0,
+                          *Index,
+                          &IndexSize
+                          );
+        }
+
+        if ((EfiStatus != EFI_BUFFER_TOO_SMALL) || (*Index != NULL)) {
+            break;
+        }
+
+        *Index = AllocatePool(IndexSize);
+        if (*Index == NULL) {
+            Print(L"Error: AllocatePool failed!\r\n");
+            return EFI_OUT_OF_RESOURCES;
+        }
+    }
 
-    EfiStatus = HvlGetMemoryMap(
-                  &EfiMemoryMapSize, 
-                  EfiMemoryMap, 
-                  &MapKey,
-                  &DescriptorSize,
-                  &DescriptorVersion
-                  );
-    
     if (EFI_ERROR(EfiStatus)) {
         Print(
-          L"Error: HvlGetMemoryMap failed, status %d, required size %d !\r\n",
-          EfiStatus, EfiMemoryMapSize
+          L"Error: Memory map index failed, status %d, size %d!\r\n",
+          EfiStatus, IndexSize
           );
 
-        goto Done;
+        if (*Index != NULL) {
+            FreePool(*Index);
+            *Index = NULL;
+        }
+
+        return EfiStatus;
     }
 
     Print(
-      L"HvlpRunTests: Allocated memory map size %d key 0x%X "
-      L"desc size %d desc ver 0x%x\r\n",
-      EfiMemoryMapSize, MapKey, DescriptorSize, DescriptorVersion
+      L"HvlpRunTests: Memory map index (%s) size %d, %d HV ranges\r\n",
+      HV_EFI_MEDIA_EX_SUPPORTS(HvEfiExProtocol, HvlGetMemoryMapIndex) ?
+        L"provider" : L"local",
+      IndexSize, (*Index)->ExRangeCount
       );
 
-    //
-    // Print memory descriptor information.
-    //
-    {
-        EFI_MEMORY_DESCRIPTOR *Descriptor;
-        HV_EFI_MEMORY_DESCRIPTOR_EX *DescriptorEx;
-        int Index;
-        VOID *TableEnd;
+    return EFI_SUCCESS;
+}
 
-        //
-        // Printout memory descriptors
-        //
 
-        Descriptor = EfiMemoryMap;
-        TableEnd = Add2Ptr(EfiMemoryMap, EfiMemoryMapSize);
-        Index = 1;
-        while (Descriptor != TableEnd) {
-          DescriptorEx = Add2Ptr(
-                          Descriptor, 
-                          DescriptorSize - sizeof(*DescriptorEx)
-                          );
+/**
+  Finds the memory descriptor that covers a physical address, by walking
+  the memory map.
 
-#if HVL_TEST_VERBOSE
-          Print(
-            L"%02d) type 0x%X addr %p, np %d attr 0x%x xattr 0x%p\r\n",
-            Index,
-            Descriptor->Type,
-            Descriptor->PhysicalStart,
-            Descriptor->NumberOfPages,
-            Descriptor->Attribute,
-            DescriptorEx->ExAttribute
-            );
-#else // HVL_TEST_VERBOSE
-          if (CHECK_FLAG(
-                DescriptorEx->ExAttribute, 
-                HV_EFI_MEMORY_EX_ATTR_HVLOADER
-                )) {
+  @param[in]  EfiMemoryMap      The memory map.
+  @param[in]  EfiMemoryMapSize  The memory map size.
+  @param[in]  DescriptorSize    The memory descriptor size.
+  @param[in]  Address           The physical address.
+
+  @return The index of the descriptor covering Address, or the descriptor
+          count if Address is not covered by the memory map.
+**/
+UINTN
+HvlTestLinearLookup (
+  IN  EFI_MEMORY_DESCRIPTOR *EfiMemoryMap,
+  IN  UINTN                 EfiMemoryMapSize,
+  IN  UINTN                 DescriptorSize,
+  IN  EFI_PHYSICAL_ADDRESS  Address
+  )
+{
+
+    EFI_MEMORY_DESCRIPTOR *Descriptor;
+    UINTN Index;
+    VOID *TableEnd;
+
+    Descriptor = EfiMemoryMap;
+    TableEnd = Add2Ptr(EfiMemoryMap, EfiMemoryMapSize);
+    Index = 0;
+
+    while (Descriptor != TableEnd) {
+        if ((Address >= Descriptor->PhysicalStart) &&
+            (Address - Descriptor->PhysicalStart <
+              EFI_PAGES_TO_SIZE(Descriptor->NumberOfPages))) {
+            break;
+        }
+
+        Descriptor = Add2Ptr(Descriptor, DescriptorSize);
+        Index++;
+    }
+
+    return Index;
+}
+
+
+/**
+  Validates a memory map index against the (validated) memory map it was
+  built from:
+  - Every descriptor is indexed, with the same fields.
+  - The first and last address of every descriptor resolve to it, and
+    holes in the map resolve to no descriptor.
+  - The HV ranges are exactly the HV and HV loader descriptors.
+
+  @param[in]  Index             The memory map index.
+  @param[in]  EfiMemoryMap      The memory map.
+  @param[in]  EfiMemoryMapSize  The memory map size.
+  @param[in]  DescriptorSize    The memory descriptor size.
+
+  @return EFI_SUCCESS           If the memory map index is valid.
+  @return EFI_PROTOCOL_ERROR    Otherwise.
+**/
+EFI_STATUS
+HvlTestValidateMemoryMapIndex (
+  IN  HV_EFI_MEMORY_MAP_INDEX *Index,
+  IN  EFI_MEMORY_DESCRIPTOR   *EfiMemoryMap,
+  IN  UINTN                   EfiMemoryMapSize,
+  IN  UINTN                   DescriptorSize
+  )
+{
+
+    UINTN Count;
+    EFI_MEMORY_DESCRIPTOR *Descriptor;
+    HV_EFI_MEMORY_DESCRIPTOR_EX *DescriptorEx;
+    EFI_PHYSICAL_ADDRESS End;
+    UINTN Entry;
+    UINTN ExRange;
+    EFI_PHYSICAL_ADDRESS PrevEnd;
+
+    Count = EfiMemoryMapSize / DescriptorSize;
+    if ((Index->Version != HV_EFI_MEMORY_MAP_INDEX_VERSION) ||
+        (Index->Count != Count)) {
+
+        Print(
+          L"Error: Bad memory map index version 0x%x count %d, "
+          L"expected %d!\r\n",
+          Index->Version, Index->Count, Count
+          );
+
+        return EFI_PROTOCOL_ERROR;
+    }
+
+    Descriptor = EfiMemoryMap;
+    PrevEnd = 0;
+    ExRange = 0;
+
+    for (Entry = 0; Entry < Count; Entry++) {
+        DescriptorEx = HvlDescriptorEx(Descriptor, DescriptorSize);
+        End = Descriptor->PhysicalStart +
+              EFI_PAGES_TO_SIZE(Descriptor->NumberOfPages);
+
+        if ((HvlMemMapIndexStart(Index)[Entry] != Descriptor->PhysicalStart) ||
+            (HvlMemMapIndexPages(Index)[Entry] != Descriptor->NumberOfPages) ||
+            (HvlMemMapIndexAttribute(Index)[Entry] != Descriptor->Attribute) ||
+            (HvlMemMapIndexExAttribute(Index)[Entry] !=
+              DescriptorEx->ExAttribute) ||
+            (HvlMemMapIndexType(Index)[Entry] != Descriptor->Type)) {
+
+            Print(L"Error: Memory map index entry %d mismatch!\r\n", Entry);
+            return EFI_PROTOCOL_ERROR;
+        }
+
+        if ((HvlMemMapIndexLookup(Index, Descriptor->PhysicalStart) != Entry) ||
+            (HvlMemMapIndexLookup(Index, End - 1) != Entry) ||
+            ((PrevEnd < Descriptor->PhysicalStart) &&
+              (HvlMemMapIndexLookup(Index, PrevEnd) != Count))) {
 
             Print(
-              L"Loader mem: type 0x%X addr %p, np %d attr 0x%x xattr 0x%p\r\n",
-              Descriptor->Type,
-              Descriptor->PhysicalStart,
-              Descriptor->NumberOfPages,
-              Descriptor->Attribute,
-              DescriptorEx->ExAttribute
+              L"Error: Memory map index lookup of descriptor %d addr %p "
+              L"failed!\r\n",
+              Entry, Descriptor->PhysicalStart
               );
-          }
 
-          if (CHECK_FLAG(
-                DescriptorEx->ExAttribute, 
-                HV_EFI_MEMORY_EX_ATTR_HV
-                )) {
+            return EFI_PROTOCOL_ERROR;
+        }
 
-            Print(
-              L"HV mem: type 0x%X addr %p, np %d attr 0x%x xattr 0x%p\r\n",
-              Descriptor->Type,
-              Descriptor->PhysicalStart,
-              Descriptor->NumberOfPages,
-              Descriptor->Attribute,
-              DescriptorEx->ExAttribute
+        if ((DescriptorEx->ExAttribute & HVL_MEMMAP_EX_ATTR_RANGES) != 0) {
+            if ((ExRange >= Index->ExRangeCount) ||
+                (HvlMemMapIndexExRanges(Index)[ExRange] != Entry) ||
+                (HvlMemMapIndexNextExRange(
+                  Index,
+                  Descriptor->PhysicalStart,
+                  HVL_MEMMAP_EX_ATTR_RANGES
+                  ) != ExRange)) {
+
+                Print(L"Error: Memory map index HV range %d mismatch!\r\n",
+                      ExRange);
+
+                return EFI_PROTOCOL_ERROR;
+            }
+
+            ExRange++;
+        }
+
+        PrevEnd = End;
+        Descriptor = Add2Ptr(Descriptor, DescriptorSize);
+    }
+
+    if ((ExRange != Index->ExRangeCount) ||
+        (HvlMemMapIndexLookup(Index, PrevEnd) != Count) ||
+        (HvlMemMapIndexNextExRange(Index, PrevEnd, HVL_MEMMAP_EX_ATTR_RANGES) !=
+          Index->ExRangeCount)) {
+
+        Print(L"Error: Memory map index has extra entries!\r\n");
+        return EFI_PROTOCOL_ERROR;
+    }
+
+    Print(L"HvlpRunTests: Memory map index of %d entries is valid\r\n", Count);
+
+    return EFI_SUCCESS;
+}
+
+
+/**
+  Benchmarks physical address lookups, walking the memory map vs the
+  memory map index.
+  Each timed call resolves HVL_TEST_LOOKUPS addresses, spread over the
+  memory map.
+
+  @param[in]  Index             The memory map index.
+  @param[in]  EfiMemoryMap      The memory map.
+  @param[in]  EfiMemoryMapSize  The memory map size.
+  @param[in]  DescriptorSize    The memory descriptor size.
+  @param[in]  Samples           Samples buffer, HVL_TEST_BENCH_ITERATIONS
+                                entries.
+
+  @return EFI_SUCCESS           If both lookups agree.
+  @return EFI_PROTOCOL_ERROR    Otherwise.
+**/
+EFI_STATUS
+HvlTestBenchMemoryMapIndex (
+  IN  HV_EFI_MEMORY_MAP_INDEX *Index,
+  IN  EFI_MEMORY_DESCRIPTOR   *EfiMemoryMap,
+  IN  UINTN                   EfiMemoryMapSize,
+  IN  UINTN                   DescriptorSize,
+  IN  UINT64                  *Samples
+  )
+{
+
+    EFI_PHYSICAL_ADDRESS Address;
+    EFI_PHYSICAL_ADDRESS Base;
+    UINTN Iteration;
+    UINTN Lookup;
+    UINT64 Page;
+    UINT64 Span;
+    UINT64 Start;
+
+    if (Index->Count == 0) {
+        return EFI_SUCCESS;
+    }
+
+    Base = HvlMemMapIndexStart(Index)[0];
+    Span = ((HvlMemMapIndexStart(Index)[Index->Count - 1] - Base) >>
+              EFI_PAGE_SHIFT) +
+           HvlMemMapIndexPages(Index)[Index->Count - 1];
+
+    //
+    // Both lookups should agree before timing them.
+    //
+
+    for (Lookup = 0; Lookup < HVL_TEST_LOOKUPS; Lookup++) {
+        DivU64x64Remainder(MultU64x32(Lookup, 7919), Span, &Page);
+        Address = Base + EFI_PAGES_TO_SIZE(Page);
+
+        if (HvlMemMapIndexLookup(Index, Address) !=
+            HvlTestLinearLookup(
+              EfiMemoryMap,
+              EfiMemoryMapSize,
+              DescriptorSize,
+              Address
+              )) {
+
+            Print(L"Error: Lookup of addr %p mismatch!\r\n", Address);
+            return EFI_PROTOCOL_ERROR;
+        }
+    }
+
+    for (Iteration = 0; Iteration < HVL_TEST_BENCH_ITERATIONS; Iteration++) {
+        Start = GetPerformanceCounter();
+        for (Lookup = 0; Lookup < HVL_TEST_LOOKUPS; Lookup++) {
+            DivU64x64Remainder(MultU64x32(Lookup, 7919), Span, &Page);
+            HvlTestLinearLookup(
+              EfiMemoryMap,
+              EfiMemoryMapSize,
+              DescriptorSize,
+              Base + EFI_PAGES_TO_SIZE(Page)
               );
-          }
-#endif // !HVL_TEST_VERBOSE
-         Descriptor = Add2Ptr(Descriptor, DescriptorSize);
-         Index++;
         }
+
+        Samples[Iteration] =
+          GetTimeInNanoSecond(GetPerformanceCounter() - Start);
     }
 
-Done:
+    HvlBenchPrintPhase(L"WalkLookup", Samples, HVL_TEST_BENCH_ITERATIONS, 0);
 
-    Print(L"Hvloader.efi test run completed, status %d <<<\r\n", EfiStatus);
+    for (Iteration = 0; Iteration < HVL_TEST_BENCH_ITERATIONS; Iteration++) {
+        Start = GetPerformanceCounter();
+        for (Lookup = 0; Lookup < HVL_TEST_LOOKUPS; Lookup++) {
+            DivU64x64Remainder(MultU64x32(Lookup, 7919), Span, &Page);
+            HvlMemMapIndexLookup(Index, Base + EFI_PAGES_TO_SIZE(Page));
+        }
 
-    if (EfiMemoryMap != NULL) {
-        gBS->FreePool(EfiMemoryMap);
+        Samples[Iteration] =
+          GetTimeInNanoSecond(GetPerformanceCounter() - Start);
+    }
+
+    HvlBenchPrintPhase(L"IndexLookup", Samples, HVL_TEST_BENCH_ITERATIONS, 0);
+
+    return EFI_SUCCESS;
+}
+
+
+/**
+  Builds the synthetic ACPI SRAT and SLIT, splitting the memory map span
+  between HVL_TEST_NUMA_DOMAINS proximity domains.
+  The xAPIC BSP is on domain 1, the x2APIC BSP on domain 0, and domain 1
+  is nearer to domain 2 than to domain 0. Domain 1 only has
+  HVL_TEST_NUMA_BSP_PAGES pages, so larger allocations fall back to
+  another domain.
+
+  @param[in]  EfiMemoryMap      The memory map.
+  @param[in]  EfiMemoryMapSize  The memory map size.
+  @param[in]  DescriptorSize    The memory descriptor size.
+  @param[out] Srat              The synthetic SRAT.
+  @param[out] Slit              The synthetic SLIT.
+
+  @return None
+**/
+VOID
+HvlTestBuildAcpiNuma (
+  IN  EFI_MEMORY_DESCRIPTOR *EfiMemoryMap,
+  IN  UINTN                 EfiMemoryMapSize,
+  IN  UINTN                 DescriptorSize,
+  OUT HVL_TEST_SRAT         *Srat,
+  OUT HVL_TEST_SLIT         *Slit
+  )
+{
+
+    STATIC CONST UINT8 Distances[][HVL_TEST_NUMA_DOMAINS] = {
+        { 10, 20, 30 },
+        { 30, 10, 20 },
+        { 20, 30, 10 }
+    };
+
+    EFI_PHYSICAL_ADDRESS Base;
+    EFI_PHYSICAL_ADDRESS Bounds[HVL_TEST_NUMA_DOMAINS + 1];
+    EFI_MEMORY_DESCRIPTOR *Descriptor;
+    EFI_PHYSICAL_ADDRESS End;
+    UINTN Index;
+    UINT64 Length;
+    EFI_ACPI_4_0_MEMORY_AFFINITY_STRUCTURE *Memory;
+    EFI_PHYSICAL_ADDRESS Start;
+
+    Base = MAX_UINT64;
+    End = 0;
+
+    for (Index = 0; Index < EfiMemoryMapSize; Index += DescriptorSize) {
+        Descriptor = Add2Ptr(EfiMemoryMap, Index);
+        Base = MIN(Base, Descriptor->PhysicalStart);
+        End = MAX(
+                End,
+                Descriptor->PhysicalStart +
+                  EFI_PAGES_TO_SIZE(Descriptor->NumberOfPages)
+                );
+    }
+
+    Bounds[0] = Base;
+    Bounds[1] = Base + (((End - Base) / 2) & ~(UINT64)EFI_PAGE_MASK);
+    Bounds[2] = Bounds[1] + EFI_PAGES_TO_SIZE(HVL_TEST_NUMA_BSP_PAGES);
+    Bounds[3] = End;
+
+    ZeroMem(Srat, sizeof(*Srat));
+    Srat->Header.Header.Signature =
+        EFI_ACPI_4_0_SYSTEM_RESOURCE_AFFINITY_TABLE_SIGNATURE;
+    Srat->Header.Header.Length = sizeof(*Srat);
+
+    Srat->Apic[0].Type = EFI_ACPI_4_0_PROCESSOR_LOCAL_APIC_SAPIC_AFFINITY;
+    Srat->Apic[0].Length = sizeof(Srat->Apic[0]);
+    Srat->Apic[0].ProximityDomain7To0 = 1;
+    Srat->Apic[0].ApicId = 0;
+    Srat->Apic[0].Flags = EFI_ACPI_4_0_PROCESSOR_LOCAL_APIC_SAPIC_ENABLED;
+
+    Srat->Apic[1].Type = EFI_ACPI_4_0_PROCESSOR_LOCAL_APIC_SAPIC_AFFINITY;
+    Srat->Apic[1].Length = sizeof(Srat->Apic[1]);
+    Srat->Apic[1].ProximityDomain7To0 = 2;
+    Srat->Apic[1].ApicId = 2;
+
+    Srat->X2Apic.Type = EFI_ACPI_4_0_PROCESSOR_LOCAL_X2APIC_AFFINITY;
+    Srat->X2Apic.Length = sizeof(Srat->X2Apic);
+    Srat->X2Apic.ProximityDomain = 0;
+    Srat->X2Apic.X2ApicId = 0x100;
+    Srat->X2Apic.Flags = EFI_ACPI_4_0_PROCESSOR_LOCAL_X2APIC_ENABLED;
+
+    //
+    // The last memory range is disabled, and covers the whole span.
+    //
+
+    for (Index = 0; Index <= HVL_TEST_NUMA_DOMAINS; Index++) {
+        if (Index < HVL_TEST_NUMA_DOMAINS) {
+            Start = Bounds[Index];
+            Length = Bounds[Index + 1] - Bounds[Index];
+        } else {
+            Start = Base;
+            Length = End - Base;
+        }
+
+        Memory = &Srat->Memory[Index];
+        Memory->Type = EFI_ACPI_4_0_MEMORY_AFFINITY;
+        Memory->Length = sizeof(*Memory);
+        Memory->ProximityDomain = (UINT32)(Index % HVL_TEST_NUMA_DOMAINS);
+        Memory->AddressBaseLow = (UINT32)Start;
+        Memory->AddressBaseHigh = (UINT32)RShiftU64(Start, 32);
+        Memory->LengthLow = (UINT32)Length;
+        Memory->LengthHigh = (UINT32)RShiftU64(Length, 32);
+        if (Index < HVL_TEST_NUMA_DOMAINS) {
+            Memory->Flags = EFI_ACPI_4_0_MEMORY_ENABLED;
+        }
+    }
+
+    ZeroMem(Slit, sizeof(*Slit));
+    Slit->Header.Header.Signature =
+        EFI_ACPI_4_0_SYSTEM_LOCALITY_INFORMATION_TABLE_SIGNATURE;
+    Slit->Header.Header.Length = sizeof(*Slit);
+    Slit->Header.NumberOfSystemLocalities = HVL_TEST_NUMA_DOMAINS;
+    CopyMem(Slit->Distances, Distances, sizeof(Distances));
+}
+
+
+/**
+  Finds the largest free memory block of a proximity domain in the NUMA
+  placement window, by a linear walk over the memory map and the domain
+  memory ranges.
+
+  @param[in]  Topology          The NUMA topology.
+  @param[in]  EfiMemoryMap      The memory map.
+  @param[in]  EfiMemoryMapSize  The memory map size.
+  @param[in]  DescriptorSize    The memory descriptor size.
+  @param[in]  Domain            The proximity domain.
+
+  @return The largest free block page count.
+**/
+UINT64
+HvlTestNumaLargestFree (
+  IN  HVL_NUMA_TOPOLOGY     *Topology,
+  IN  EFI_MEMORY_DESCRIPTOR *EfiMemoryMap,
+  IN  UINTN                 EfiMemoryMapSize,
+  IN  UINTN                 DescriptorSize,
+  IN  UINT32                Domain
+  )
+{
+
+    EFI_MEMORY_DESCRIPTOR *Descriptor;
+    EFI_PHYSICAL_ADDRESS End;
+    UINTN Index;
+    UINT64 Largest;
+    UINTN Offset;
+    HVL_NUMA_RANGE *Range;
+    EFI_PHYSICAL_ADDRESS Start;
+
+    Largest = 0;
+
+    for (Offset = 0; Offset < EfiMemoryMapSize; Offset += DescriptorSize) {
+        Descriptor = Add2Ptr(EfiMemoryMap, Offset);
+        if (Descriptor->Type != EfiConventionalMemory) {
+            continue;
+        }
+
+        for (Index = 0; Index < Topology->RangeCount; Index++) {
+            Range = &Topology->Ranges[Index];
+            if (Range->Domain != Domain) {
+                continue;
+            }
+
+            Start = MAX(Descriptor->PhysicalStart, Range->Base);
+            Start = MAX(Start, HVL_NUMA_MIN_ADDRESS);
+            End = MIN(
+                    Descriptor->PhysicalStart +
+                      EFI_PAGES_TO_SIZE(Descriptor->NumberOfPages),
+                    Range->Base + Range->Length
+                    );
+
+            End = MIN(End, HVL_NUMA_MAX_ADDRESS);
+
+            if (End > Start) {
+                Largest = MAX(Largest, EFI_SIZE_TO_PAGES(End - Start));
+            }
+        }
+    }
+
+    return Largest;
+}
+
+
+/**
+  Validates and benchmarks the NUMA placement policy, with synthetic ACPI
+  SRAT and SLIT over the memory map span.
+  The parsed topology is checked for each BSP, and the selected addresses
+  are checked against a linear walk of the memory map.
+
+  @param[in]  EfiMemoryMap      The memory map.
+  @param[in]  EfiMemoryMapSize  The memory map size.
+  @param[in]  DescriptorSize    The memory descriptor size.
+  @param[in]  Samples           Samples buffer, HVL_TEST_BENCH_ITERATIONS
+                                entries.
+
+  @return EFI_SUCCESS           If the placement policy is valid.
+  @return Others                Otherwise.
+**/
+EFI_STATUS
+HvlTestNuma (
+  IN  EFI_MEMORY_DESCRIPTOR *EfiMemoryMap,
+  IN  UINTN                 EfiMemoryMapSize,
+  IN  UINTN                 DescriptorSize,
+  IN  UINT64                *Samples
+  )
+{
+
+    //
+    // BSP APIC ID, SLIT, and the expected domain order.
+    //
+    STATIC CONST struct {
+        UINT32 BspApicId;
+        BOOLEAN UseSlit;
+        UINT32 Domains[HVL_TEST_NUMA_DOMAINS];
+    } Cases[] = {
+        { 0, TRUE, { 1, 2, 0 } },
+        { 0x100, TRUE, { 0, 1, 2 } },
+        { 0, FALSE, { 1, 0, 2 } },
+    };
+
+    EFI_PHYSICAL_ADDRESS Address;
+    UINTN Case;
+    EFI_MEMORY_DESCRIPTOR *Descriptor;
+    UINT32 Domain;
+    EFI_STATUS EfiStatus;
+    EFI_PHYSICAL_ADDRESS End;
+    UINTN Expected;
+    UINTN Index;
+    UINT64 Largest;
+    UINTN Offset;
+    UINT64 Pages;
+    HVL_TEST_SLIT Slit;
+    HVL_TEST_SRAT Srat;
+    UINT64 Start;
+    HVL_NUMA_TOPOLOGY *Topology;
+
+    Topology = AllocatePool(sizeof(HVL_NUMA_TOPOLOGY));
+    if (Topology == NULL) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+
+    HvlTestBuildAcpiNuma(
+      EfiMemoryMap,
+      EfiMemoryMapSize,
+      DescriptorSize,
+      &Srat,
+      &Slit
+      );
+
+    EfiStatus = EFI_PROTOCOL_ERROR;
+
+    //
+    // The disabled processor is not a BSP.
+    //
+
+    if (HvlNumaParse(&Srat.Header.Header, NULL, 2, Topology) !=
+        EFI_NOT_FOUND) {
+        Print(L"Error: NUMA disabled BSP was parsed!\r\n");
+        goto Done;
+    }
+
+    for (Case = 0; Case < ARRAY_SIZE(Cases); Case++) {
+        if (EFI_ERROR(HvlNumaParse(
+                        &Srat.Header.Header,
+                        Cases[Case].UseSlit ? &Slit.Header.Header : NULL,
+                        Cases[Case].BspApicId,
+                        Topology
+                        )) ||
+            (Topology->BspDomain != Cases[Case].Domains[0]) ||
+            (Topology->RangeCount != HVL_TEST_NUMA_DOMAINS) ||
+            (Topology->DomainCount != HVL_TEST_NUMA_DOMAINS) ||
+            (CompareMem(
+               Topology->Domains,
+               Cases[Case].Domains,
+               sizeof(Cases[Case].Domains)
+               ) != 0)) {
+            Print(L"Error: NUMA case %d topology is invalid!\r\n", Case);
+            goto Done;
+        }
+    }
+
+    //
+    // Select ranges of growing size, from the first case topology.
+    // The selected domain should be the first in distance order with a
+    // large enough free block.
+    //
+
+    HvlNumaParse(&Srat.Header.Header, &Slit.Header.Header, 0, Topology);
+
+    for (Pages = 1; ; Pages *= 2) {
+        Expected = HVL_TEST_NUMA_DOMAINS;
+        for (Index = 0; Index < HVL_TEST_NUMA_DOMAINS; Index++) {
+            Largest = HvlTestNumaLargestFree(
+                        Topology,
+                        EfiMemoryMap,
+                        EfiMemoryMapSize,
+                        DescriptorSize,
+                        Topology->Domains[Index]
+                        );
+
+            if (Largest >= Pages) {
+                Expected = Index;
+                break;
+            }
+        }
+
+        if (HvlNumaSelectRange(
+              Topology,
+              EfiMemoryMap,
+              EfiMemoryMapSize,
+              DescriptorSize,
+              Pages,
+              &Address,
+              &Domain
+              ) != EFI_SUCCESS) {
+            if (Expected == HVL_TEST_NUMA_DOMAINS) {
+                break;
+            }
+
+            Print(L"Error: NUMA %ld pages not placed!\r\n", Pages);
+            goto Done;
+        }
+
+        if ((Expected == HVL_TEST_NUMA_DOMAINS) ||
+            (Domain != Topology->Domains[Expected])) {
+            Print(
+              L"Error: NUMA %ld pages placed on domain %d!\r\n",
+              Pages,
+              Domain
+              );
+
+            goto Done;
+        }
+
+        //
+        // The selected block is free, on the selected domain, in the
+        // placement window, and ends its free block, domain range or the
+        // window, the highest address that fits.
+        //
+
+        for (Offset = 0; Offset < EfiMemoryMapSize; Offset += DescriptorSize) {
+            Descriptor = Add2Ptr(EfiMemoryMap, Offset);
+            if ((Descriptor->Type == EfiConventionalMemory) &&
+                (Address >= Descriptor->PhysicalStart) &&
+                ((Address + EFI_PAGES_TO_SIZE(Pages)) <=
+                  (Descriptor->PhysicalStart +
+                    EFI_PAGES_TO_SIZE(Descriptor->NumberOfPages)))) {
+                break;
+            }
+        }
+
+        for (Index = 0; Index < Topology->RangeCount; Index++) {
+            if ((Topology->Ranges[Index].Domain == Domain) &&
+                (Address >= Topology->Ranges[Index].Base) &&
+                ((Address + EFI_PAGES_TO_SIZE(Pages)) <=
+                  (Topology->Ranges[Index].Base +
+                    Topology->Ranges[Index].Length))) {
+                break;
+            }
+        }
+
+        if ((Offset >= EfiMemoryMapSize) ||
+            (Index == Topology->RangeCount)) {
+            Print(
+              L"Error: NUMA %ld pages at %p are not free!\r\n",
+              Pages,
+              Address
+              );
+
+            goto Done;
+        }
+
+        End = Address + EFI_PAGES_TO_SIZE(Pages);
+        if ((Address < HVL_NUMA_MIN_ADDRESS) ||
+            (End > HVL_NUMA_MAX_ADDRESS) ||
+            ((End != (Descriptor->PhysicalStart +
+                       EFI_PAGES_TO_SIZE(Descriptor->NumberOfPages))) &&
+             (End != (Topology->Ranges[Index].Base +
+                       Topology->Ranges[Index].Length)) &&
+             (End != HVL_NUMA_MAX_ADDRESS))) {
+            Print(
+              L"Error: NUMA %ld pages at %p are not the highest fit!\r\n",
+              Pages,
+              Address
+              );
+
+            goto Done;
+        }
+    }
+
+    Print(
+      L"HvlpRunTests: NUMA placement of up to %ld pages is valid\r\n",
+      Pages / 2
+      );
+
+    for (Index = 0; Index < HVL_TEST_BENCH_ITERATIONS; Index++) {
+        Start = GetPerformanceCounter();
+        HvlNumaSelectRange(
+          Topology,
+          EfiMemoryMap,
+          EfiMemoryMapSize,
+          DescriptorSize,
+          1,
+          &Address,
+          &Domain
+          );
+
+        Samples[Index] = GetTimeInNanoSecond(GetPerformanceCounter() - Start);
+    }
+
+    HvlBenchPrintPhase(L"NumaSelect", Samples, HVL_TEST_BENCH_ITERATIONS, 0);
+
+    EfiStatus = EFI_SUCCESS;
+
+Done:
+
+    FreePool(Topology);
+
+    return EfiStatus;
+}
+
+
+/**
+  Benchmarks LINUX_EFI_HYPERVISOR_MEDIA_PROTOCOL.HvlGetMemoryMap(), the
+  size probe and the map copy calls.
+
+  @param[in]  HvEfiProtocol     The protocol interface.
+  @param[in]  EfiMemoryMapSize  The current memory map size.
+  @param[in]  Samples           Samples buffer, HVL_TEST_BENCH_ITERATIONS
+                                entries.
+
+  @return EFI_SUCCESS           If all calls succeeded.
+  @return Others                Otherwise.
+**/
+EFI_STATUS
+HvlTestBenchGetMemoryMap (
+  IN  LINUX_EFI_HYPERVISOR_MEDIA_PROTOCOL *HvEfiProtocol,
+  IN  UINTN                               EfiMemoryMapSize,
+  IN  UINT64                              *Samples
+  )
+{
+
+    UINTN DescriptorSize;
+    UINT32 DescriptorVersion;
+    EFI_STATUS EfiStatus;
+    EFI_MEMORY_DESCRIPTOR *EfiMemoryMap;
+    UINTN Index;
+    UINTN MapKey;
+    UINTN MapSize;
+    UINT64 Start;
+
+    //
+    // Leave room for a few more descriptors, in case the map grows.
+    //
+
+    EfiMemoryMapSize += EFI_PAGE_SIZE;
+    EfiMemoryMap = AllocatePool(EfiMemoryMapSize);
+    if (EfiMemoryMap == NULL) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+
+    for (Index = 0; Index < HVL_TEST_BENCH_ITERATIONS; Index++) {
+        MapSize = 0;
+        Start = GetPerformanceCounter();
+        EfiStatus = HvEfiProtocol->HvlGetMemoryMap(
+                      &MapSize,
+                      NULL,
+                      &MapKey,
+                      &DescriptorSize,
+                      &DescriptorVersion
+                      );
+
+        Samples[Index] = GetTimeInNanoSecond(GetPerformanceCounter() - Start);
+        if (EfiStatus != EFI_BUFFER_TOO_SMALL) {
+            goto Done;
+        }
+    }
+
+    HvlBenchPrintPhase(L"Probe", Samples, HVL_TEST_BENCH_ITERATIONS, 0);
+
+    for (Index = 0; Index < HVL_TEST_BENCH_ITERATIONS; Index++) {
+        MapSize = EfiMemoryMapSize;
+        Start = GetPerformanceCounter();
+        EfiStatus = HvEfiProtocol->HvlGetMemoryMap(
+                      &MapSize,
+                      EfiMemoryMap,
+                      &MapKey,
+                      &DescriptorSize,
+                      &DescriptorVersion
+                      );
+
+        Samples[Index] = GetTimeInNanoSecond(GetPerformanceCounter() - Start);
+        if (EFI_ERROR(EfiStatus)) {
+            goto Done;
+        }
+    }
+
+    HvlBenchPrintPhase(L"Copy", Samples, HVL_TEST_BENCH_ITERATIONS, MapSize);
+
+    EfiStatus = EFI_SUCCESS;
+
+Done:
+
+    if (EFI_ERROR(EfiStatus)) {
+        Print(L"Error: HvlGetMemoryMap failed, status %d!\r\n", EfiStatus);
+    }
+
+    FreePool(EfiMemoryMap);
+
+    return EfiStatus;
+}
+
+
+/**
+  Gets the memory map with LINUX_EFI_HYPERVISOR_MEDIA_PROTOCOL.
+  HvlGetMemoryMapEx(), a size probe call followed by a copy call.
+
+  @param[in]      HvEfiExProtocol   The extension protocol interface.
+  @param[in]      Flags             HV_EFI_MEMORY_MAP_* flags.
+  @param[in]      EfiMemoryMap      The caller buffer.
+  @param[in,out]  EfiMemoryMapSize  On input the caller buffer size. On
+                                    output the memory map size.
+  @param[out]     DescriptorSize    The returned memory descriptor size.
+  @param[out]     DescriptorVersion The returned memory descriptor version.
+
+  @return EFI_SUCCESS           If the memory map was copied.
+  @return Others                Otherwise.
+**/
+EFI_STATUS
+HvlTestGetMemoryMapEx (
+  IN      LINUX_EFI_HYPERVISOR_MEDIA_EX_PROTOCOL *HvEfiExProtocol,
+  IN      UINT32                                 Flags,
+  IN      VOID                                   *EfiMemoryMap,
+  IN OUT  UINTN                                  *EfiMemoryMapSize,
+  OUT     UINTN                                  *DescriptorSize,
+  OUT     UINT32                                 *DescriptorVersion
+  )
+{
+
+    UINTN BufferSize;
+    EFI_STATUS EfiStatus;
+    UINTN MapKey;
+
+    BufferSize = *EfiMemoryMapSize;
+    *EfiMemoryMapSize = 0;
+
+    EfiStatus = HvEfiExProtocol->HvlGetMemoryMapEx(
+                  Flags,
+                  EfiMemoryMapSize,
+                  NULL,
+                  &MapKey,
+                  DescriptorSize,
+                  DescriptorVersion
+                  );
+
+    if (EfiStatus != EFI_BUFFER_TOO_SMALL) {
+        return EFI_ERROR(EfiStatus) ? EfiStatus : EFI_PROTOCOL_ERROR;
+    }
+
+    if (*EfiMemoryMapSize > BufferSize) {
+        return EFI_BUFFER_TOO_SMALL;
+    }
+
+    return HvEfiExProtocol->HvlGetMemoryMapEx(
+             Flags,
+             EfiMemoryMapSize,
+             EfiMemoryMap,
+             &MapKey,
+             DescriptorSize,
+             DescriptorVersion
+             );
+}
+
+
+/**
+  Validates and benchmarks LINUX_EFI_HYPERVISOR_MEDIA_PROTOCOL.
+  HvlGetMemoryMapEx(), the plain, coalesced and coalesced compact modes.
+  - The coalesced map is a valid map, covers the same pages, and has no
+    adjacent descriptors left to merge.
+  - The compact map has the same descriptors as the coalesced map.
+
+  @param[in]  HvEfiExProtocol   The extension protocol interface, or NULL.
+  @param[in]  EfiMemoryMap      The current memory map.
+  @param[in]  EfiMemoryMapSize  The current memory map size.
+  @param[in]  DescriptorSize    The memory descriptor size.
+  @param[in]  Samples           Samples buffer, HVL_TEST_BENCH_ITERATIONS
+                                entries.
+
+  @return EFI_SUCCESS           If all calls succeeded, and the returned maps
+                                are valid.
+  @return Others                Otherwise.
+**/
+EFI_STATUS
+HvlTestBenchGetMemoryMapEx (
+  IN  LINUX_EFI_HYPERVISOR_MEDIA_EX_PROTOCOL *HvEfiExProtocol,
+  IN  EFI_MEMORY_DESCRIPTOR                  *EfiMemoryMap,
+  IN  UINTN                                  EfiMemoryMapSize,
+  IN  UINTN                                  DescriptorSize,
+  IN  UINT64                                 *Samples
+  )
+{
+
+    EFI_MEMORY_DESCRIPTOR *Coalesced;
+    UINTN CoalescedSize;
+    HV_EFI_MEMORY_DESCRIPTOR_COMPACT *Compact;
+    UINTN CompactSize;
+    EFI_MEMORY_DESCRIPTOR *Descriptor;
+    EFI_MEMORY_DESCRIPTOR *Next;
+    UINT32 DescriptorVersion;
+    EFI_STATUS EfiStatus;
+    UINTN Index;
+    UINTN MapKey;
+    UINTN MapSize;
+    UINTN Mode;
+    UINT64 Pages;
+    UINT64 Start;
+    UINTN OutputSize;
+    STATIC CONST UINT32 Flags[] = {
+        0,
+        HV_EFI_MEMORY_MAP_COALESCE,
+        HV_EFI_MEMORY_MAP_COALESCE | HV_EFI_MEMORY_MAP_COMPACT
+    };
+    STATIC CHAR16 *Names[] = { L"MapEx", L"Coalesce", L"Compact" };
+
+    if (!HV_EFI_MEDIA_EX_SUPPORTS(HvEfiExProtocol, HvlGetMemoryMapEx)) {
+        Print(L"HvlpRunTests: No GetMemoryMapEx method, skipped\r\n");
+        return EFI_SUCCESS;
+    }
+
+    //
+    // Leave room for a few more descriptors, in case the map grows.
+    //
+
+    CoalescedSize = EfiMemoryMapSize + EFI_PAGE_SIZE;
+    CompactSize = CoalescedSize;
+    Coalesced = AllocatePool(CoalescedSize);
+    Compact = AllocatePool(CompactSize);
+    if ((Coalesced == NULL) || (Compact == NULL)) {
+        EfiStatus = EFI_OUT_OF_RESOURCES;
+        goto Done;
+    }
+
+    //
+    // Validate the coalesced map.
+    //
+
+    EfiStatus = HvlTestGetMemoryMapEx(
+                  HvEfiExProtocol,
+                  HV_EFI_MEMORY_MAP_COALESCE,
+                  Coalesced,
+                  &CoalescedSize,
+                  &OutputSize,
+                  &DescriptorVersion
+                  );
+
+    if (EFI_ERROR(EfiStatus)) {
+        goto Done;
+    }
+
+    EfiStatus = EFI_PROTOCOL_ERROR;
+    if ((OutputSize != DescriptorSize) ||
+        (DescriptorVersion != EFI_MEMORY_DESCRIPTOR_VERSION) ||
+        EFI_ERROR(HvlTestValidateMemoryMap(
+                    Coalesced,
+                    CoalescedSize,
+                    DescriptorSize
+                    ))) {
+        Print(L"Error: Coalesced memory map is not valid!\r\n");
+        goto Done;
+    }
+
+    Pages = 0;
+    Descriptor = EfiMemoryMap;
+    for (Index = 0; Index < EfiMemoryMapSize / DescriptorSize; Index++) {
+        Pages += Descriptor->NumberOfPages;
+        Descriptor = Add2Ptr(Descriptor, DescriptorSize);
+    }
+
+    Descriptor = Coalesced;
+    for (Index = 0; Index < CoalescedSize / DescriptorSize; Index++) {
+        Pages -= Descriptor->NumberOfPages;
+        Next = Add2Ptr(Descriptor, DescriptorSize);
+
+        if ((Index + 1 < CoalescedSize / DescriptorSize) &&
+            (Descriptor->Type == Next->Type) &&
+            (Descriptor->Attribute == Next->Attribute) &&
+            (HvlDescriptorEx(Descriptor, DescriptorSize)->ExAttribute ==
+              HvlDescriptorEx(Next, DescriptorSize)->ExAttribute) &&
+            (Descriptor->PhysicalStart +
+              EFI_PAGES_TO_SIZE(Descriptor->NumberOfPages) ==
+              Next->PhysicalStart)) {
+
+            Print(L"Error: Coalesced descriptor %d is not merged!\r\n", Index);
+            goto Done;
+        }
+
+        Descriptor = Next;
+    }
+
+    if (Pages != 0) {
+        Print(L"Error: Coalesced memory map page count mismatch!\r\n");
+        goto Done;
+    }
+
+    //
+    // Validate the compact map against the coalesced map.
+    //
+
+    EfiStatus = HvlTestGetMemoryMapEx(
+                  HvEfiExProtocol,
+                  HV_EFI_MEMORY_MAP_COALESCE | HV_EFI_MEMORY_MAP_COMPACT,
+                  Compact,
+                  &CompactSize,
+                  &OutputSize,
+                  &DescriptorVersion
+                  );
+
+    if (EFI_ERROR(EfiStatus)) {
+        goto Done;
+    }
+
+    EfiStatus = EFI_PROTOCOL_ERROR;
+    if ((OutputSize != sizeof(HV_EFI_MEMORY_DESCRIPTOR_COMPACT)) ||
+        (DescriptorVersion != HV_EFI_MEMORY_DESCRIPTOR_COMPACT_VERSION) ||
+        (CompactSize / OutputSize != CoalescedSize / DescriptorSize)) {
+        Print(L"Error: Compact memory map is not valid!\r\n");
+        goto Done;
+    }
+
+    Descriptor = Coalesced;
+    for (Index = 0; Index < CompactSize / OutputSize; Index++) {
+        if ((Compact[Index].PhysicalStart != Descriptor->PhysicalStart) ||
+            (Compact[Index].NumberOfPages != Descriptor->NumberOfPages) ||
+            (Compact[Index].Attribute != Descriptor->Attribute) ||
+            (Compact[Index].Type != Descriptor->Type) ||
+            (Compact[Index].ExAttribute !=
+              HvlDescriptorEx(Descriptor, DescriptorSize)->ExAttribute)) {
+            Print(L"Error: Compact descriptor %d mismatch!\r\n", Index);
+            goto Done;
+        }
+
+        Descriptor = Add2Ptr(Descriptor, DescriptorSize);
+    }
+
+    //
+    // A buffer one descriptor short should be left untouched.
+    //
+
+    if (CompactSize != 0) {
+        MapSize = CompactSize - OutputSize;
+        SetMem(Compact, CompactSize, 0xA5);
+        EfiStatus = HvEfiExProtocol->HvlGetMemoryMapEx(
+                      HV_EFI_MEMORY_MAP_COALESCE | HV_EFI_MEMORY_MAP_COMPACT,
+                      &MapSize,
+                      Compact,
+                      &MapKey,
+                      &OutputSize,
+                      &DescriptorVersion
+                      );
+
+        if ((EfiStatus != EFI_BUFFER_TOO_SMALL) || (MapSize < CompactSize)) {
+            Print(L"Error: Short compact memory map buffer not rejected!\r\n");
+            EfiStatus = EFI_PROTOCOL_ERROR;
+            goto Done;
+        }
+
+        for (Index = 0; Index < CompactSize; Index++) {
+            if (((UINT8 *)Compact)[Index] != 0xA5) {
+                Print(L"Error: Short compact memory map buffer modified!\r\n");
+                EfiStatus = EFI_PROTOCOL_ERROR;
+                goto Done;
+            }
+        }
+    }
+
+    Print(
+      L"HvlpRunTests: Memory map size %d, coalesced %d, compact %d\r\n",
+      EfiMemoryMapSize, CoalescedSize, CompactSize
+      );
+
+    //
+    // Benchmark the probe and copy call pair, for each mode.
+    //
+
+    for (Mode = 0; Mode < ARRAY_SIZE(Flags); Mode++) {
+        for (Index = 0; Index < HVL_TEST_BENCH_ITERATIONS; Index++) {
+            MapSize = EfiMemoryMapSize + EFI_PAGE_SIZE;
+            Start = GetPerformanceCounter();
+            EfiStatus = HvlTestGetMemoryMapEx(
+                          HvEfiExProtocol,
+                          Flags[Mode],
+                          Coalesced,
+                          &MapSize,
+                          &OutputSize,
+                          &DescriptorVersion
+                          );
+
+            Samples[Index] =
+              GetTimeInNanoSecond(GetPerformanceCounter() - Start);
+
+            if (EFI_ERROR(EfiStatus)) {
+                Print(
+                  L"Error: HvlGetMemoryMapEx(0x%x) failed, status %d!\r\n",
+                  Flags[Mode], EfiStatus
+                  );
+
+                goto Done;
+            }
+        }
+
+        HvlBenchPrintPhase(
+          Names[Mode],
+          Samples,
+          HVL_TEST_BENCH_ITERATIONS,
+          MapSize
+          );
+    }
+
+    EfiStatus = EFI_SUCCESS;
+
+Done:
+
+    if (Coalesced != NULL) {
+        FreePool(Coalesced);
+    }
+
+    if (Compact != NULL) {
+        FreePool(Compact);
+    }
+
+    return EfiStatus;
+}
+
+
+/**
+  Benchmarks LINUX_EFI_HYPERVISOR_MEDIA_PROTOCOL.HvlRegisterRuntimeRange(),
+  and validates the memory map afterwards.
+  Ranges are taken from the current map, and cover either a full
+  descriptor or the middle of it, so descriptors get split.
+
+  Note:
+    This modifies the memory map, and should only be used with the mock
+    provider.
+
+  @param[in]  HvEfiProtocol     The protocol interface.
+  @param[in]  EfiMemoryMap      The current memory map.
+  @param[in]  EfiMemoryMapSize  The current memory map size.
+  @param[in]  DescriptorSize    The memory descriptor size.
+
+  @return EFI_SUCCESS           If all calls succeeded, and the resulting
+                                map is valid.
+  @return Others                Otherwise.
+**/
+EFI_STATUS
+HvlTestBenchRegisterRuntimeRange (
+  IN  LINUX_EFI_HYPERVISOR_MEDIA_PROTOCOL *HvEfiProtocol,
+  IN  EFI_MEMORY_DESCRIPTOR               *EfiMemoryMap,
+  IN  UINTN                               EfiMemoryMapSize,
+  IN  UINTN                               DescriptorSize
+  )
+{
+
+    UINT64 BasePage;
+    UINTN DescriptorCount;
+    EFI_MEMORY_DESCRIPTOR *Descriptor;
+    EFI_STATUS EfiStatus;
+    UINTN Index;
+    UINTN MapKey;
+    EFI_MEMORY_DESCRIPTOR *NewMap;
+    UINTN NewMapSize;
+    UINT64 PageCount;
+    UINT32 Result;
+    UINT64 *Samples;
+    UINT64 Start;
+    UINTN Step;
+
+    NewMap = NULL;
+    DescriptorCount = EfiMemoryMapSize / DescriptorSize;
+    Step = MAX(DescriptorCount / HVL_TEST_RUNTIME_RANGES, 1);
+
+    Samples = AllocateZeroPool(HVL_TEST_RUNTIME_RANGES * sizeof(UINT64));
+    if (Samples == NULL) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+
+    for (Index = 0; Index < HVL_TEST_RUNTIME_RANGES; Index++) {
+        Descriptor = Add2Ptr(
+                        EfiMemoryMap,
+                        ((Index * Step) % DescriptorCount) * DescriptorSize
+                        );
+
+        BasePage = Descriptor->PhysicalStart >> EFI_PAGE_SHIFT;
+        PageCount = Descriptor->NumberOfPages;
+        if (((Index % 2) != 0) && (PageCount > 2)) {
+            BasePage++;
+            PageCount -= 2;
+        }
+
+        Start = GetPerformanceCounter();
+        Result = HvEfiProtocol->HvlRegisterRuntimeRange(BasePage, PageCount);
+        Samples[Index] = GetTimeInNanoSecond(GetPerformanceCounter() - Start);
+
+        if (Result != HVL_MOCK_RANGE_SUCCESS) {
+            Print(
+              L"Error: HvlRegisterRuntimeRange(0x%lx, %ld) failed, "
+              L"result %d!\r\n",
+              BasePage, PageCount, Result
+              );
+
+            EfiStatus = EFI_PROTOCOL_ERROR;
+            goto Done;
+        }
+    }
+
+    HvlBenchPrintPhase(L"Register", Samples, HVL_TEST_RUNTIME_RANGES, 0);
+
+    //
+    // The map should still be valid after splitting descriptors.
+    //
+
+    EfiStatus = HvlTestGetMemoryMap(
+                  HvEfiProtocol,
+                  &NewMap,
+                  &NewMapSize,
+                  &DescriptorSize,
+                  &MapKey
+                  );
+
+    if (EFI_ERROR(EfiStatus)) {
+        goto Done;
+    }
+
+    EfiStatus = HvlTestValidateMemoryMap(NewMap, NewMapSize, DescriptorSize);
+
+Done:
+
+    if (NewMap != NULL) {
+        FreePool(NewMap);
+    }
+
+    FreePool(Samples);
+
+    return EfiStatus;
+}
+
+
+/**
+  Validates and benchmarks LINUX_EFI_HYPERVISOR_MEDIA_PROTOCOL.
+  HvlRegisterRuntimeRanges().
+  The ranges are taken from the memory map, in reverse order, with some
+  overlapping and some invalid ranges. After registration, every page of
+  the registered ranges should be runtime.
+
+  Note:
+    This modifies the memory map, and should only be used with the mock
+    provider.
+
+  @param[in]  HvEfiProtocol     The protocol interface.
+  @param[in]  HvEfiExProtocol   The extension protocol interface, or NULL.
+  @param[in]  EfiMemoryMap      The memory map.
+  @param[in]  EfiMemoryMapSize  The memory map size.
+  @param[in]  DescriptorSize    The memory descriptor size.
+  @param[in]  Samples           Samples buffer, HVL_TEST_BENCH_ITERATIONS
+                                entries.
+
+  @return EFI_SUCCESS           If the ranges were registered as expected.
+  @return Others                Otherwise.
+**/
+EFI_STATUS
+HvlTestBenchRegisterRuntimeRanges (
+  IN  LINUX_EFI_HYPERVISOR_MEDIA_PROTOCOL    *HvEfiProtocol,
+  IN  LINUX_EFI_HYPERVISOR_MEDIA_EX_PROTOCOL *HvEfiExProtocol,
+  IN  EFI_MEMORY_DESCRIPTOR                  *EfiMemoryMap,
+  IN  UINTN                                  EfiMemoryMapSize,
+  IN  UINTN                                  DescriptorSize,
+  IN  UINT64                                 *Samples
+  )
+{
+
+    EFI_PHYSICAL_ADDRESS Address;
+    UINTN DescriptorCount;
+    EFI_MEMORY_DESCRIPTOR *Descriptor;
+    EFI_STATUS EfiStatus;
+    EFI_PHYSICAL_ADDRESS End;
+    UINTN Entry;
+    UINTN Index;
+    HV_EFI_MEMORY_MAP_INDEX *MapIndex;
+    UINTN MapIndexSize;
+    UINTN MapKey;
+    EFI_MEMORY_DESCRIPTOR *NewMap;
+    UINTN NewMapSize;
+    HV_EFI_RUNTIME_RANGE *Range;
+    UINTN RangeCount;
+    HV_EFI_RUNTIME_RANGE *Ranges;
+    UINT64 Start;
+    UINTN Step;
+
+    if (!HV_EFI_MEDIA_EX_SUPPORTS(HvEfiExProtocol, HvlRegisterRuntimeRanges)) {
+        Print(L"HvlpRunTests: No RegisterRuntimeRanges method, skipped\r\n");
+        return EFI_SUCCESS;
+    }
+
+    MapIndex = NULL;
+    NewMap = NULL;
+    DescriptorCount = EfiMemoryMapSize / DescriptorSize;
+    Step = MAX(DescriptorCount / HVL_TEST_RUNTIME_RANGES, 1);
+
+    //
+    // Two extra invalid ranges, an empty one and one past the map end.
+    //
+
+    RangeCount = HVL_TEST_RUNTIME_RANGES + 2;
+    Ranges = AllocateZeroPool(RangeCount * sizeof(HV_EFI_RUNTIME_RANGE));
+    if (Ranges == NULL) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+
+    for (Index = 0; Index < HVL_TEST_RUNTIME_RANGES; Index++) {
+        Entry = ((HVL_TEST_RUNTIME_RANGES - 1 - Index) * Step + (Step / 2)) %
+                DescriptorCount;
+
+        Descriptor = Add2Ptr(EfiMemoryMap, Entry * DescriptorSize);
+        Range = &Ranges[Index];
+        Range->BasePage = Descriptor->PhysicalStart >> EFI_PAGE_SHIFT;
+        Range->PageCount = Descriptor->NumberOfPages;
+        if (((Index % 2) != 0) && (Range->PageCount > 2)) {
+            Range->BasePage++;
+            Range->PageCount -= 2;
+        }
+
+        //
+        // Overlap the previous range.
+        //
+
+        if (((Index % 4) == 3) && (Range->PageCount > 1)) {
+            Ranges[Index - 1].BasePage = Range->BasePage + 1;
+            Ranges[Index - 1].PageCount = Range->PageCount - 1;
+        }
+    }
+
+    Descriptor = Add2Ptr(EfiMemoryMap, (DescriptorCount - 1) * DescriptorSize);
+    Ranges[HVL_TEST_RUNTIME_RANGES].BasePage = 1;
+    Ranges[HVL_TEST_RUNTIME_RANGES].PageCount = 0;
+    Ranges[HVL_TEST_RUNTIME_RANGES + 1].BasePage =
+        (Descriptor->PhysicalStart >> EFI_PAGE_SHIFT) +
+        Descriptor->NumberOfPages;
+    Ranges[HVL_TEST_RUNTIME_RANGES + 1].PageCount = 1;
+
+    //
+    // Only the first call changes the map, the others time the validation
+    // and merge of an already registered batch.
+    //
+
+    for (Index = 0; Index < HVL_TEST_BENCH_ITERATIONS; Index++) {
+        Start = GetPerformanceCounter();
+        EfiStatus = HvEfiExProtocol->HvlRegisterRuntimeRanges(
+                      Ranges,
+                      RangeCount
+                      );
+
+        Samples[Index] = GetTimeInNanoSecond(GetPerformanceCounter() - Start);
+        if (EfiStatus != EFI_NOT_FOUND) {
+            Print(
+              L"Error: HvlRegisterRuntimeRanges failed, status %d!\r\n",
+              EfiStatus
+              );
+
+            EfiStatus = EFI_PROTOCOL_ERROR;
+            goto Done;
+        }
+    }
+
+    HvlBenchPrintPhase(L"RegisterN", Samples, HVL_TEST_BENCH_ITERATIONS, 0);
+
+    //
+    // Check the results, and that all the ranges are runtime in the new
+    // map.
+    //
+
+    EfiStatus = HvlTestGetMemoryMap(
+                  HvEfiProtocol,
+                  &NewMap,
+                  &NewMapSize,
+                  &DescriptorSize,
+                  &MapKey
+                  );
+
+    if (EFI_ERROR(EfiStatus)) {
+        goto Done;
+    }
+
+    EfiStatus = HvlTestValidateMemoryMap(NewMap, NewMapSize, DescriptorSize);
+    if (EFI_ERROR(EfiStatus)) {
+        goto Done;
+    }
+
+    MapIndexSize = 0;
+    HvlMemMapIndexBuild(
+      NewMap,
+      NewMapSize,
+      DescriptorSize,
+      MapKey,
+      NULL,
+      &MapIndexSize
+      );
+
+    MapIndex = AllocatePool(MapIndexSize);
+    if (MapIndex == NULL) {
+        EfiStatus = EFI_OUT_OF_RESOURCES;
+        goto Done;
+    }
+
+    EfiStatus = HvlMemMapIndexBuild(
+                  NewMap,
+                  NewMapSize,
+                  DescriptorSize,
+                  MapKey,
+                  MapIndex,
+                  &MapIndexSize
+                  );
+
+    if (EFI_ERROR(EfiStatus)) {
+        goto Done;
+    }
+
+    EfiStatus = EFI_PROTOCOL_ERROR;
+
+    for (Index = 0; Index < RangeCount; Index++) {
+        Range = &Ranges[Index];
+        if (Range->Result !=
+            ((Index < HVL_TEST_RUNTIME_RANGES) ? HVL_MOCK_RANGE_SUCCESS :
+                                                 HVL_MOCK_RANGE_FAILURE)) {
+            Print(
+              L"Error: Range %d (0x%lx, %ld) unexpected result %d!\r\n",
+              Index, Range->BasePage, Range->PageCount, Range->Result
+              );
+
+            goto Done;
+        }
+
+        if (Range->Result != HVL_MOCK_RANGE_SUCCESS) {
+            continue;
+        }
+
+        Address = EFI_PAGES_TO_SIZE(Range->BasePage);
+        End = EFI_PAGES_TO_SIZE(Range->BasePage + Range->PageCount);
+        while (Address < End) {
+            Entry = HvlMemMapIndexLookup(MapIndex, Address);
+            if ((Entry == MapIndex->Count) ||
+                !CHECK_FLAG(
+                  HvlMemMapIndexAttribute(MapIndex)[Entry],
+                  EFI_MEMORY_RUNTIME
+                  )) {
+                Print(
+                  L"Error: Range %d addr %p is not runtime!\r\n",
+                  Index, Address
+                  );
+
+                goto Done;
+            }
+
+            Address = HvlMemMapIndexStart(MapIndex)[Entry] +
+                      EFI_PAGES_TO_SIZE(HvlMemMapIndexPages(MapIndex)[Entry]);
+        }
+    }
+
+    Print(
+      L"HvlpRunTests: %d runtime ranges registered in one call\r\n",
+      HVL_TEST_RUNTIME_RANGES
+      );
+
+    EfiStatus = EFI_SUCCESS;
+
+Done:
+
+    if (MapIndex != NULL) {
+        FreePool(MapIndex);
+    }
+
+    if (NewMap != NULL) {
+        FreePool(NewMap);
+    }
+
+    FreePool(Ranges);
+
+    return EfiStatus;
+}
+
+
+/**
+  Gets the memory map changes made after a generation, from
+  LINUX_EFI_HYPERVISOR_MEDIA_PROTOCOL.HvlGetMemoryMapChanges().
+
+  @param[in]  HvEfiExProtocol   The extension protocol interface.
+  @param[in]  Generation        The memory map generation.
+  @param[out] Changes           The returned change records, to be freed by
+                                the caller.
+  @param[out] ChangeCount       The returned number of change records.
+  @param[out] CurrentGeneration The returned current generation.
+
+  @return EFI_SUCCESS           If the changes were acquired.
+  @return Others                Otherwise.
+**/
+EFI_STATUS
+HvlTestGetMemoryMapChanges (
+  IN  LINUX_EFI_HYPERVISOR_MEDIA_EX_PROTOCOL *HvEfiExProtocol,
+  IN  UINTN                                  Generation,
+  OUT HV_EFI_MEMORY_MAP_CHANGE               **Changes,
+  OUT UINTN                                  *ChangeCount,
+  OUT UINTN                                  *CurrentGeneration
+  )
+{
+
+    UINTN ChangesSize;
+    EFI_STATUS EfiStatus;
+
+    ChangesSize = 0;
+    EfiStatus = HvEfiExProtocol->HvlGetMemoryMapChanges(
+                  Generation,
+                  &ChangesSize,
+                  NULL,
+                  CurrentGeneration
+                  );
+
+    if ((EfiStatus != EFI_BUFFER_TOO_SMALL) && (EfiStatus != EFI_SUCCESS)) {
+        Print(
+          L"Error: HvlGetMemoryMapChanges(%d) failed, status %d!\r\n",
+          Generation, EfiStatus
+          );
+
+        return EfiStatus;
+    }
+
+    //
+    // Always allocate, so an empty change list is still returned.
+    //
+
+    *Changes = AllocatePool(ChangesSize + sizeof(HV_EFI_MEMORY_MAP_CHANGE));
+    if (*Changes == NULL) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+
+    EfiStatus = HvEfiExProtocol->HvlGetMemoryMapChanges(
+                  Generation,
+                  &ChangesSize,
+                  *Changes,
+                  CurrentGeneration
+                  );
+
+    if (EFI_ERROR(EfiStatus)) {
+        Print(
+          L"Error: HvlGetMemoryMapChanges(%d) failed, status %d!\r\n",
+          Generation, EfiStatus
+          );
+
+        FreePool(*Changes);
+        *Changes = NULL;
+        return EfiStatus;
+    }
+
+    *ChangeCount = ChangesSize / sizeof(HV_EFI_MEMORY_MAP_CHANGE);
+
+    return EFI_SUCCESS;
+}
+
+
+/**
+  Finds the first compact descriptor that does not start below an address.
+
+  @param[in]  Map       The sorted compact descriptors.
+  @param[in]  Count     Number of descriptors.
+  @param[in]  Address   The physical address.
+
+  @return The descriptor index, Count if all descriptors start below
+          Address.
+**/
+UINTN
+HvlTestFindCompact (
+  IN  HV_EFI_MEMORY_DESCRIPTOR_COMPACT  *Map,
+  IN  UINTN                             Count,
+  IN  EFI_PHYSICAL_ADDRESS              Address
+  )
+{
+
+    UINTN High;
+    UINTN Low;
+    UINTN Middle;
+
+    Low = 0;
+    High = Count;
+    while (Low < High) {
+        Middle = Low + ((High - Low) / 2);
+        if (Map[Middle].PhysicalStart < Address) {
+            Low = Middle + 1;
+        } else {
+            High = Middle;
+        }
+    }
+
+    return Low;
+}
+
+
+/**
+  Validates and benchmarks LINUX_EFI_HYPERVISOR_MEDIA_PROTOCOL.
+  HvlGetMemoryMapChanges().
+  The changes made after the generation of a memory map are applied to it,
+  and the result is compared with the current memory map.
+
+  @param[in]  HvEfiProtocol     The protocol interface.
+  @param[in]  HvEfiExProtocol   The extension protocol interface, or NULL.
+  @param[in]  EfiMemoryMap      The memory map of Generation.
+  @param[in]  EfiMemoryMapSize  The memory map size.
+  @param[in]  DescriptorSize    The memory descriptor size.
+  @param[in]  Generation        The memory map generation (key).
+  @param[in]  Samples           Samples buffer, HVL_TEST_BENCH_ITERATIONS
+                                entries.
+
+  @return EFI_SUCCESS           If the changes reproduce the current memory
+                                map.
+  @return Others                Otherwise.
+**/
+EFI_STATUS
+HvlTestMemoryMapChanges (
+  IN  LINUX_EFI_HYPERVISOR_MEDIA_PROTOCOL    *HvEfiProtocol,
+  IN  LINUX_EFI_HYPERVISOR_MEDIA_EX_PROTOCOL *HvEfiExProtocol,
+  IN  EFI_MEMORY_DESCRIPTOR                  *EfiMemoryMap,
+  IN  UINTN                                  EfiMemoryMapSize,
+  IN  UINTN                                  DescriptorSize,
+  IN  UINTN                                  Generation,
+  IN  UINT64                                 *Samples
+  )
+{
+
+    UINTN BufferSize;
+    HV_EFI_MEMORY_MAP_CHANGE *Change;
+    UINTN ChangeCount;
+    HV_EFI_MEMORY_MAP_CHANGE *Changes;
+    UINTN ChangesSize;
+    UINTN Count;
+    UINTN CurrentGeneration;
+    EFI_MEMORY_DESCRIPTOR *Descriptor;
+    EFI_STATUS EfiStatus;
+    UINTN Index;
+    HV_EFI_MEMORY_DESCRIPTOR_COMPACT *Map;
+    UINTN MapKey;
+    EFI_MEMORY_DESCRIPTOR *NewMap;
+    UINTN NewMapSize;
+    UINTN Position;
+    UINT64 Start;
+
+    if (!HV_EFI_MEDIA_EX_SUPPORTS(HvEfiExProtocol, HvlGetMemoryMapChanges)) {
+        Print(L"HvlpRunTests: No GetMemoryMapChanges method, skipped\r\n");
+        return EFI_SUCCESS;
+    }
+
+    Changes = NULL;
+    Map = NULL;
+    NewMap = NULL;
+
+    EfiStatus = HvlTestGetMemoryMapChanges(
+                  HvEfiExProtocol,
+                  Generation,
+                  &Changes,
+                  &ChangeCount,
+                  &CurrentGeneration
+                  );
+
+    if (EFI_ERROR(EfiStatus)) {
+        goto Done;
+    }
+
+    //
+    // Apply the changes to a compact copy of the memory map.
+    //
+
+    Count = EfiMemoryMapSize / DescriptorSize;
+    Map = AllocatePool(
+            (Count + ChangeCount) * sizeof(HV_EFI_MEMORY_DESCRIPTOR_COMPACT)
+            );
+
+    if (Map == NULL) {
+        EfiStatus = EFI_OUT_OF_RESOURCES;
+        goto Done;
+    }
+
+    Descriptor = EfiMemoryMap;
+    for (Index = 0; Index < Count; Index++) {
+        Map[Index].PhysicalStart = Descriptor->PhysicalStart;
+        Map[Index].NumberOfPages = Descriptor->NumberOfPages;
+        Map[Index].Attribute = Descriptor->Attribute;
+        Map[Index].Type = Descriptor->Type;
+        Map[Index].Reserved = 0;
+        Map[Index].ExAttribute =
+            HvlDescriptorEx(Descriptor, DescriptorSize)->ExAttribute;
+
+        Descriptor = Add2Ptr(Descriptor, DescriptorSize);
+    }
+
+    EfiStatus = EFI_PROTOCOL_ERROR;
+
+    for (Index = 0; Index < ChangeCount; Index++) {
+        Change = &Changes[Index];
+        Position = HvlTestFindCompact(
+                      Map,
+                      Count,
+                      Change->Descriptor.PhysicalStart
+                      );
+
+        if ((Change->Generation <= Generation) ||
+            (Change->Generation > CurrentGeneration)) {
+            Print(L"Error: Change %d has a bad generation!\r\n", Index);
+            goto Done;
+        }
+
+        if (Change->Kind == HV_EFI_MEMORY_MAP_CHANGE_ADDED) {
+            CopyMem(
+              &Map[Position + 1],
+              &Map[Position],
+              (Count - Position) * sizeof(HV_EFI_MEMORY_DESCRIPTOR_COMPACT)
+              );
+
+            Count++;
+
+        } else if ((Position == Count) ||
+                   (Map[Position].PhysicalStart !=
+                     Change->Descriptor.PhysicalStart)) {
+            Print(
+              L"Error: Change %d addr %p has no descriptor!\r\n",
+              Index, Change->Descriptor.PhysicalStart
+              );
+
+            goto Done;
+
+        } else if (Change->Kind == HV_EFI_MEMORY_MAP_CHANGE_REMOVED) {
+            Count--;
+            CopyMem(
+              &Map[Position],
+              &Map[Position + 1],
+              (Count - Position) * sizeof(HV_EFI_MEMORY_DESCRIPTOR_COMPACT)
+              );
+
+            continue;
+
+        } else if (Change->Kind != HV_EFI_MEMORY_MAP_CHANGE_CHANGED) {
+            Print(L"Error: Change %d kind %d!\r\n", Index, Change->Kind);
+            goto Done;
+        }
+
+        Map[Position] = Change->Descriptor;
+    }
+
+    //
+    // Compare with the current memory map.
+    //
+
+    EfiStatus = HvlTestGetMemoryMap(
+                  HvEfiProtocol,
+                  &NewMap,
+                  &NewMapSize,
+                  &DescriptorSize,
+                  &MapKey
+                  );
+
+    if (EFI_ERROR(EfiStatus)) {
+        goto Done;
+    }
+
+    EfiStatus = EFI_PROTOCOL_ERROR;
+    if ((MapKey != CurrentGeneration) ||
+        (NewMapSize / DescriptorSize != Count)) {
+        Print(
+          L"Error: Changes %d -> %d give %d descriptors, map has %d!\r\n",
+          Generation, CurrentGeneration, Count, NewMapSize / DescriptorSize
+          );
+
+        goto Done;
+    }
+
+    Descriptor = NewMap;
+    for (Index = 0; Index < Count; Index++) {
+        if ((Map[Index].PhysicalStart != Descriptor->PhysicalStart) ||
+            (Map[Index].NumberOfPages != Descriptor->NumberOfPages) ||
+            (Map[Index].Attribute != Descriptor->Attribute) ||
+            (Map[Index].Type != Descriptor->Type) ||
+            (Map[Index].ExAttribute !=
+              HvlDescriptorEx(Descriptor, DescriptorSize)->ExAttribute)) {
+            Print(L"Error: Changed descriptor %d mismatch!\r\n", Index);
+            goto Done;
+        }
+
+        Descriptor = Add2Ptr(Descriptor, DescriptorSize);
+    }
+
+    Print(
+      L"HvlpRunTests: Memory map changes %d -> %d, %d records, are valid\r\n",
+      Generation, CurrentGeneration, ChangeCount
+      );
+
+    //
+    // Benchmark a re-sync after the last update, the probe and copy call
+    // pair, O(changes) rather than O(map).
+    //
+
+    Generation = (CurrentGeneration > Generation) ? CurrentGeneration - 1 :
+                                                    CurrentGeneration;
+
+    BufferSize = (ChangeCount + 1) * sizeof(HV_EFI_MEMORY_MAP_CHANGE);
+    for (Index = 0; Index < HVL_TEST_BENCH_ITERATIONS; Index++) {
+        Start = GetPerformanceCounter();
+        ChangesSize = 0;
+        EfiStatus = HvEfiExProtocol->HvlGetMemoryMapChanges(
+                      Generation,
+                      &ChangesSize,
+                      NULL,
+                      &CurrentGeneration
+                      );
+
+        if ((EfiStatus == EFI_BUFFER_TOO_SMALL) &&
+            (ChangesSize <= BufferSize)) {
+            EfiStatus = HvEfiExProtocol->HvlGetMemoryMapChanges(
+                          Generation,
+                          &ChangesSize,
+                          Changes,
+                          &CurrentGeneration
+                          );
+        }
+
+        Samples[Index] = GetTimeInNanoSecond(GetPerformanceCounter() - Start);
+        if (EFI_ERROR(EfiStatus)) {
+            Print(
+              L"Error: HvlGetMemoryMapChanges failed, status %d!\r\n",
+              EfiStatus
+              );
+
+            goto Done;
+        }
+    }
+
+    HvlBenchPrintPhase(
+      L"DeltaSync",
+      Samples,
+      HVL_TEST_BENCH_ITERATIONS,
+      ChangesSize
+      );
+
+Done:
+
+    if (Changes != NULL) {
+        FreePool(Changes);
+    }
+
+    if (Map != NULL) {
+        FreePool(Map);
+    }
+
+    if (NewMap != NULL) {
+        FreePool(NewMap);
+    }
+
+    return EfiStatus;
+}
+
+
+/**
+  Benchmarks LINUX_EFI_HYPERVISOR_MEDIA_PROTOCOL.HvlGetNextLogMessage(),
+  by repeatedly draining the whole log.
+
+  @param[in]  HvEfiProtocol     The protocol interface.
+  @param[in]  Samples           Samples buffer, HVL_TEST_BENCH_ITERATIONS
+                                entries.
+
+  @return EFI_SUCCESS           If the log was drained.
+  @return Others                Otherwise.
+**/
+EFI_STATUS
+HvlTestBenchGetNextLogMessage (
+  IN  LINUX_EFI_HYPERVISOR_MEDIA_PROTOCOL *HvEfiProtocol,
+  IN  UINT64                              *Samples
+  )
+{
+
+    UINTN Bytes;
+    UINTN Index;
+    CHAR16 *Message;
+    UINTN MessageCount;
+    size_t NextMessage;
+    UINT64 Start;
+
+    if (HvEfiProtocol->HvlGetNextLogMessage == NULL) {
+        Print(L"Error: Bad HV EFI protocol, no GetNextLogMessage method!\r\n");
+        return EFI_PROTOCOL_ERROR;
+    }
+
+    Bytes = 0;
+    MessageCount = 0;
+
+    for (Index = 0; Index < HVL_TEST_BENCH_ITERATIONS; Index++) {
+        Bytes = 0;
+        MessageCount = 0;
+        NextMessage = 0;
+
+        Start = GetPerformanceCounter();
+        while ((Message = HvEfiProtocol->HvlGetNextLogMessage(&NextMessage)) !=
+                NULL) {
+
+            Bytes += StrSize(Message);
+            MessageCount++;
+        }
+
+        Samples[Index] = GetTimeInNanoSecond(GetPerformanceCounter() - Start);
+    }
+
+    Print(
+      L"HvlpRunTests: Log has %d messages, %d bytes\r\n",
+      MessageCount, Bytes
+      );
+
+    HvlBenchPrintPhase(L"LogDrain", Samples, HVL_TEST_BENCH_ITERATIONS, Bytes);
+
+    return EFI_SUCCESS;
+}
+
+
+/**
+  Compares a log record with a message returned by
+  LINUX_EFI_HYPERVISOR_MEDIA_PROTOCOL.HvlGetNextLogMessage(), decoding the
+  record text if UTF-8 encoded.
+
+  @param[in]  Record    The log record.
+  @param[in]  Flags     The HvlGetLogMessages() flags.
+  @param[in]  Message   The message.
+
+  @return TRUE          If the record text is the message.
+  @return FALSE         Otherwise.
+**/
+BOOLEAN
+HvlTestCompareLogRecord (
+  IN  CONST HV_EFI_LOG_RECORD *Record,
+  IN  UINT32                  Flags,
+  IN  CONST CHAR16            *Message
+  )
+{
+
+    CHAR16 Char;
+    UINTN Index;
+    UINTN Length;
+    CONST UINT8 *Text;
+
+    Length = StrLen(Message);
+    Text = (CONST UINT8 *)(Record + 1);
+
+    if (!CHECK_FLAG(Flags, HV_EFI_LOG_UTF8)) {
+        return (Record->TextSize == (Length * sizeof(CHAR16))) &&
+               (CompareMem(Text, Message, StrSize(Message)) == 0);
+    }
+
+    Index = 0;
+    while (Index < Record->TextSize) {
+        if (Text[Index] < 0x80) {
+            Char = Text[Index];
+            Index += 1;
+
+        } else if ((Text[Index] & 0xE0) == 0xC0) {
+            Char = ((Text[Index] & 0x1F) << 6) | (Text[Index + 1] & 0x3F);
+            Index += 2;
+
+        } else {
+            Char = ((Text[Index] & 0x0F) << 12) |
+                   ((Text[Index + 1] & 0x3F) << 6) |
+                   (Text[Index + 2] & 0x3F);
+
+            Index += 3;
+        }
+
+        if ((*Message == L'\0') || (Char != *Message)) {
+            return FALSE;
+        }
+
+        Message++;
+    }
+
+    return (Index == Record->TextSize) && (*Message == L'\0') &&
+           (Text[Index] == '\0');
+}
+
+
+/**
+  Validates and benchmarks LINUX_EFI_HYPERVISOR_MEDIA_PROTOCOL.
+  HvlGetLogMessages(), by repeatedly draining the whole log into a
+  HVL_TEST_LOG_BUFFER_SIZE buffer, UCS-2 and UTF-8 encoded.
+  The records are checked against the HvlGetNextLogMessage() messages.
+
+  @param[in]  HvEfiProtocol     The protocol interface.
+  @param[in]  HvEfiExProtocol   The extension protocol interface, or NULL.
+  @param[in]  Samples           Samples buffer, HVL_TEST_BENCH_ITERATIONS
+                                entries.
+
+  @return EFI_SUCCESS           If the log was drained as expected.
+  @return Others                Otherwise.
+**/
+EFI_STATUS
+HvlTestBenchGetLogMessages (
+  IN  LINUX_EFI_HYPERVISOR_MEDIA_PROTOCOL    *HvEfiProtocol,
+  IN  LINUX_EFI_HYPERVISOR_MEDIA_EX_PROTOCOL *HvEfiExProtocol,
+  IN  UINT64                                 *Samples
+  )
+{
+
+    VOID *Buffer;
+    UINTN BufferSize;
+    UINTN Bytes;
+    UINTN CallCount;
+    EFI_STATUS EfiStatus;
+    UINT32 Flags;
+    UINTN Index;
+    CHAR16 *Message;
+    UINTN MessageCount;
+    size_t NextMessage;
+    size_t NextRecord;
+    UINTN Offset;
+    HV_EFI_LOG_RECORD *Record;
+    UINTN RecordCount;
+    UINT64 Start;
+
+    if (!HV_EFI_MEDIA_EX_SUPPORTS(HvEfiExProtocol, HvlGetLogMessages)) {
+        Print(L"HvlpRunTests: No GetLogMessages method, skipped\r\n");
+        return EFI_SUCCESS;
+    }
+
+    Buffer = AllocatePool(HVL_TEST_LOG_BUFFER_SIZE);
+    if (Buffer == NULL) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+
+    for (Flags = 0; Flags <= HV_EFI_LOG_UTF8; Flags += HV_EFI_LOG_UTF8) {
+
+        //
+        // A buffer too small for the first record.
+        //
+
+        NextRecord = 0;
+        BufferSize = sizeof(HV_EFI_LOG_RECORD);
+        EfiStatus = HvEfiExProtocol->HvlGetLogMessages(
+                      Flags,
+                      &NextRecord,
+                      &BufferSize,
+                      Buffer,
+                      &RecordCount
+                      );
+
+        if ((EfiStatus != EFI_BUFFER_TOO_SMALL) ||
+            (BufferSize <= sizeof(HV_EFI_LOG_RECORD)) ||
+            (NextRecord != 0)) {
+            Print(
+              L"Error: HvlGetLogMessages(%x) small buffer, status %d!\r\n",
+              Flags,
+              EfiStatus
+              );
+
+            EfiStatus = EFI_PROTOCOL_ERROR;
+            goto Done;
+        }
+
+        //
+        // Validate the whole log.
+        //
+
+        NextMessage = 0;
+        NextRecord = 0;
+        MessageCount = 0;
+
+        do {
+            BufferSize = HVL_TEST_LOG_BUFFER_SIZE;
+            EfiStatus = HvEfiExProtocol->HvlGetLogMessages(
+                          Flags,
+                          &NextRecord,
+                          &BufferSize,
+                          Buffer,
+                          &RecordCount
+                          );
+
+            if (EFI_ERROR(EfiStatus)) {
+                Print(
+                  L"Error: HvlGetLogMessages(%x) failed, status %d!\r\n",
+                  Flags,
+                  EfiStatus
+                  );
+
+                goto Done;
+            }
+
+            Offset = 0;
+            for (Index = 0; Index < RecordCount; Index++) {
+                Record = Add2Ptr(Buffer, Offset);
+                Message = HvEfiProtocol->HvlGetNextLogMessage(&NextMessage);
+                if ((Message == NULL) ||
+                    ((Record->RecordSize % HV_EFI_LOG_RECORD_ALIGN) != 0) ||
+                    ((Offset + Record->RecordSize) > BufferSize) ||
+                    !HvlTestCompareLogRecord(Record, Flags, Message)) {
+                    Print(
+                      L"Error: Log record %d (flags %x) is invalid!\r\n",
+                      MessageCount,
+                      Flags
+                      );
+
+                    EfiStatus = EFI_PROTOCOL_ERROR;
+                    goto Done;
+                }
+
+                Offset += Record->RecordSize;
+                MessageCount++;
+            }
+
+            if ((Offset != BufferSize) || (NextRecord != NextMessage)) {
+                Print(L"Error: Log buffer (flags %x) is invalid!\r\n", Flags);
+                EfiStatus = EFI_PROTOCOL_ERROR;
+                goto Done;
+            }
+
+        } while (RecordCount != 0);
+
+        if (HvEfiProtocol->HvlGetNextLogMessage(&NextMessage) != NULL) {
+            Print(L"Error: Log drain (flags %x) is incomplete!\r\n", Flags);
+            EfiStatus = EFI_PROTOCOL_ERROR;
+            goto Done;
+        }
+
+        //
+        // Benchmark.
+        //
+
+        Bytes = 0;
+        CallCount = 0;
+
+        for (Index = 0; Index < HVL_TEST_BENCH_ITERATIONS; Index++) {
+            Bytes = 0;
+            CallCount = 0;
+            NextRecord = 0;
+
+            Start = GetPerformanceCounter();
+            do {
+                BufferSize = HVL_TEST_LOG_BUFFER_SIZE;
+                HvEfiExProtocol->HvlGetLogMessages(
+                  Flags,
+                  &NextRecord,
+                  &BufferSize,
+                  Buffer,
+                  &RecordCount
+                  );
+
+                Bytes += BufferSize;
+                CallCount++;
+
+            } while (RecordCount != 0);
+
+            Samples[Index] = GetTimeInNanoSecond(
+                               GetPerformanceCounter() - Start
+                               );
+        }
+
+        Print(
+          L"HvlpRunTests: Log has %d messages, %d bytes, %d calls\r\n",
+          MessageCount, Bytes, CallCount
+          );
+
+        HvlBenchPrintPhase(
+          CHECK_FLAG(Flags, HV_EFI_LOG_UTF8) ? L"LogBulkUtf8" : L"LogBulk",
+          Samples,
+          HVL_TEST_BENCH_ITERATIONS,
+          Bytes
+          );
+    }
+
+    EfiStatus = EFI_SUCCESS;
+
+Done:
+
+    FreePool(Buffer);
+
+    return EfiStatus;
+}
+
+
+/**
+  Run unit tests.
+
+  LINUX_EFI_HYPERVISOR_MEDIA_PROTOCOL methods are validated and benchmarked.
+  The protocol installed by the hypervisor loader is used, or the mock
+  provider, if requested.
+
+  @param[in]  UseMock   Use the mock protocol provider.
+
+  @return EFI_SUCCESS   If all tests passed.
+  @return Others        Otherwise.
+**/
+EFI_STATUS
+HvlTestRun (
+  IN  BOOLEAN   UseMock
+  )
+{
+
+    UINTN DescriptorSize;
+    EFI_STATUS EfiStatus;
+    EFI_MEMORY_DESCRIPTOR *EfiMemoryMap;
+    UINTN EfiMemoryMapSize;
+    LINUX_EFI_HYPERVISOR_MEDIA_EX_PROTOCOL *HvEfiExProtocol;
+    LINUX_EFI_HYPERVISOR_MEDIA_PROTOCOL *HvEfiProtocol;
+    HV_EFI_MEMORY_MAP_INDEX *Index;
+    UINTN MapKey;
+    UINT64 *Samples;
+
+    Print(L"\r\nHvloader.efi test run starting >>>\r\n");
+
+    EfiMemoryMap  = NULL;
+    Index = NULL;
+    Samples = NULL;
+
+    if (UseMock) {
+        EfiStatus = HvlMockCreate(
+                      HVL_MOCK_DEF_DESCRIPTORS,
+                      HVL_MOCK_DEF_MESSAGES,
+                      &HvEfiProtocol,
+                      &HvEfiExProtocol
+                      );
+
+    } else {
+        EfiStatus = gBS->LocateProtocol(
+                        &gLinuxEfiHypervisorMediaGuid,
+                        NULL,
+                        (VOID **)&HvEfiProtocol
+                        );
+    }
+
+    if (EFI_ERROR(EfiStatus)) {
+        Print(L"Error: LocateProtocol failed, EFI status %d!\r\n", EfiStatus);
+        goto Done;
+    }
+
+    //
+    // The extension protocol is optional, its methods are only used if
+    // its version and size cover them.
+    //
+
+    if (!UseMock) {
+        if (EFI_ERROR(gBS->LocateProtocol(
+                             &gLinuxEfiHypervisorMediaExGuid,
+                             NULL,
+                             (VOID **)&HvEfiExProtocol
+                             ))) {
+            HvEfiExProtocol = NULL;
+        }
+    }
+
+    if (HvEfiExProtocol == NULL) {
+        Print(L"HvlpRunTests: No extension protocol\r\n");
+
+    } else {
+        Print(
+          L"HvlpRunTests: Extension protocol version 0x%x size %d%s\r\n",
+          HvEfiExProtocol->Version,
+          HvEfiExProtocol->Size,
+          (HvEfiExProtocol->Version == LINUX_EFI_HYPERVISOR_MEDIA_EX_VERSION) ?
+            L"" : L", unsupported version"
+          );
+    }
+
+    Samples = AllocateZeroPool(HVL_TEST_BENCH_ITERATIONS * sizeof(UINT64));
+    if (Samples == NULL) {
+        EfiStatus = EFI_OUT_OF_RESOURCES;
+        goto Done;
+    }
+
+    //
+    // Test LINUX_EFI_HYPERVISOR_MEDIA_PROTOCOL.HvlGetMemoryMap()
+    //
+
+    if (HvEfiProtocol->HvlGetMemoryMap == NULL) {
+        Print(L"Error: Bad HV EFI protocol, no GetMemoryMap method!\r\n");
+        EfiStatus = EFI_PROTOCOL_ERROR;
+        goto Done;
+    }
+
+    EfiStatus = HvlTestGetMemoryMap(
+                  HvEfiProtocol,
+                  &EfiMemoryMap,
+                  &EfiMemoryMapSize,
+                  &DescriptorSize,
+                  &MapKey
+                  );
+
+    if (EFI_ERROR(EfiStatus)) {
+        goto Done;
+    }
+
+    EfiStatus = HvlTestValidateMemoryMap(
+                  EfiMemoryMap,
+                  EfiMemoryMapSize,
+                  DescriptorSize
+                  );
+
+    if (EFI_ERROR(EfiStatus)) {
+        goto Done;
+    }
+
+    HvlTestPrintMemoryMap(EfiMemoryMap, EfiMemoryMapSize, DescriptorSize);
+
+    //
+    // Test the memory map index.
+    //
+
+    EfiStatus = HvlTestGetMemoryMapIndex(
+                  HvEfiExProtocol,
+                  EfiMemoryMap,
+                  EfiMemoryMapSize,
+                  DescriptorSize,
+                  &Index
+                  );
+
+    if (EFI_ERROR(EfiStatus)) {
+        goto Done;
+    }
+
+    EfiStatus = HvlTestValidateMemoryMapIndex(
+                  Index,
+                  EfiMemoryMap,
+                  EfiMemoryMapSize,
+                  DescriptorSize
+                  );
+
+    if (EFI_ERROR(EfiStatus)) {
+        goto Done;
+    }
+
+    //
+    // Benchmark LINUX_EFI_HYPERVISOR_MEDIA_PROTOCOL methods.
+    //
+
+    Print(
+      L"HvlpRunTests: Benchmark, %d iterations:\r\n",
+      HVL_TEST_BENCH_ITERATIONS
+      );
+
+    EfiStatus = HvlTestBenchGetMemoryMap(
+                  HvEfiProtocol,
+                  EfiMemoryMapSize,
+                  Samples
+                  );
+
+    if (EFI_ERROR(EfiStatus)) {
+        goto Done;
+    }
+
+    EfiStatus = HvlTestBenchGetMemoryMapEx(
+                  HvEfiExProtocol,
+                  EfiMemoryMap,
+                  EfiMemoryMapSize,
+                  DescriptorSize,
+                  Samples
+                  );
+
+    if (EFI_ERROR(EfiStatus)) {
+        goto Done;
+    }
+
+    EfiStatus = HvlTestBenchMemoryMapIndex(
+                  Index,
+                  EfiMemoryMap,
+                  EfiMemoryMapSize,
+                  DescriptorSize,
+                  Samples
+                  );
+
+    if (EFI_ERROR(EfiStatus)) {
+        goto Done;
+    }
+
+    EfiStatus = HvlTestNuma(
+                  EfiMemoryMap,
+                  EfiMemoryMapSize,
+                  DescriptorSize,
+                  Samples
+                  );
+
+    if (EFI_ERROR(EfiStatus)) {
+        goto Done;
+    }
+
+    EfiStatus = HvlTestBenchGetNextLogMessage(HvEfiProtocol, Samples);
+    if (EFI_ERROR(EfiStatus)) {
+        goto Done;
+    }
+
+    EfiStatus = HvlTestBenchGetLogMessages(
+                  HvEfiProtocol,
+                  HvEfiExProtocol,
+                  Samples
+                  );
+
+    if (EFI_ERROR(EfiStatus)) {
+        goto Done;
+    }
+
+    //
+    // Registering runtime ranges changes the hypervisor memory map, so
+    // only do it with the mock provider.
+    //
+
+    if (UseMock) {
+        EfiStatus = HvlTestBenchRegisterRuntimeRange(
+                      HvEfiProtocol,
+                      EfiMemoryMap,
+                      EfiMemoryMapSize,
+                      DescriptorSize
+                      );
+
+        if (EFI_ERROR(EfiStatus)) {
+            goto Done;
+        }
+
+        EfiStatus = HvlTestBenchRegisterRuntimeRanges(
+                      HvEfiProtocol,
+                      HvEfiExProtocol,
+                      EfiMemoryMap,
+                      EfiMemoryMapSize,
+                      DescriptorSize,
+                      Samples
+                      );
+
+        if (EFI_ERROR(EfiStatus)) {
+            goto Done;
+        }
+    }
+
+    //
+    // The memory map changes since the initial memory map should
+    // reproduce the current memory map.
+    //
+
+    EfiStatus = HvlTestMemoryMapChanges(
+                  HvEfiProtocol,
+                  HvEfiExProtocol,
+                  EfiMemoryMap,
+                  EfiMemoryMapSize,
+                  DescriptorSize,
+                  MapKey,
+                  Samples
+                  );
+
+    if (EFI_ERROR(EfiStatus)) {
+        goto Done;
+    }
+
+Done:
+
+    Print(L"Hvloader.efi test run completed, status %d <<<\r\n", EfiStatus);
+
+    if (EfiMemoryMap != NULL) {
+        FreePool(EfiMemoryMap);
+    }
+
+    if (Index != NULL) {
+        FreePool(Index);
+    }
+
+    if (Samples != NULL) {
+        FreePool(Samples);
+    }
+
+    if (UseMock) {
+        HvlMockDestroy();
     }
 
-    while (Busy) {}
+    return EfiStatus;
 }
 
-#endif // HVL_TEST
\ No newline at end of file
+#endif // HVL_TEST
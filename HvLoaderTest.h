@@ -0,0 +1,85 @@
+/** @file
+  Definitions shared by the HvLoader.efi test and benchmark code.
+
+  This code is used for testing purposes only and is not part of production
+  images!
+
+  Copyright (c) Microsoft Corporation.
+  Licensed under the MIT License.
+
+**/
+
+#ifndef __HVLOADER_TEST_H__
+#define __HVLOADER_TEST_H__
+
+#include "HvEfi.h"
+
+//
+// -------------------------------------------------------------------- Defines
+//
+
+#define Add2Ptr(_ptr,_inc) ((VOID*)((CHAR8*)(_ptr) + (_inc)))
+
+//
+// Get the HV_EFI_MEMORY_DESCRIPTOR_EX at the tail of a memory descriptor.
+//
+#define HvlDescriptorEx(_desc, _descSize) \
+        ((HV_EFI_MEMORY_DESCRIPTOR_EX*)Add2Ptr( \
+                                        (_desc), \
+                                        (_descSize) - \
+                                          sizeof(HV_EFI_MEMORY_DESCRIPTOR_EX)))
+
+//
+// Mock LINUX_EFI_HYPERVISOR_MEDIA_PROTOCOL provider defaults.
+// The mock map is large enough to resemble a multi-TB host map.
+//
+#define HVL_MOCK_DEF_DESCRIPTORS  4096
+#define HVL_MOCK_DEF_MESSAGES     2048
+
+//
+// Mock memory descriptor size, EFI_MEMORY_DESCRIPTOR aligned to 128 bits,
+// followed by HV_EFI_MEMORY_DESCRIPTOR_EX.
+//
+#define HVL_MOCK_DESCRIPTOR_SIZE \
+        (ALIGN_VALUE(sizeof(EFI_MEMORY_DESCRIPTOR), 16) + \
+         sizeof(HV_EFI_MEMORY_DESCRIPTOR_EX))
+
+//
+// Mock HvlRegisterRuntimeRange() return values.
+//
+#define HVL_MOCK_RANGE_SUCCESS    0
+#define HVL_MOCK_RANGE_FAILURE    1
+
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+VOID
+HvlBenchSortSamples (
+  IN OUT  UINT64  *Samples,
+  IN      UINTN   SampleCount
+  );
+
+VOID
+HvlBenchPrintPhase (
+  IN      CHAR16  *PhaseName,
+  IN OUT  UINT64  *Samples,
+  IN      UINTN   SampleCount,
+  IN      UINTN   Bytes
+  );
+
+EFI_STATUS
+HvlMockCreate (
+  IN  UINTN                                   DescriptorCount,
+  IN  UINTN                                   MessageCount,
+  OUT LINUX_EFI_HYPERVISOR_MEDIA_PROTOCOL     **Protocol,
+  OUT LINUX_EFI_HYPERVISOR_MEDIA_EX_PROTOCOL  **ExProtocol
+  );
+
+VOID
+HvlMockDestroy (
+  VOID
+  );
+
+#endif // !__HVLOADER_TEST_H__
@@ -0,0 +1,1124 @@
+/** @file
+  This is a mock LINUX_EFI_HYPERVISOR_MEDIA_PROTOCOL provider.
+  It serves a synthetic memory map and log, so the test suite can run without
+  a hypervisor loader, for example under QEMU/OVMF.
+
+  This code is used for testing purposes only and is not part of production
+  images!
+
+  Copyright (c) Microsoft Corporation.
+  Licensed under the MIT License.
+
+**/
+
+#include <stddef.h>
+#include <Uefi.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/PrintLib.h>
+#include <Library/UefiLib.h>
+#include <Protocol/LoadedImage.h>
+
+#include "HvLoaderEfi.h"
+#include "HvLoaderP.h"
+
+#if HVL_TEST
+#include "HvLoaderMemMap.h"
+#include "HvLoaderTest.h"
+
+
+//
+// -------------------------------------------------------------------- Defines
+//
+
+//
+// Mock log message length, including the NULL terminator.
+//
+#define HVL_MOCK_MESSAGE_LENGTH   64
+
+//
+// Mock memory map base address.
+//
+#define HVL_MOCK_MAP_BASE         0x100000
+
+//
+// Number of memory map change records retained.
+//
+#define HVL_MOCK_CHANGES          4096
+
+
+//
+// ---------------------------------------------------------------------- Types
+//
+
+//
+// Mock provider state.
+//
+typedef struct {
+  //
+  // Memory map, HVL_MOCK_DESCRIPTOR_SIZE stride.
+  //
+  UINT8   *Map;
+  UINTN   Count;
+  UINTN   Capacity;
+  UINTN   MapKey;
+
+  //
+  // Memory map change records ring, and the generation of the newest
+  // change record dropped from it.
+  //
+  HV_EFI_MEMORY_MAP_CHANGE  *Changes;
+  UINTN                     ChangeCount;
+  UINTN                     LostGeneration;
+
+  //
+  // Log messages, HVL_MOCK_MESSAGE_LENGTH stride, and their lengths in
+  // characters.
+  //
+  CHAR16  *Messages;
+  UINT16  *MessageLengths;
+  UINTN   MessageCount;
+} HVL_MOCK;
+
+//
+// Mock runtime range, page aligned [Start, End).
+//
+typedef struct {
+  EFI_PHYSICAL_ADDRESS  Start;
+  EFI_PHYSICAL_ADDRESS  End;
+} HVL_MOCK_RANGE;
+
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+HVL_MOCK mHvlMock;
+
+//
+// Memory types used for the synthetic memory map.
+//
+EFI_MEMORY_TYPE mHvlMockTypes[] = {
+  EfiConventionalMemory,
+  EfiConventionalMemory,
+  EfiBootServicesData,
+  EfiBootServicesCode,
+  EfiLoaderData,
+  EfiLoaderCode,
+  EfiRuntimeServicesData,
+  EfiACPIReclaimMemory,
+  EfiReservedMemoryType,
+  EfiMemoryMappedIO
+};
+
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+/**
+  Returns the next pseudo random number, for a reproducible synthetic map.
+
+  @param[in,out]  Seed  The generator state.
+
+  @return The next pseudo random number.
+**/
+UINT32
+HvlMockRandom (
+  IN OUT  UINT32  *Seed
+  )
+{
+
+  *Seed = (*Seed * 1103515245) + 12345;
+  return (*Seed >> 16) & 0x7FFF;
+}
+
+
+/**
+  Returns the mock memory descriptor at a given index.
+
+  @param[in]  Index   The descriptor index.
+
+  @return The memory descriptor.
+**/
+EFI_MEMORY_DESCRIPTOR *
+HvlMockDescriptor (
+  IN  UINTN   Index
+  )
+{
+
+  return Add2Ptr(mHvlMock.Map, Index * HVL_MOCK_DESCRIPTOR_SIZE);
+}
+
+
+/**
+  Finds the mock memory descriptor that covers a physical address.
+
+  @param[in]  Address The physical address.
+
+  @return The index of the descriptor covering Address, or the descriptor
+          count if Address is not covered by the map.
+**/
+UINTN
+HvlMockFind (
+  IN  EFI_PHYSICAL_ADDRESS  Address
+  )
+{
+
+  EFI_MEMORY_DESCRIPTOR *Descriptor;
+  UINTN                 High;
+  UINTN                 Low;
+  UINTN                 Middle;
+
+  Low = 0;
+  High = mHvlMock.Count;
+
+  while (Low < High) {
+    Middle = Low + ((High - Low) / 2);
+    Descriptor = HvlMockDescriptor(Middle);
+
+    if (Address < Descriptor->PhysicalStart) {
+      High = Middle;
+    } else if (Address >= Descriptor->PhysicalStart +
+                          EFI_PAGES_TO_SIZE(Descriptor->NumberOfPages)) {
+      Low = Middle + 1;
+    } else {
+      return Middle;
+    }
+  }
+
+  return mHvlMock.Count;
+}
+
+
+/**
+  Logs a memory map change of the next generation.
+
+  @param[in]  Kind        HV_EFI_MEMORY_MAP_CHANGE_*.
+  @param[in]  Descriptor  The descriptor changed.
+
+  @return None
+**/
+VOID
+HvlMockLogChange (
+  IN  UINT32                Kind,
+  IN  EFI_MEMORY_DESCRIPTOR *Descriptor
+  )
+{
+
+  HV_EFI_MEMORY_MAP_CHANGE  *Change;
+
+  if (mHvlMock.Changes == NULL) {
+    return;
+  }
+
+  Change = &mHvlMock.Changes[mHvlMock.ChangeCount % HVL_MOCK_CHANGES];
+  if (mHvlMock.ChangeCount >= HVL_MOCK_CHANGES) {
+    mHvlMock.LostGeneration = (UINTN)Change->Generation;
+  }
+
+  Change->Generation = mHvlMock.MapKey + 1;
+  Change->Kind = Kind;
+  Change->Reserved = 0;
+  Change->Descriptor.PhysicalStart = Descriptor->PhysicalStart;
+  Change->Descriptor.NumberOfPages = Descriptor->NumberOfPages;
+  Change->Descriptor.Attribute = Descriptor->Attribute;
+  Change->Descriptor.Type = Descriptor->Type;
+  Change->Descriptor.Reserved = 0;
+  Change->Descriptor.ExAttribute =
+    HvlDescriptorEx(Descriptor, HVL_MOCK_DESCRIPTOR_SIZE)->ExAttribute;
+
+  mHvlMock.ChangeCount++;
+}
+
+
+/**
+  Checks that a range is fully covered by the mock memory map.
+
+  @param[in]  Start   The range start physical address.
+  @param[in]  End     The range end physical address.
+
+  @return TRUE if the range is covered, FALSE otherwise.
+**/
+BOOLEAN
+HvlMockCovered (
+  IN  EFI_PHYSICAL_ADDRESS  Start,
+  IN  EFI_PHYSICAL_ADDRESS  End
+  )
+{
+
+  EFI_MEMORY_DESCRIPTOR *Descriptor;
+  UINTN                 Index;
+
+  Index = HvlMockFind(Start);
+  while (Start < End) {
+    if (Index == mHvlMock.Count) {
+      return FALSE;
+    }
+
+    Descriptor = HvlMockDescriptor(Index);
+    if (Descriptor->PhysicalStart > Start) {
+      return FALSE;
+    }
+
+    Start = Descriptor->PhysicalStart +
+            EFI_PAGES_TO_SIZE(Descriptor->NumberOfPages);
+    Index++;
+  }
+
+  return TRUE;
+}
+
+
+/**
+  Marks sorted, non-overlapping, ranges as runtime, in one pass over the
+  mock memory map. Descriptors are split at range boundaries.
+
+  @param[in]  Ranges      The ranges, covered by the map.
+  @param[in]  RangeCount  Number of ranges.
+
+  @return EFI_SUCCESS           If the ranges were applied.
+  @return EFI_OUT_OF_RESOURCES  If the map could not be grown, the map is
+                                not changed.
+**/
+EFI_STATUS
+HvlMockApplyRanges (
+  IN  HVL_MOCK_RANGE  *Ranges,
+  IN  UINTN           RangeCount
+  )
+{
+
+  EFI_PHYSICAL_ADDRESS  Address;
+  UINTN                 Capacity;
+  UINTN                 Count;
+  EFI_MEMORY_DESCRIPTOR *Descriptor;
+  EFI_PHYSICAL_ADDRESS  End;
+  UINTN                 Index;
+  UINT8                 *Map;
+  UINTN                 Next;
+  EFI_MEMORY_DESCRIPTOR *Piece;
+  EFI_PHYSICAL_ADDRESS  PieceEnd;
+  UINTN                 Range;
+  BOOLEAN               Runtime;
+
+  //
+  // Each range splits at most 2 descriptors.
+  //
+
+  Capacity = MAX(mHvlMock.Capacity, mHvlMock.Count + (2 * RangeCount));
+  Map = AllocatePool(Capacity * HVL_MOCK_DESCRIPTOR_SIZE);
+  if (Map == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Count = 0;
+  Index = 0;
+  Range = 0;
+
+  while (Index < mHvlMock.Count) {
+    //
+    // Copy the descriptors up to the next range as is.
+    //
+
+    Next = mHvlMock.Count;
+    if (Range < RangeCount) {
+      Next = MAX(HvlMockFind(Ranges[Range].Start), Index);
+    }
+
+    CopyMem(
+      Add2Ptr(Map, Count * HVL_MOCK_DESCRIPTOR_SIZE),
+      HvlMockDescriptor(Index),
+      (Next - Index) * HVL_MOCK_DESCRIPTOR_SIZE
+      );
+
+    Count += Next - Index;
+    Index = Next;
+    if (Index == mHvlMock.Count) {
+      break;
+    }
+
+    Descriptor = HvlMockDescriptor(Index);
+    Address = Descriptor->PhysicalStart;
+    End = Address + EFI_PAGES_TO_SIZE(Descriptor->NumberOfPages);
+    Index++;
+
+    while (Address < End) {
+      if ((Range < RangeCount) && (Ranges[Range].Start <= Address)) {
+        PieceEnd = MIN(End, Ranges[Range].End);
+        Runtime = TRUE;
+      } else if (Range < RangeCount) {
+        PieceEnd = MIN(End, Ranges[Range].Start);
+        Runtime = FALSE;
+      } else {
+        PieceEnd = End;
+        Runtime = FALSE;
+      }
+
+      Piece = Add2Ptr(Map, Count * HVL_MOCK_DESCRIPTOR_SIZE);
+      CopyMem(Piece, Descriptor, HVL_MOCK_DESCRIPTOR_SIZE);
+      Piece->PhysicalStart = Address;
+      Piece->NumberOfPages = (PieceEnd - Address) >> EFI_PAGE_SHIFT;
+      if (Runtime) {
+        Piece->Attribute |= EFI_MEMORY_RUNTIME;
+      }
+
+      if (Address != Descriptor->PhysicalStart) {
+        Piece->VirtualStart = 0;
+        HvlMockLogChange(HV_EFI_MEMORY_MAP_CHANGE_ADDED, Piece);
+
+      } else if ((Piece->NumberOfPages != Descriptor->NumberOfPages) ||
+                 (Piece->Attribute != Descriptor->Attribute)) {
+        HvlMockLogChange(HV_EFI_MEMORY_MAP_CHANGE_CHANGED, Piece);
+      }
+
+      if (Runtime && (PieceEnd == Ranges[Range].End)) {
+        Range++;
+      }
+
+      Address = PieceEnd;
+      Count++;
+    }
+  }
+
+  FreePool(mHvlMock.Map);
+  mHvlMock.Map = Map;
+  mHvlMock.Count = Count;
+  mHvlMock.Capacity = Capacity;
+
+  return EFI_SUCCESS;
+}
+
+
+/**
+  Builds a synthetic, sorted and non-overlapping, memory map.
+
+  @param[in]  DescriptorCount Number of descriptors.
+
+  @return EFI_SUCCESS           If the map was built.
+  @return EFI_OUT_OF_RESOURCES  Otherwise.
+**/
+EFI_STATUS
+HvlMockBuildMap (
+  IN  UINTN   DescriptorCount
+  )
+{
+
+  EFI_PHYSICAL_ADDRESS        Address;
+  EFI_MEMORY_DESCRIPTOR       *Descriptor;
+  HV_EFI_MEMORY_DESCRIPTOR_EX *DescriptorEx;
+  UINTN                       Index;
+  UINT32                      Random;
+  UINT32                      Seed;
+
+  mHvlMock.Capacity = DescriptorCount * 2;
+  mHvlMock.Map = AllocateZeroPool(mHvlMock.Capacity * HVL_MOCK_DESCRIPTOR_SIZE);
+  if (mHvlMock.Map == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Address = HVL_MOCK_MAP_BASE;
+  Seed = 0x48564C;
+
+  for (Index = 0; Index < DescriptorCount; Index++) {
+    Random = HvlMockRandom(&Seed);
+    Descriptor = HvlMockDescriptor(Index);
+    DescriptorEx = HvlDescriptorEx(Descriptor, HVL_MOCK_DESCRIPTOR_SIZE);
+
+    //
+    // Leave an occasional hole in the address space.
+    // Firmware maps are fragmented, so most descriptors continue the
+    // previous one, with the same type and attributes.
+    //
+
+    if ((Random % 8) == 0) {
+      Address += EFI_PAGES_TO_SIZE(1 + (Random % 64));
+
+    } else if ((Index != 0) && ((Random % 4) != 0)) {
+      CopyMem(
+        Descriptor,
+        HvlMockDescriptor(Index - 1),
+        HVL_MOCK_DESCRIPTOR_SIZE
+        );
+
+      Descriptor->PhysicalStart = Address;
+      Descriptor->NumberOfPages = 1 + (HvlMockRandom(&Seed) % 256);
+      Address += EFI_PAGES_TO_SIZE(Descriptor->NumberOfPages);
+      continue;
+    }
+
+    Descriptor->Type = mHvlMockTypes[Random % ARRAY_SIZE(mHvlMockTypes)];
+    Descriptor->PhysicalStart = Address;
+    Descriptor->NumberOfPages = 1 + (HvlMockRandom(&Seed) % 256);
+    Descriptor->Attribute = EFI_MEMORY_WB;
+    if (Descriptor->Type == EfiMemoryMappedIO) {
+      Descriptor->Attribute = EFI_MEMORY_UC;
+    }
+
+    switch (Random % 32) {
+      case 0:
+        DescriptorEx->ExAttribute = HV_EFI_MEMORY_EX_ATTR_HV;
+        break;
+
+      case 1:
+        DescriptorEx->ExAttribute = HV_EFI_MEMORY_EX_ATTR_HVLOADER;
+        break;
+
+      default:
+        break;
+    }
+
+    Address += EFI_PAGES_TO_SIZE(Descriptor->NumberOfPages);
+  }
+
+  mHvlMock.Count = DescriptorCount;
+  mHvlMock.MapKey = 1;
+
+  return EFI_SUCCESS;
+}
+
+
+/**
+  Builds the synthetic log messages.
+
+  @param[in]  MessageCount  Number of messages.
+
+  @return EFI_SUCCESS           If the log was built.
+  @return EFI_OUT_OF_RESOURCES  Otherwise.
+**/
+EFI_STATUS
+HvlMockBuildLog (
+  IN  UINTN   MessageCount
+  )
+{
+
+  UINTN   Index;
+
+  mHvlMock.Messages = AllocatePool(
+                        MessageCount *
+                        HVL_MOCK_MESSAGE_LENGTH *
+                        sizeof(CHAR16)
+                        );
+
+  mHvlMock.MessageLengths = AllocatePool(MessageCount * sizeof(UINT16));
+
+  if ((mHvlMock.Messages == NULL) || (mHvlMock.MessageLengths == NULL)) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  for (Index = 0; Index < MessageCount; Index++) {
+    mHvlMock.MessageLengths[Index] = (UINT16)UnicodeSPrint(
+      mHvlMock.Messages + (Index * HVL_MOCK_MESSAGE_LENGTH),
+      HVL_MOCK_MESSAGE_LENGTH * sizeof(CHAR16),
+      L"Mock HV loader log message %d, %d\x00B5s\r\n",
+      Index,
+      Index * 7
+      );
+  }
+
+  mHvlMock.MessageCount = MessageCount;
+
+  return EFI_SUCCESS;
+}
+
+
+//
+// Mock LINUX_EFI_HYPERVISOR_MEDIA_PROTOCOL methods
+//
+
+VOID
+EFIAPI
+HvlMockLaunchHv (
+  IN OPTIONAL VOID *SanitizeBspContext,
+  OUT         VOID *HvlReturnData
+  )
+{
+
+  return;
+}
+
+
+EFI_STATUS
+EFIAPI
+HvlMockRegisterRuntimeRanges (
+  IN OUT  HV_EFI_RUNTIME_RANGE    *Ranges,
+  IN      UINTN                   RangeCount
+  )
+{
+
+  UINTN                 ChangeCount;
+  EFI_PHYSICAL_ADDRESS  End;
+  UINTN                 Index;
+  HVL_MOCK_RANGE        *Merged;
+  UINTN                 MergedCount;
+  UINTN                 *Order;
+  UINTN                 OrderCount;
+  UINTN                 Position;
+  EFI_PHYSICAL_ADDRESS  Start;
+  EFI_STATUS            Status;
+
+  if ((Ranges == NULL) && (RangeCount != 0)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  Order = AllocatePool((RangeCount + 1) * sizeof(UINTN));
+  Merged = AllocatePool((RangeCount + 1) * sizeof(HVL_MOCK_RANGE));
+  if ((Order == NULL) || (Merged == NULL)) {
+    Status = EFI_OUT_OF_RESOURCES;
+    goto Done;
+  }
+
+  //
+  // Each range needs to be valid and fully covered by the memory map.
+  // Valid ranges are sorted by base page.
+  //
+
+  OrderCount = 0;
+  for (Index = 0; Index < RangeCount; Index++) {
+    Ranges[Index].Result = HVL_MOCK_RANGE_FAILURE;
+
+    if ((Ranges[Index].PageCount == 0) ||
+        (Ranges[Index].BasePage > (MAX_UINT64 >> EFI_PAGE_SHIFT)) ||
+        (Ranges[Index].PageCount >
+          (MAX_UINT64 >> EFI_PAGE_SHIFT) - Ranges[Index].BasePage) ||
+        !HvlMockCovered(
+          EFI_PAGES_TO_SIZE(Ranges[Index].BasePage),
+          EFI_PAGES_TO_SIZE(Ranges[Index].BasePage + Ranges[Index].PageCount)
+          )) {
+      continue;
+    }
+
+    Ranges[Index].Result = HVL_MOCK_RANGE_SUCCESS;
+
+    Position = OrderCount;
+    while ((Position > 0) &&
+           (Ranges[Order[Position - 1]].BasePage > Ranges[Index].BasePage)) {
+      Order[Position] = Order[Position - 1];
+      Position--;
+    }
+
+    Order[Position] = Index;
+    OrderCount++;
+  }
+
+  //
+  // Merge overlapping and adjacent ranges.
+  //
+
+  MergedCount = 0;
+  for (Index = 0; Index < OrderCount; Index++) {
+    Start = EFI_PAGES_TO_SIZE(Ranges[Order[Index]].BasePage);
+    End = Start + EFI_PAGES_TO_SIZE(Ranges[Order[Index]].PageCount);
+
+    if ((MergedCount != 0) && (Start <= Merged[MergedCount - 1].End)) {
+      Merged[MergedCount - 1].End = MAX(Merged[MergedCount - 1].End, End);
+    } else {
+      Merged[MergedCount].Start = Start;
+      Merged[MergedCount].End = End;
+      MergedCount++;
+    }
+  }
+
+  ChangeCount = mHvlMock.ChangeCount;
+  Status = HvlMockApplyRanges(Merged, MergedCount);
+  if (EFI_ERROR(Status)) {
+    for (Index = 0; Index < OrderCount; Index++) {
+      Ranges[Order[Index]].Result = HVL_MOCK_RANGE_FAILURE;
+    }
+
+    goto Done;
+  }
+
+  if ((OrderCount != 0) || (mHvlMock.ChangeCount != ChangeCount)) {
+    mHvlMock.MapKey++;
+  }
+
+  if (OrderCount != RangeCount) {
+    Status = EFI_NOT_FOUND;
+  }
+
+Done:
+
+  if (Order != NULL) {
+    FreePool(Order);
+  }
+
+  if (Merged != NULL) {
+    FreePool(Merged);
+  }
+
+  return Status;
+}
+
+
+UINT32
+EFIAPI
+HvlMockRegisterRuntimeRange (
+  IN UINT64 BasePage,
+  IN UINT64 PageCount
+  )
+{
+
+  HV_EFI_RUNTIME_RANGE  Range;
+
+  Range.BasePage = BasePage;
+  Range.PageCount = PageCount;
+  Range.Result = HVL_MOCK_RANGE_FAILURE;
+  Range.Reserved = 0;
+
+  HvlMockRegisterRuntimeRanges(&Range, 1);
+
+  return Range.Result;
+}
+
+
+EFI_STATUS
+EFIAPI
+HvlMockGetMemoryMap (
+  IN OUT  UINTN                   *EfiMemoryMapSize,
+  IN OUT  EFI_MEMORY_DESCRIPTOR   *EfiMemoryMap,
+  OUT     UINTN                   *MapKey,
+  OUT     UINTN                   *DescriptorSize,
+  OUT     UINT32                  *DescriptorVersion
+  )
+{
+
+  UINTN   RequiredSize;
+
+  if (EfiMemoryMapSize == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  RequiredSize = mHvlMock.Count * HVL_MOCK_DESCRIPTOR_SIZE;
+
+  *MapKey = mHvlMock.MapKey;
+  *DescriptorSize = HVL_MOCK_DESCRIPTOR_SIZE;
+  *DescriptorVersion = EFI_MEMORY_DESCRIPTOR_VERSION;
+
+  if (*EfiMemoryMapSize < RequiredSize) {
+    *EfiMemoryMapSize = RequiredSize;
+    return EFI_BUFFER_TOO_SMALL;
+  }
+
+  if (EfiMemoryMap == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  CopyMem(EfiMemoryMap, mHvlMock.Map, RequiredSize);
+  *EfiMemoryMapSize = RequiredSize;
+
+  return EFI_SUCCESS;
+}
+
+
+CHAR16*
+EFIAPI
+HvlMockGetNextLogMessage (
+  IN OUT  size_t *NextMessage
+  )
+{
+
+  CHAR16  *Message;
+
+  if (*NextMessage >= mHvlMock.MessageCount) {
+    return NULL;
+  }
+
+  Message = mHvlMock.Messages + (*NextMessage * HVL_MOCK_MESSAGE_LENGTH);
+  (*NextMessage)++;
+
+  return Message;
+}
+
+
+/**
+  Encodes UCS-2 text as UTF-8.
+
+  @param[in]  Text      The UCS-2 text.
+  @param[in]  Length    The text length, in characters.
+  @param[out] Buffer    The UTF-8 buffer, NULL to only get the encoded size.
+
+  @return The UTF-8 text size, in bytes.
+**/
+UINTN
+HvlMockUtf8Encode (
+  IN  CONST CHAR16  *Text,
+  IN  UINTN         Length,
+  OUT CHAR8         *Buffer OPTIONAL
+  )
+{
+
+  CHAR16  Char;
+  UINTN   Index;
+  UINTN   Size;
+
+  Size = 0;
+
+  for (Index = 0; Index < Length; Index++) {
+    Char = Text[Index];
+    if (Char < 0x80) {
+      if (Buffer != NULL) {
+        Buffer[Size] = (CHAR8)Char;
+      }
+
+      Size += 1;
+
+    } else if (Char < 0x800) {
+      if (Buffer != NULL) {
+        Buffer[Size] = (CHAR8)(0xC0 | (Char >> 6));
+        Buffer[Size + 1] = (CHAR8)(0x80 | (Char & 0x3F));
+      }
+
+      Size += 2;
+
+    } else {
+      if (Buffer != NULL) {
+        Buffer[Size] = (CHAR8)(0xE0 | (Char >> 12));
+        Buffer[Size + 1] = (CHAR8)(0x80 | ((Char >> 6) & 0x3F));
+        Buffer[Size + 2] = (CHAR8)(0x80 | (Char & 0x3F));
+      }
+
+      Size += 3;
+    }
+  }
+
+  return Size;
+}
+
+
+EFI_STATUS
+EFIAPI
+HvlMockGetLogMessages (
+  IN      UINT32                  Flags,
+  IN OUT  size_t                  *NextMessage,
+  IN OUT  UINTN                   *BufferSize,
+  OUT     VOID                    *Buffer,
+  OUT     UINTN                   *MessageCount
+  )
+{
+
+  UINTN               Available;
+  UINTN               CharSize;
+  UINTN               Count;
+  BOOLEAN             Encoded;
+  UINTN               Length;
+  CHAR16              *Message;
+  UINTN               Offset;
+  HV_EFI_LOG_RECORD   *Record;
+  UINTN               RecordSize;
+  UINTN               TextSize;
+
+  if ((NextMessage == NULL) || (BufferSize == NULL) ||
+      (MessageCount == NULL) || ((Flags & ~HV_EFI_LOG_FLAGS) != 0) ||
+      ((Buffer == NULL) && (*BufferSize != 0))) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  CharSize = CHECK_FLAG(Flags, HV_EFI_LOG_UTF8) ?
+             sizeof(CHAR8) : sizeof(CHAR16);
+
+  Count = 0;
+  Offset = 0;
+  RecordSize = 0;
+
+  while ((*NextMessage + Count) < mHvlMock.MessageCount) {
+    Message = mHvlMock.Messages +
+              ((*NextMessage + Count) * HVL_MOCK_MESSAGE_LENGTH);
+
+    Length = mHvlMock.MessageLengths[*NextMessage + Count];
+    Available = *BufferSize - Offset;
+    Record = Add2Ptr(Buffer, Offset);
+    Encoded = FALSE;
+
+    //
+    // UTF-8 text is encoded in place, if its worst case size fits,
+    // otherwise its size is computed first.
+    //
+
+    if (CharSize == sizeof(CHAR16)) {
+      TextSize = Length * sizeof(CHAR16);
+
+    } else if (Available >= ALIGN_VALUE(
+                              sizeof(HV_EFI_LOG_RECORD) + (Length * 3) + 1,
+                              HV_EFI_LOG_RECORD_ALIGN
+                              )) {
+      TextSize = HvlMockUtf8Encode(Message, Length, (CHAR8 *)(Record + 1));
+      Encoded = TRUE;
+
+    } else {
+      TextSize = HvlMockUtf8Encode(Message, Length, NULL);
+    }
+
+    RecordSize = ALIGN_VALUE(
+                   sizeof(HV_EFI_LOG_RECORD) + TextSize + CharSize,
+                   HV_EFI_LOG_RECORD_ALIGN
+                   );
+
+    if (RecordSize > Available) {
+      break;
+    }
+
+    if (!Encoded) {
+      if (CharSize == sizeof(CHAR16)) {
+        CopyMem(Record + 1, Message, TextSize);
+      } else {
+        HvlMockUtf8Encode(Message, Length, (CHAR8 *)(Record + 1));
+      }
+    }
+
+    //
+    // NULL terminator and padding.
+    //
+
+    ZeroMem(
+      (UINT8 *)(Record + 1) + TextSize,
+      RecordSize - sizeof(HV_EFI_LOG_RECORD) - TextSize
+      );
+
+    Record->RecordSize = (UINT32)RecordSize;
+    Record->TextSize = (UINT32)TextSize;
+    Offset += RecordSize;
+    Count++;
+  }
+
+  *MessageCount = Count;
+
+  if ((Count == 0) && (*NextMessage < mHvlMock.MessageCount)) {
+    *BufferSize = RecordSize;
+    return EFI_BUFFER_TOO_SMALL;
+  }
+
+  *NextMessage += Count;
+  *BufferSize = Offset;
+
+  return EFI_SUCCESS;
+}
+
+
+EFI_STATUS
+EFIAPI
+HvlMockGetMemoryMapIndex (
+  IN OUT  UINTN                   *IndexSize,
+  OUT     HV_EFI_MEMORY_MAP_INDEX *Index
+  )
+{
+
+  return HvlMemMapIndexBuild(
+           (EFI_MEMORY_DESCRIPTOR *)mHvlMock.Map,
+           mHvlMock.Count * HVL_MOCK_DESCRIPTOR_SIZE,
+           HVL_MOCK_DESCRIPTOR_SIZE,
+           mHvlMock.MapKey,
+           Index,
+           IndexSize
+           );
+}
+
+
+EFI_STATUS
+EFIAPI
+HvlMockGetMemoryMapEx (
+  IN      UINT32                  Flags,
+  IN OUT  UINTN                   *EfiMemoryMapSize,
+  IN OUT  VOID                    *EfiMemoryMap,
+  OUT     UINTN                   *MapKey,
+  OUT     UINTN                   *DescriptorSize,
+  OUT     UINT32                  *DescriptorVersion
+  )
+{
+
+  if (MapKey == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  *MapKey = mHvlMock.MapKey;
+
+  return HvlMemMapCopy(
+           (EFI_MEMORY_DESCRIPTOR *)mHvlMock.Map,
+           mHvlMock.Count * HVL_MOCK_DESCRIPTOR_SIZE,
+           HVL_MOCK_DESCRIPTOR_SIZE,
+           Flags,
+           EfiMemoryMap,
+           EfiMemoryMapSize,
+           DescriptorSize,
+           DescriptorVersion
+           );
+}
+
+
+EFI_STATUS
+EFIAPI
+HvlMockGetMemoryMapChanges (
+  IN      UINTN                     Generation,
+  IN OUT  UINTN                     *ChangesSize,
+  OUT     HV_EFI_MEMORY_MAP_CHANGE  *Changes,
+  OUT     UINTN                     *CurrentGeneration
+  )
+{
+
+  UINTN   First;
+  UINTN   High;
+  UINTN   Index;
+  UINTN   Low;
+  UINTN   Middle;
+  UINTN   RequiredSize;
+
+  if ((ChangesSize == NULL) || (CurrentGeneration == NULL) ||
+      (Generation > mHvlMock.MapKey)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  *CurrentGeneration = mHvlMock.MapKey;
+
+  if ((mHvlMock.Changes == NULL) || (Generation < mHvlMock.LostGeneration)) {
+    return EFI_NOT_FOUND;
+  }
+
+  //
+  // Change records are in generation order, find the first record after
+  // Generation.
+  //
+
+  Low = 0;
+  if (mHvlMock.ChangeCount > HVL_MOCK_CHANGES) {
+    Low = mHvlMock.ChangeCount - HVL_MOCK_CHANGES;
+  }
+
+  High = mHvlMock.ChangeCount;
+  while (Low < High) {
+    Middle = Low + ((High - Low) / 2);
+    if (mHvlMock.Changes[Middle % HVL_MOCK_CHANGES].Generation <= Generation) {
+      Low = Middle + 1;
+    } else {
+      High = Middle;
+    }
+  }
+
+  First = Low;
+  RequiredSize = (mHvlMock.ChangeCount - First) *
+                 sizeof(HV_EFI_MEMORY_MAP_CHANGE);
+
+  if (*ChangesSize < RequiredSize) {
+    *ChangesSize = RequiredSize;
+    return EFI_BUFFER_TOO_SMALL;
+  }
+
+  if ((Changes == NULL) && (RequiredSize != 0)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  for (Index = First; Index < mHvlMock.ChangeCount; Index++) {
+    Changes[Index - First] = mHvlMock.Changes[Index % HVL_MOCK_CHANGES];
+  }
+
+  *ChangesSize = RequiredSize;
+
+  return EFI_SUCCESS;
+}
+
+
+LINUX_EFI_HYPERVISOR_MEDIA_PROTOCOL mHvlMockProtocol = {
+  HvlMockLaunchHv,
+  HvlMockRegisterRuntimeRange,
+  HvlMockGetMemoryMap,
+  HvlMockGetNextLogMessage
+};
+
+LINUX_EFI_HYPERVISOR_MEDIA_EX_PROTOCOL mHvlMockExProtocol = {
+  LINUX_EFI_HYPERVISOR_MEDIA_EX_VERSION,
+  sizeof(LINUX_EFI_HYPERVISOR_MEDIA_EX_PROTOCOL),
+  HvlMockGetMemoryMapIndex,
+  HvlMockGetMemoryMapEx,
+  HvlMockGetMemoryMapChanges,
+  HvlMockRegisterRuntimeRanges,
+  HvlMockGetLogMessages
+};
+
+
+/**
+  Creates the mock LINUX_EFI_HYPERVISOR_MEDIA_PROTOCOL provider.
+  The protocols are not installed, they are returned to the caller.
+
+  @param[in]  DescriptorCount Number of synthetic memory map descriptors.
+  @param[in]  MessageCount    Number of synthetic log messages.
+  @param[out] Protocol        The mock protocol interface.
+  @param[out] ExProtocol      The mock extension protocol interface.
+
+  @return EFI_SUCCESS         If the mock provider was created.
+  @return Others              Otherwise.
+**/
+EFI_STATUS
+HvlMockCreate (
+  IN  UINTN                                   DescriptorCount,
+  IN  UINTN                                   MessageCount,
+  OUT LINUX_EFI_HYPERVISOR_MEDIA_PROTOCOL     **Protocol,
+  OUT LINUX_EFI_HYPERVISOR_MEDIA_EX_PROTOCOL  **ExProtocol
+  )
+{
+
+  EFI_STATUS  Status;
+
+  ZeroMem(&mHvlMock, sizeof(mHvlMock));
+
+  Status = HvlMockBuildMap(DescriptorCount);
+  if (EFI_ERROR(Status)) {
+    goto Done;
+  }
+
+  Status = HvlMockBuildLog(MessageCount);
+  if (EFI_ERROR(Status)) {
+    goto Done;
+  }
+
+  mHvlMock.Changes = AllocatePool(
+                       HVL_MOCK_CHANGES * sizeof(HV_EFI_MEMORY_MAP_CHANGE)
+                       );
+
+  if (mHvlMock.Changes == NULL) {
+    Status = EFI_OUT_OF_RESOURCES;
+    goto Done;
+  }
+
+  *Protocol = &mHvlMockProtocol;
+  *ExProtocol = &mHvlMockExProtocol;
+
+Done:
+
+  if (EFI_ERROR(Status)) {
+    HvlMockDestroy();
+  }
+
+  return Status;
+}
+
+
+/**
+  Destroys the mock LINUX_EFI_HYPERVISOR_MEDIA_PROTOCOL provider.
+
+  @return None
+**/
+VOID
+HvlMockDestroy (
+  VOID
+  )
+{
+
+  if (mHvlMock.Map != NULL) {
+    FreePool(mHvlMock.Map);
+  }
+
+  if (mHvlMock.Messages != NULL) {
+    FreePool(mHvlMock.Messages);
+  }
+
+  if (mHvlMock.MessageLengths != NULL) {
+    FreePool(mHvlMock.MessageLengths);
+  }
+
+  if (mHvlMock.Changes != NULL) {
+    FreePool(mHvlMock.Changes);
+  }
+
+  ZeroMem(&mHvlMock, sizeof(mHvlMock));
+}
+
+#endif // HVL_TEST
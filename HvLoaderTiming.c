@@ -0,0 +1,182 @@
+/** @file
+  HvLoader.efi boot timing history.
+  The phase times of each boot are kept in a ring of HVL_TIMING_RECORD
+  records, in the non-volatile HVL_TIMING_VARIABLE variable, written once
+  per boot, so slow drift across boots can be tracked from the OS.
+
+  Note:
+    Phase timing is only done in HVL_TIMING builds, and uses TimerLib. The
+    platform DSC must map TimerLib to a real timer library instance, see
+    README.md, the NULL template instance ASSERTs in DEBUG builds. Other
+    builds report all times as 0, and keep no history.
+
+  Copyright (c) Microsoft Corporation.
+  Licensed under the MIT License.
+
+**/
+
+#include <stddef.h>
+#include <Uefi.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/TimerLib.h>
+#include <Library/UefiLib.h>
+#include <Library/UefiRuntimeServicesTableLib.h>
+#include <Protocol/LoadedImage.h>
+
+#include "HvLoaderEfi.h"
+#include "HvLoaderP.h"
+
+
+#if HVL_TIMING
+
+//
+// ---------------------------------------------------------------------- Types
+//
+
+//
+// HVL_TIMING_VARIABLE content, HVL_TIMING_HISTORY and its records.
+//
+typedef struct {
+  HVL_TIMING_HISTORY  History;
+  HVL_TIMING_RECORD   Records[HVL_TIMING_RECORDS];
+} HVL_TIMING_DATA;
+
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+EFI_GUID gHvlTimingGuid = HVL_TIMING_GUID;
+
+#endif // HVL_TIMING
+
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+/**
+  Gets the performance counter value at the start of a phase.
+
+  @return The performance counter value, 0 if not an HVL_TIMING build.
+**/
+UINT64
+HvlTimingStart (
+  VOID
+  )
+{
+
+#if HVL_TIMING
+  return GetPerformanceCounter();
+#else // HVL_TIMING
+  return 0;
+#endif // !HVL_TIMING
+}
+
+
+/**
+  Gets the elapsed time since a performance counter value.
+
+  @param[in]  Start     The start performance counter value.
+
+  @return The elapsed time in uSec, clipped to MAX_UINT32, 0 if not an
+          HVL_TIMING build.
+**/
+UINT32
+HvlTimingElapsedUs (
+  IN  UINT64  Start
+  )
+{
+
+#if HVL_TIMING
+  UINT64  Elapsed;
+
+  Elapsed = DivU64x32(
+              GetTimeInNanoSecond(GetPerformanceCounter() - Start),
+              1000
+              );
+
+  return (UINT32)MIN(Elapsed, MAX_UINT32);
+#else // HVL_TIMING
+  (VOID)Start;
+  return 0;
+#endif // !HVL_TIMING
+}
+
+
+#if HVL_TIMING
+
+
+/**
+  Appends a boot timing record to the boot timing history variable.
+  A missing or malformed variable starts a new history.
+
+  @param[in,out]  Record    The boot timing record, its sequence number is
+                            assigned on return.
+
+  @return None
+**/
+VOID
+HvlTimingSave (
+  IN OUT  HVL_TIMING_RECORD *Record
+  )
+{
+
+  UINT32          Attributes;
+  HVL_TIMING_DATA *Data;
+  UINTN           Size;
+  EFI_STATUS      Status;
+
+  Data = AllocatePool(sizeof(*Data));
+  if (Data == NULL) {
+    return;
+  }
+
+  Size = sizeof(*Data);
+  Status = gRT->GetVariable(
+                  HVL_TIMING_VARIABLE,
+                  &gHvlTimingGuid,
+                  &Attributes,
+                  &Size,
+                  Data
+                  );
+
+  if (EFI_ERROR(Status) ||
+      (Size != sizeof(*Data)) ||
+      (Data->History.Version != HVL_TIMING_VERSION) ||
+      (Data->History.RecordCount != HVL_TIMING_RECORDS) ||
+      (Data->History.RecordSize != sizeof(HVL_TIMING_RECORD))) {
+    ZeroMem(Data, sizeof(*Data));
+    Data->History.Version = HVL_TIMING_VERSION;
+    Data->History.RecordCount = HVL_TIMING_RECORDS;
+    Data->History.RecordSize = sizeof(HVL_TIMING_RECORD);
+    Data->History.NextSequence = 1;
+  }
+
+  Record->Sequence = Data->History.NextSequence++;
+  CopyMem(
+    &Data->Records[Record->Sequence % HVL_TIMING_RECORDS],
+    Record,
+    sizeof(*Record)
+    );
+
+  Status = gRT->SetVariable(
+                  HVL_TIMING_VARIABLE,
+                  &gHvlTimingGuid,
+                  EFI_VARIABLE_NON_VOLATILE |
+                  EFI_VARIABLE_BOOTSERVICE_ACCESS |
+                  EFI_VARIABLE_RUNTIME_ACCESS,
+                  sizeof(*Data),
+                  Data
+                  );
+
+  if (EFI_ERROR(Status)) {
+    Print(L"Error: Failed to save boot timing, status %d!\r\n", Status);
+  }
+
+  FreePool(Data);
+}
+
+#endif // HVL_TIMING
@@ -0,0 +1,771 @@
+/** @file
+  This is the OS environment (HVL_ENV_OS) build of the HvLoader image read
+  and load pipeline. It runs the HvLoaderImage.c pipeline in Linux
+  userspace: reads a hypervisor loader DLL, expanding sparse image
+  containers, then loads and relocates it with the EDK2 BasePeCoffLib, and
+  reports the resulting HVL_LOADED_IMAGE_INFO.
+  The loader entry point is never called.
+
+  This file provides the thin OS primitives the pipeline uses: file access,
+  image pages, console output and the few EDK2 library functions needed by
+  BasePeCoffLib. The image is loaded to anonymous memory, at whatever address
+  the kernel returns, so relocation processing is always exercised.
+
+  It is a profiling target for the PE load and relocation hot paths, built
+  against an EDK2 tree, for example:
+    gcc -O2 -g -Wall -fshort-wchar -DMDEPKG_NDEBUG -DHVL_ENV_OS=1 \
+      -I$EDK2/MdePkg/Include -I$EDK2/MdePkg/Include/X64 \
+      -I$EDK2/MdePkg/Library/BasePeCoffLib \
+      -o HvLoaderOs Os/HvLoaderOs.c HvLoaderImage.c \
+      $EDK2/MdePkg/Library/BasePeCoffLib/BasePeCoff.c \
+      $EDK2/MdePkg/Library/BasePeCoffLib/PeCoffLoaderEx.c
+    perf record ./HvLoaderOs lxhvloader.dll 1000
+
+  Note:
+    SHIM_LOCK is not available in the OS environment, so the verify phase
+    is skipped. Signature verification is left to the OS (IMA, etc.).
+
+  Copyright (c) Microsoft Corporation.
+  Licensed under the MIT License.
+
+**/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <Uefi.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/PeCoffExtraActionLib.h>
+#include <Library/PeCoffLib.h>
+#include <Library/UefiLib.h>
+#include <Protocol/LoadedImage.h>
+
+#include "../HvLoaderEfi.h"
+#include "../HvLoaderP.h"
+
+
+//
+// -------------------------------------------------------------------- Defines
+//
+
+//
+// Default number of pipeline iterations.
+//
+#define HVL_OS_DEF_ITERATIONS         1
+
+
+//
+// ---------------------------------------------------------------------- Types
+//
+
+//
+// An open file, EFI_FILE_PROTOCOL over a file descriptor.
+//
+typedef struct {
+  EFI_FILE_PROTOCOL File;
+  int               Fd;
+} HVL_OS_FILE;
+
+
+//
+// ------------------------------------------------------ EDK2 library shims
+//
+
+VOID *
+EFIAPI
+CopyMem (
+  OUT VOID        *DestinationBuffer,
+  IN  CONST VOID  *SourceBuffer,
+  IN  UINTN       Length
+  )
+{
+
+  return memmove(DestinationBuffer, SourceBuffer, Length);
+}
+
+
+VOID *
+EFIAPI
+SetMem (
+  OUT VOID  *Buffer,
+  IN  UINTN Length,
+  IN  UINT8 Value
+  )
+{
+
+  return memset(Buffer, Value, Length);
+}
+
+
+VOID *
+EFIAPI
+ZeroMem (
+  OUT VOID  *Buffer,
+  IN  UINTN Length
+  )
+{
+
+  return memset(Buffer, 0, Length);
+}
+
+
+INTN
+EFIAPI
+CompareMem (
+  IN  CONST VOID  *DestinationBuffer,
+  IN  CONST VOID  *SourceBuffer,
+  IN  UINTN       Length
+  )
+{
+
+  return memcmp(DestinationBuffer, SourceBuffer, Length);
+}
+
+
+UINT16
+EFIAPI
+ReadUnaligned16 (
+  IN  CONST UINT16  *Buffer
+  )
+{
+
+  UINT16  Value;
+
+  memcpy(&Value, Buffer, sizeof(Value));
+  return Value;
+}
+
+
+UINT16
+EFIAPI
+WriteUnaligned16 (
+  OUT UINT16  *Buffer,
+  IN  UINT16  Value
+  )
+{
+
+  memcpy(Buffer, &Value, sizeof(Value));
+  return Value;
+}
+
+
+UINT32
+EFIAPI
+ReadUnaligned32 (
+  IN  CONST UINT32  *Buffer
+  )
+{
+
+  UINT32  Value;
+
+  memcpy(&Value, Buffer, sizeof(Value));
+  return Value;
+}
+
+
+UINT32
+EFIAPI
+WriteUnaligned32 (
+  OUT UINT32  *Buffer,
+  IN  UINT32  Value
+  )
+{
+
+  memcpy(Buffer, &Value, sizeof(Value));
+  return Value;
+}
+
+
+UINT64
+EFIAPI
+ReadUnaligned64 (
+  IN  CONST UINT64  *Buffer
+  )
+{
+
+  UINT64  Value;
+
+  memcpy(&Value, Buffer, sizeof(Value));
+  return Value;
+}
+
+
+UINT64
+EFIAPI
+WriteUnaligned64 (
+  OUT UINT64  *Buffer,
+  IN  UINT64  Value
+  )
+{
+
+  memcpy(Buffer, &Value, sizeof(Value));
+  return Value;
+}
+
+
+VOID *
+EFIAPI
+AllocatePool (
+  IN  UINTN AllocationSize
+  )
+{
+
+  return malloc(AllocationSize);
+}
+
+
+VOID *
+EFIAPI
+AllocateZeroPool (
+  IN  UINTN AllocationSize
+  )
+{
+
+  return calloc(1, AllocationSize);
+}
+
+
+VOID
+EFIAPI
+FreePool (
+  IN  VOID  *Buffer
+  )
+{
+
+  free(Buffer);
+}
+
+
+VOID
+EFIAPI
+PeCoffLoaderRelocateImageExtraAction (
+  IN OUT  PE_COFF_LOADER_IMAGE_CONTEXT  *ImageContext
+  )
+{
+
+}
+
+
+VOID
+EFIAPI
+PeCoffLoaderUnloadImageExtraAction (
+  IN OUT  PE_COFF_LOADER_IMAGE_CONTEXT  *ImageContext
+  )
+{
+
+}
+
+
+/**
+  Prints a string to stdout, narrowed to ASCII, and padded to a width.
+
+  @param[in]  String      The NULL terminated string, or NULL.
+  @param[in]  Wide        TRUE for a CHAR16 string, FALSE for a CHAR8 one.
+  @param[in]  Width       The minimum width.
+  @param[in]  LeftAlign   TRUE to pad on the right.
+
+  @return The number of characters printed.
+**/
+UINTN
+HvlOsPutString (
+  IN  CONST VOID  *String,
+  IN  BOOLEAN     Wide,
+  IN  UINTN       Width,
+  IN  BOOLEAN     LeftAlign
+  )
+{
+
+  UINTN   Index;
+  UINTN   Length;
+  UINT16  Char;
+
+  if (String == NULL) {
+    String = "<null>";
+    Wide = FALSE;
+  }
+
+  if (Wide) {
+    for (Length = 0; ((CONST CHAR16 *)String)[Length] != CHAR_NULL; Length++);
+  } else {
+    Length = strlen(String);
+  }
+
+  for (Index = Length; !LeftAlign && (Index < Width); Index++) {
+    putchar(' ');
+  }
+
+  for (Index = 0; Index < Length; Index++) {
+    Char = Wide ? ((CONST CHAR16 *)String)[Index] :
+                  (UINT8)((CONST CHAR8 *)String)[Index];
+
+    putchar((Char < 0x80) ? (int)Char : '?');
+  }
+
+  for (Index = Length; LeftAlign && (Index < Width); Index++) {
+    putchar(' ');
+  }
+
+  return MAX(Length, Width);
+}
+
+
+/**
+  Prints a formatted string to stdout.
+  Supports the PrintLib conversions used by HvLoader.efi: %d, %u, %x, %X,
+  %s, %a, %c and %r, with the '-' and '0' flags, width, and the 'l' 64-bit
+  modifier.
+
+  @param[in]  Format    The NULL terminated format string.
+  @param[in]  ...       The format arguments.
+
+  @return The number of characters printed.
+**/
+UINTN
+EFIAPI
+Print (
+  IN  CONST CHAR16  *Format,
+  ...
+  )
+{
+
+  UINTN         Count;
+  CONST CHAR16  *Format16;
+  BOOLEAN       Is64;
+  BOOLEAN       LeftAlign;
+  VA_LIST       Marker;
+  CHAR8         Spec[16];
+  UINTN         Width;
+  BOOLEAN       ZeroPad;
+
+  Count = 0;
+  VA_START(Marker, Format);
+
+  for (Format16 = Format; *Format16 != CHAR_NULL; Format16++) {
+    if (*Format16 != (CHAR16)'%') {
+      if (*Format16 != (CHAR16)'\r') {
+        putchar((*Format16 < 0x80) ? (int)*Format16 : '?');
+        Count++;
+      }
+
+      continue;
+    }
+
+    Format16++;
+    LeftAlign = FALSE;
+    ZeroPad = FALSE;
+    Width = 0;
+    Is64 = FALSE;
+
+    for (;; Format16++) {
+      if (*Format16 == (CHAR16)'-') {
+        LeftAlign = TRUE;
+      } else if (*Format16 == (CHAR16)'0') {
+        ZeroPad = TRUE;
+      } else {
+        break;
+      }
+    }
+
+    while ((*Format16 >= (CHAR16)'0') && (*Format16 <= (CHAR16)'9')) {
+      Width = (Width * 10) + (*Format16++ - (CHAR16)'0');
+    }
+
+    if ((*Format16 == (CHAR16)'l') || (*Format16 == (CHAR16)'L')) {
+      Is64 = TRUE;
+      Format16++;
+    }
+
+    snprintf(
+      Spec,
+      sizeof(Spec),
+      "%%%s%s%u",
+      LeftAlign ? "-" : "",
+      (ZeroPad && !LeftAlign) ? "0" : "",
+      (unsigned)Width
+      );
+
+    switch (*Format16) {
+    case 'd':
+    case 'i':
+      strcat(Spec, "lld");
+      Count += printf(Spec,
+                 Is64 ? (long long)VA_ARG(Marker, INT64) :
+                        (long long)VA_ARG(Marker, INT32));
+      break;
+
+    case 'u':
+    case 'x':
+    case 'X':
+      strcat(Spec, (*Format16 == 'u') ? "llu" :
+                   (*Format16 == 'x') ? "llx" : "llX");
+      Count += printf(Spec,
+                 Is64 ? (unsigned long long)VA_ARG(Marker, UINT64) :
+                        (unsigned long long)VA_ARG(Marker, UINT32));
+      break;
+
+    case 'r':
+      Count += printf("0x%llx",
+                 (unsigned long long)VA_ARG(Marker, RETURN_STATUS));
+      break;
+
+    case 'c':
+      putchar((int)(CHAR8)VA_ARG(Marker, UINTN));
+      Count++;
+      break;
+
+    case 's':
+      Count += HvlOsPutString(
+                 VA_ARG(Marker, CONST CHAR16 *),
+                 TRUE,
+                 Width,
+                 LeftAlign
+                 );
+      break;
+
+    case 'a':
+      Count += HvlOsPutString(
+                 VA_ARG(Marker, CONST CHAR8 *),
+                 FALSE,
+                 Width,
+                 LeftAlign
+                 );
+      break;
+
+    case '%':
+      putchar('%');
+      Count++;
+      break;
+
+    default:
+      VA_END(Marker);
+      return Count;
+    }
+  }
+
+  VA_END(Marker);
+
+  return Count;
+}
+
+
+//
+// ---------------------------------------------------- HvLoader OS primitives
+//
+
+/**
+  Reads from an open file, EFI_FILE_PROTOCOL.Read().
+**/
+EFI_STATUS
+EFIAPI
+HvlOsFileRead (
+  IN      EFI_FILE_PROTOCOL *This,
+  IN OUT  UINTN             *BufferSize,
+  OUT     VOID              *Buffer
+  )
+{
+
+  ssize_t Result;
+
+  do {
+    Result = read(((HVL_OS_FILE *)This)->Fd, Buffer, *BufferSize);
+  } while ((Result < 0) && (errno == EINTR));
+
+  if (Result < 0) {
+    *BufferSize = 0;
+    return EFI_DEVICE_ERROR;
+  }
+
+  *BufferSize = (UINTN)Result;
+
+  return EFI_SUCCESS;
+}
+
+
+/**
+  Closes an open file, EFI_FILE_PROTOCOL.Close().
+**/
+EFI_STATUS
+EFIAPI
+HvlOsFileClose (
+  IN  EFI_FILE_PROTOCOL *This
+  )
+{
+
+  close(((HVL_OS_FILE *)This)->Fd);
+  free(This);
+
+  return EFI_SUCCESS;
+}
+
+
+/**
+  Opens a file for reading, and gets its size.
+  The OS environment counterpart of the HvLoader.c function, the file path
+  is relative to the current directory, and LoadedImage is not used.
+
+  @param[in]  LoadedImage   Not used.
+  @param[in]  FilePath      The file path.
+  @param[out] FileHandle    Address of returned file handle.
+  @param[out] FileSize      Address of returned file size.
+
+  @return EFI_SUCCESS       If the file was opened.
+  @return Others            Otherwise.
+**/
+EFI_STATUS
+HvlOpenFile (
+  IN  EFI_LOADED_IMAGE_PROTOCOL *LoadedImage,
+  IN  CONST CHAR16              *FilePath,
+  OUT EFI_FILE_HANDLE           *FileHandle,
+  OUT UINTN                     *FileSize
+  )
+{
+
+  HVL_OS_FILE *File;
+  UINTN       Index;
+  CHAR8       *Path;
+  struct stat Stat;
+
+  *FileHandle = NULL;
+
+  for (Index = 0; FilePath[Index] != CHAR_NULL; Index++);
+
+  Path = malloc(Index + 1);
+  File = calloc(1, sizeof(*File));
+  if ((Path == NULL) || (File == NULL)) {
+    free(Path);
+    free(File);
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  for (Index = 0; FilePath[Index] != CHAR_NULL; Index++) {
+    Path[Index] = (CHAR8)FilePath[Index];
+  }
+
+  Path[Index] = '\0';
+
+  File->Fd = open(Path, O_RDONLY);
+  if (File->Fd < 0) {
+    fprintf(stderr, "Error: Failed to open %s: %s\n", Path, strerror(errno));
+    free(Path);
+    free(File);
+    return EFI_NOT_FOUND;
+  }
+
+  free(Path);
+
+  if (fstat(File->Fd, &Stat) != 0) {
+    close(File->Fd);
+    free(File);
+    return EFI_DEVICE_ERROR;
+  }
+
+  File->File.Read = HvlOsFileRead;
+  File->File.Close = HvlOsFileClose;
+
+  *FileHandle = &File->File;
+  *FileSize = (UINTN)Stat.st_size;
+
+  return EFI_SUCCESS;
+}
+
+
+/**
+  Allocates the pages of a PE/COFF image.
+  The OS environment counterpart of the HvLoader.c function, the image is
+  placed anywhere in the process address space, regardless of its load
+  options placement.
+
+  @param[in]  Options         The image load options.
+  @param[in]  Pages           The image page count.
+  @param[out] Address         The image pages address.
+  @param[out] ProximityDomain HVL_PROXIMITY_DOMAIN_NONE.
+
+  @return EFI_SUCCESS         If the pages were allocated.
+  @return Others              Otherwise.
+**/
+EFI_STATUS
+HvlAllocateImagePages (
+  IN  CONST HVL_IMAGE_LOAD_OPTIONS  *Options,
+  IN  UINTN                         Pages,
+  OUT EFI_PHYSICAL_ADDRESS          *Address,
+  OUT UINT32                        *ProximityDomain
+  )
+{
+
+  VOID  *Buffer;
+
+  *ProximityDomain = HVL_PROXIMITY_DOMAIN_NONE;
+
+  Buffer = mmap(
+             NULL,
+             EFI_PAGES_TO_SIZE(Pages),
+             PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS,
+             -1,
+             0
+             );
+
+  if (Buffer == MAP_FAILED) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  *Address = (EFI_PHYSICAL_ADDRESS)(UINTN)Buffer;
+
+  return EFI_SUCCESS;
+}
+
+
+/**
+  Frees the pages of a PE/COFF image, allocated by HvlAllocateImagePages().
+
+  @param[in]  Address     The image pages address.
+  @param[in]  Pages       The image page count.
+
+  @return None
+**/
+VOID
+HvlFreeImagePages (
+  IN  EFI_PHYSICAL_ADDRESS  Address,
+  IN  UINTN                 Pages
+  )
+{
+
+  munmap((VOID *)(UINTN)Address, EFI_PAGES_TO_SIZE(Pages));
+}
+
+
+/**
+  Gets a monotonic time stamp.
+
+  @return The time stamp in nSec.
+**/
+UINT64
+HvlOsGetTimeNs (
+  VOID
+  )
+{
+
+  struct timespec Time;
+
+  clock_gettime(CLOCK_MONOTONIC, &Time);
+
+  return ((UINT64)Time.tv_sec * 1000000000ULL) + (UINT64)Time.tv_nsec;
+}
+
+
+/**
+  HvLoaderOs entry point.
+
+  Usage: HvLoaderOs <loader DLL path> [iterations]
+
+  @return 0 on success, 1 otherwise.
+**/
+int
+main (
+  int   argc,
+  char  **argv
+  )
+{
+
+  VOID                  *DllFileBuffer;
+  CHAR16                *DllFilePath;
+  UINTN                 DllFileSize;
+  HVL_LOADED_IMAGE_INFO DllImageInfo;
+  UINT64                Elapsed[2];
+  UINTN                 Index;
+  UINTN                 Iteration;
+  UINTN                 Iterations;
+  EFI_STATUS            Status;
+  UINT64                Time;
+
+  if ((argc < 2) || (argc > 3)) {
+    fprintf(stderr, "Usage: %s <loader DLL path> [iterations]\n", argv[0]);
+    return 1;
+  }
+
+  Iterations = HVL_OS_DEF_ITERATIONS;
+  if (argc == 3) {
+    Iterations = strtoul(argv[2], NULL, 0);
+    if (Iterations == 0) {
+      Iterations = 1;
+    }
+  }
+
+  DllFilePath = calloc(strlen(argv[1]) + 1, sizeof(CHAR16));
+  if (DllFilePath == NULL) {
+    return 1;
+  }
+
+  for (Index = 0; argv[1][Index] != '\0'; Index++) {
+    DllFilePath[Index] = (CHAR16)(UINT8)argv[1][Index];
+  }
+
+  memset(Elapsed, 0, sizeof(Elapsed));
+  memset(&DllImageInfo, 0, sizeof(DllImageInfo));
+  Status = EFI_SUCCESS;
+
+  for (Iteration = 0; Iteration < Iterations; Iteration++) {
+    Time = HvlOsGetTimeNs();
+    Status = HvlLoadLoaderDll(NULL, DllFilePath, &DllFileBuffer, &DllFileSize);
+    Elapsed[0] += HvlOsGetTimeNs() - Time;
+
+    if (EFI_ERROR(Status)) {
+      break;
+    }
+
+    Time = HvlOsGetTimeNs();
+    Status = HvlLoadPeCoffImage(DllFileBuffer, NULL, &DllImageInfo);
+    Elapsed[1] += HvlOsGetTimeNs() - Time;
+
+    FreePool(DllFileBuffer);
+
+    if (EFI_ERROR(Status)) {
+      break;
+    }
+
+    //
+    // Keep the last image loaded, for reporting.
+    //
+
+    if (Iteration + 1 < Iterations) {
+      HvlFreeImagePages(DllImageInfo.ImageAddress, DllImageInfo.ImagePages);
+    }
+  }
+
+  free(DllFilePath);
+
+  if (EFI_ERROR(Status)) {
+    fprintf(stderr, "Error: Failed to load DLL image, status 0x%lx!\n",
+      (unsigned long)Status);
+    return 1;
+  }
+
+  printf("Version         0x%x\n", DllImageInfo.Version);
+  printf("Size            %u\n", DllImageInfo.Size);
+  printf("Flags           0x%x\n", DllImageInfo.Flags);
+  printf("ImageAddress    0x%llx\n",
+    (unsigned long long)DllImageInfo.ImageAddress);
+  printf("ImageSize       %llu\n", (unsigned long long)DllImageInfo.ImageSize);
+  printf("ImagePages      %lu\n", (unsigned long)DllImageInfo.ImagePages);
+  printf("ImageMemoryType %u\n", (unsigned)DllImageInfo.ImageMemoryType);
+  printf("EntryPoint      0x%llx\n",
+    (unsigned long long)DllImageInfo.EntryPoint);
+
+  printf("%lu iterations, average: read %llu ns load %llu ns\n",
+    (unsigned long)Iterations,
+    (unsigned long long)(Elapsed[0] / Iterations),
+    (unsigned long long)(Elapsed[1] / Iterations));
+
+  HvlFreeImagePages(DllImageInfo.ImageAddress, DllImageInfo.ImagePages);
+
+  return 0;
+}
@@ -0,0 +1,99 @@
+/** @file
+  Definitions used by the OS environment tools that do not build against
+  EDK2, HvlSparsePack and HvlTimingReader.
+
+  Maps the EDK2 base types used by HvLoaderEfi.h to their Linux userspace
+  equivalents, so the tools share the HvLoaderEfi.h definitions with the
+  EFI build.
+
+  Copyright (c) Microsoft Corporation.
+  Licensed under the MIT License.
+
+**/
+
+#ifndef __HVLOADER_OS_H__
+#define __HVLOADER_OS_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+//
+// -------------------------------------------------------------------- Defines
+//
+
+#define IN
+#define OUT
+#define OPTIONAL
+#define CONST     const
+#define STATIC    static
+#define EFIAPI    __attribute__((ms_abi))
+
+#define SIGNATURE_16(A, B)        ((A) | (B << 8))
+#define SIGNATURE_32(A, B, C, D)  (SIGNATURE_16 (A, B) | (SIGNATURE_16 (C, D) << 16))
+
+#define TRUE      1
+#define FALSE     0
+
+#define EFI_PAGE_SIZE       0x1000
+#define EFI_PAGE_MASK       0xFFF
+#define EFI_PAGE_SHIFT      12
+#define EFI_SIZE_TO_PAGES(_s) \
+        (((_s) >> EFI_PAGE_SHIFT) + (((_s) & EFI_PAGE_MASK) ? 1 : 0))
+
+#define EFI_SUCCESS               0
+#define EFI_ERROR_BIT             0x8000000000000000ULL
+#define EFI_ERROR(_s)             (((_s) & EFI_ERROR_BIT) != 0)
+#define EFI_LOAD_ERROR            (EFI_ERROR_BIT | 1)
+#define EFI_INVALID_PARAMETER     (EFI_ERROR_BIT | 2)
+#define EFI_UNSUPPORTED           (EFI_ERROR_BIT | 3)
+#define EFI_OUT_OF_RESOURCES      (EFI_ERROR_BIT | 9)
+#define EFI_NOT_FOUND             (EFI_ERROR_BIT | 14)
+#define EFI_SECURITY_VIOLATION    (EFI_ERROR_BIT | 26)
+
+
+//
+// ---------------------------------------------------------------------- Types
+//
+
+typedef uint64_t    UINT64;
+typedef int64_t     INT64;
+typedef uint32_t    UINT32;
+typedef int32_t     INT32;
+typedef uint16_t    UINT16;
+typedef uint16_t    CHAR16;
+typedef uint8_t     UINT8;
+typedef char        CHAR8;
+typedef uint8_t     BOOLEAN;
+typedef uintptr_t   UINTN;
+typedef intptr_t    INTN;
+typedef void        VOID;
+
+typedef UINTN       EFI_STATUS;
+typedef VOID        *EFI_HANDLE;
+typedef UINT64      EFI_PHYSICAL_ADDRESS;
+
+typedef struct _EFI_SYSTEM_TABLE EFI_SYSTEM_TABLE;
+
+typedef enum {
+  EfiReservedMemoryType,
+  EfiLoaderCode,
+  EfiLoaderData,
+  EfiBootServicesCode,
+  EfiBootServicesData,
+  EfiRuntimeServicesCode,
+  EfiRuntimeServicesData,
+  EfiConventionalMemory,
+  EfiUnusableMemory,
+  EfiACPIReclaimMemory,
+  EfiACPIMemoryNVS,
+  EfiMemoryMappedIO,
+  EfiMemoryMappedIOPortSpace,
+  EfiPalCode,
+  EfiPersistentMemory,
+  EfiMaxMemoryType
+} EFI_MEMORY_TYPE;
+
+#include "../HvLoaderEfi.h"
+
+
+#endif // !__HVLOADER_OS_H__
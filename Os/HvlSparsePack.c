@@ -0,0 +1,220 @@
+/** @file
+  Packs an image file, for example the hypervisor loader DLL, to a sparse
+  image container (HVL_SPARSE_HEADER), that HvLoader.efi expands as it reads
+  it. All-zero pages of the image file are omitted from the container.
+
+  The image should be signed before it is packed, image signatures are
+  defined over the expanded image file, for example:
+    gcc -O2 -Wall -o HvlSparsePack Os/HvlSparsePack.c
+    ./HvlSparsePack lxhvloader.dll lxhvloader.dll.sparse
+
+  Copyright (c) Microsoft Corporation.
+  Licensed under the MIT License.
+
+**/
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "HvLoaderOs.h"
+
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+/**
+  Checks if an image page is all zeros.
+
+  @param[in]  Page      The page.
+  @param[in]  PageSize  The page size, EFI_PAGE_SIZE, or less for the last
+                        image page.
+
+  @return TRUE          If the page is all zeros.
+  @return FALSE         Otherwise.
+**/
+BOOLEAN
+HvlSparseIsZeroPage (
+  IN  CONST UINT8 *Page,
+  IN  UINTN       PageSize
+  )
+{
+
+  UINTN Offset;
+
+  for (Offset = 0; Offset < PageSize; Offset++) {
+    if (Page[Offset] != 0) {
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
+
+/**
+  Writes a sparse image container.
+
+  @param[in]  Image       The image file content.
+  @param[in]  ImageSize   The image file size.
+  @param[in]  Container   The container file.
+
+  @return EFI_SUCCESS     If the container was written.
+  @return Others          Otherwise.
+**/
+EFI_STATUS
+HvlSparsePack (
+  IN  CONST UINT8 *Image,
+  IN  UINTN       ImageSize,
+  IN  FILE        *Container
+  )
+{
+
+  HVL_SPARSE_HEADER Header;
+  UINTN             MapSize;
+  UINTN             Page;
+  UINT8             *PageMap;
+  UINTN             PageSize;
+  EFI_STATUS        Status;
+
+  memset(&Header, 0, sizeof(Header));
+  Header.Signature = HVL_SPARSE_SIGNATURE;
+  Header.Version = HVL_SPARSE_VERSION;
+  Header.ImageSize = (UINT32)ImageSize;
+  Header.PageCount = (UINT32)EFI_SIZE_TO_PAGES(ImageSize);
+
+  MapSize = (Header.PageCount + 7) / 8;
+  Header.HeaderSize = (UINT32)(sizeof(Header) + MapSize);
+
+  PageMap = calloc(1, MapSize);
+  if (PageMap == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  for (Page = 0; Page < Header.PageCount; Page++) {
+    PageSize = ImageSize - (Page * EFI_PAGE_SIZE);
+    if (PageSize > EFI_PAGE_SIZE) {
+      PageSize = EFI_PAGE_SIZE;
+    }
+
+    if (!HvlSparseIsZeroPage(Image + (Page * EFI_PAGE_SIZE), PageSize)) {
+      PageMap[Page / 8] |= (UINT8)(1 << (Page % 8));
+      Header.StoredPages++;
+    }
+  }
+
+  if ((fwrite(&Header, sizeof(Header), 1, Container) != 1) ||
+      (fwrite(PageMap, MapSize, 1, Container) != 1)) {
+    Status = EFI_LOAD_ERROR;
+    goto Done;
+  }
+
+  for (Page = 0; Page < Header.PageCount; Page++) {
+    if (!HVL_SPARSE_PAGE_STORED(PageMap, Page)) {
+      continue;
+    }
+
+    PageSize = ImageSize - (Page * EFI_PAGE_SIZE);
+    if (PageSize > EFI_PAGE_SIZE) {
+      PageSize = EFI_PAGE_SIZE;
+    }
+
+    if (fwrite(Image + (Page * EFI_PAGE_SIZE), PageSize, 1, Container) != 1) {
+      Status = EFI_LOAD_ERROR;
+      goto Done;
+    }
+  }
+
+  printf("%u of %u pages stored, image %u bytes, container %lu bytes\n",
+    Header.StoredPages,
+    Header.PageCount,
+    Header.ImageSize,
+    (unsigned long)ftell(Container));
+
+  Status = EFI_SUCCESS;
+
+Done:
+
+  free(PageMap);
+
+  return Status;
+}
+
+
+/**
+  HvlSparsePack entry point.
+
+  Usage: HvlSparsePack <image path> <container path>
+
+  @return 0 on success, 1 otherwise.
+**/
+int
+main (
+  int   argc,
+  char  **argv
+  )
+{
+
+  FILE        *Container;
+  int         Fd;
+  VOID        *Image;
+  UINTN       ImageSize;
+  struct stat Stat;
+  EFI_STATUS  Status;
+
+  if (argc != 3) {
+    fprintf(stderr, "Usage: %s <image path> <container path>\n", argv[0]);
+    return 1;
+  }
+
+  Fd = open(argv[1], O_RDONLY);
+  if (Fd < 0) {
+    perror("Error: Failed to open image file");
+    return 1;
+  }
+
+  if ((fstat(Fd, &Stat) != 0) ||
+      (Stat.st_size == 0) ||
+      (Stat.st_size > 0xFFFFFFFFLL)) {
+    fprintf(stderr, "Error: Unsupported image file size!\n");
+    close(Fd);
+    return 1;
+  }
+
+  ImageSize = (UINTN)Stat.st_size;
+  Image = mmap(NULL, ImageSize, PROT_READ, MAP_PRIVATE, Fd, 0);
+  close(Fd);
+
+  if (Image == MAP_FAILED) {
+    perror("Error: Failed to map image file");
+    return 1;
+  }
+
+  Container = fopen(argv[2], "wb");
+  if (Container == NULL) {
+    perror("Error: Failed to create container file");
+    munmap(Image, ImageSize);
+    return 1;
+  }
+
+  Status = HvlSparsePack(Image, ImageSize, Container);
+
+  if ((fclose(Container) != 0) && !EFI_ERROR(Status)) {
+    Status = EFI_LOAD_ERROR;
+  }
+
+  munmap(Image, ImageSize);
+
+  if (EFI_ERROR(Status)) {
+    fprintf(stderr, "Error: Failed to write container file!\n");
+    unlink(argv[2]);
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,421 @@
+/** @file
+  Reads the HvLoader.efi boot timing history (HVL_TIMING_VARIABLE) from
+  efivarfs, prints its boot timing records, oldest first, and flags phase
+  time regressions against a rolling median of the preceding boots.
+  For example:
+    gcc -O2 -Wall -o HvlTimingReader Os/HvlTimingReader.c
+    ./HvlTimingReader -t 25 -w 8
+
+  Exits with 2 if the last boot has a phase time regression, so it can
+  be used in health checks.
+
+  Copyright (c) Microsoft Corporation.
+  Licensed under the MIT License.
+
+**/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "HvLoaderOs.h"
+
+
+//
+// -------------------------------------------------------------------- Defines
+//
+
+//
+// Default efivarfs path of HVL_TIMING_VARIABLE, HVL_TIMING_GUID.
+//
+#define HVL_TIMING_EFIVARFS_PATH \
+        "/sys/firmware/efi/efivars/" \
+        "HvLoaderTiming-7c2a9e41-5d3b-4f86-a10e-2b9c64d71853"
+
+//
+// efivarfs files start with the variable attributes.
+//
+#define HVL_TIMING_EFIVARFS_PREFIX    sizeof(UINT32)
+
+//
+// Number of timed phases in a boot timing record.
+//
+#define HVL_TIMING_PHASES             4
+
+//
+// Regression defaults: threshold in percent over the baseline, baseline
+// window in boots, and minimum baseline samples.
+// A phase time regresses if it exceeds the baseline median by both the
+// threshold, and HVL_TIMING_MIN_DELTA_US, so timer noise on short phases
+// is not flagged.
+//
+#define HVL_TIMING_DEF_THRESHOLD      25
+#define HVL_TIMING_DEF_WINDOW         8
+#define HVL_TIMING_MAX_WINDOW         HVL_TIMING_RECORDS
+#define HVL_TIMING_MIN_SAMPLES        3
+#define HVL_TIMING_MIN_DELTA_US       250
+
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+CONST CHAR8 *mHvlTimingPhaseNames[HVL_TIMING_PHASES] = {
+  "read",
+  "verify",
+  "load",
+  "entry"
+};
+
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+/**
+  Gets the phase times of a boot timing record.
+
+  @param[in]  Record    The boot timing record.
+  @param[out] Phases    The phase times in uSec.
+
+  @return None
+**/
+VOID
+HvlTimingGetPhases (
+  IN  CONST HVL_TIMING_RECORD *Record,
+  OUT UINT32                  Phases[HVL_TIMING_PHASES]
+  )
+{
+
+  Phases[0] = Record->ReadUs;
+  Phases[1] = Record->VerifyUs;
+  Phases[2] = Record->LoadUs;
+  Phases[3] = Record->EntryUs;
+}
+
+
+/**
+  qsort() UINT32 comparator.
+**/
+int
+HvlTimingCompare (
+  CONST VOID  *A,
+  CONST VOID  *B
+  )
+{
+
+  UINT32  ValueA;
+  UINT32  ValueB;
+
+  ValueA = *(CONST UINT32 *)A;
+  ValueB = *(CONST UINT32 *)B;
+
+  return (ValueA > ValueB) - (ValueA < ValueB);
+}
+
+
+/**
+  Gets the median of phase time samples.
+
+  @param[in,out]  Samples   The samples, sorted on return.
+  @param[in]      Count     The number of samples.
+
+  @return The median.
+**/
+UINT32
+HvlTimingMedian (
+  IN OUT  UINT32  *Samples,
+  IN      UINTN   Count
+  )
+{
+
+  qsort(Samples, Count, sizeof(*Samples), HvlTimingCompare);
+
+  if ((Count % 2) == 0) {
+    return (UINT32)(((UINT64)Samples[Count / 2 - 1] + Samples[Count / 2]) / 2);
+  }
+
+  return Samples[Count / 2];
+}
+
+
+/**
+  Reads a file to memory.
+
+  @param[in]  FilePath    The file path.
+  @param[out] FileBuffer  Address of returned file content, to be freed by
+                          the caller.
+  @param[out] FileSize    Address of returned file size.
+
+  @return EFI_SUCCESS     If the file was read.
+  @return Others          Otherwise.
+**/
+EFI_STATUS
+HvlTimingReadFile (
+  IN  CONST CHAR8 *FilePath,
+  OUT UINT8       **FileBuffer,
+  OUT UINTN       *FileSize
+  )
+{
+
+  UINT8   *Buffer;
+  UINTN   BufferSize;
+  FILE    *File;
+  UINTN   Size;
+
+  File = fopen(FilePath, "rb");
+  if (File == NULL) {
+    perror("Error: Failed to open boot timing variable");
+    return EFI_NOT_FOUND;
+  }
+
+  //
+  // efivarfs reports a file size of 0 for some variables, so read until
+  // end of file.
+  //
+
+  Buffer = NULL;
+  BufferSize = 0;
+  Size = 0;
+
+  do {
+    if (Size == BufferSize) {
+      BufferSize += 4096;
+      Buffer = realloc(Buffer, BufferSize);
+      if (Buffer == NULL) {
+        fclose(File);
+        return EFI_OUT_OF_RESOURCES;
+      }
+    }
+
+    Size += fread(Buffer + Size, 1, BufferSize - Size, File);
+  } while (!feof(File) && !ferror(File));
+
+  if (ferror(File)) {
+    perror("Error: Failed to read boot timing variable");
+    fclose(File);
+    free(Buffer);
+    return EFI_LOAD_ERROR;
+  }
+
+  fclose(File);
+
+  *FileBuffer = Buffer;
+  *FileSize = Size;
+
+  return EFI_SUCCESS;
+}
+
+
+/**
+  Prints the boot timing history, and flags phase time regressions.
+
+  @param[in]  History     The boot timing history.
+  @param[in]  Size        The boot timing history size.
+  @param[in]  Threshold   The regression threshold, in percent.
+  @param[in]  Window      The baseline window, in boots.
+
+  @return 0 if the last boot has no regression, 2 if it has, 1 if the
+          history is malformed.
+**/
+int
+HvlTimingReport (
+  IN  CONST HVL_TIMING_HISTORY  *History,
+  IN  UINTN                     Size,
+  IN  UINT32                    Threshold,
+  IN  UINTN                     Window
+  )
+{
+
+  UINT32                  Baseline;
+  UINTN                   Count;
+  UINT32                  First;
+  UINTN                   Index;
+  BOOLEAN                 LastRegressed;
+  UINTN                   Phase;
+  UINT32                  Phases[HVL_TIMING_PHASES];
+  UINTN                   Prior;
+  CONST HVL_TIMING_RECORD *Record;
+  CONST HVL_TIMING_RECORD **Records;
+  BOOLEAN                 Regressed;
+  UINT32                  Samples[HVL_TIMING_MAX_WINDOW];
+  UINTN                   SampleCount;
+  UINT32                  SamplePhases[HVL_TIMING_PHASES];
+  UINT32                  Sequence;
+
+  if ((Size < sizeof(*History)) ||
+      (History->Version != HVL_TIMING_VERSION) ||
+      (History->RecordCount == 0) ||
+      (History->RecordSize < sizeof(HVL_TIMING_RECORD)) ||
+      (Size < sizeof(*History) +
+              ((UINTN)History->RecordCount * History->RecordSize))) {
+    fprintf(stderr, "Error: Malformed boot timing history!\n");
+    return 1;
+  }
+
+  Records = calloc(History->RecordCount, sizeof(*Records));
+  if (Records == NULL) {
+    return 1;
+  }
+
+  //
+  // Collect the records oldest first, skipping slots not written yet.
+  //
+
+  First = 1;
+  if (History->NextSequence > History->RecordCount) {
+    First = History->NextSequence - History->RecordCount;
+  }
+
+  Count = 0;
+  for (Sequence = First; Sequence < History->NextSequence; Sequence++) {
+    Record = (CONST HVL_TIMING_RECORD *)
+               ((CONST UINT8 *)(History + 1) +
+                ((Sequence % History->RecordCount) * History->RecordSize));
+
+    if (Record->Sequence == Sequence) {
+      Records[Count++] = Record;
+    }
+  }
+
+  printf("%8s %4s %4s %6s %10s %10s %10s %10s %10s\n",
+    "Boot", "Slot", "Try", "Flags", "DllSize",
+    "Read us", "Verify us", "Load us", "Entry us");
+
+  LastRegressed = FALSE;
+  for (Index = 0; Index < Count; Index++) {
+    Record = Records[Index];
+    HvlTimingGetPhases(Record, Phases);
+
+    printf("%8u %4u %4u 0x%04x %10u %10u %10u %10u %10u",
+      Record->Sequence,
+      Record->Slot,
+      Record->Attempts,
+      Record->Flags,
+      Record->DllSize,
+      Phases[0],
+      Phases[1],
+      Phases[2],
+      Phases[3]);
+
+    //
+    // Failed boots are neither judged, nor part of a baseline.
+    //
+
+    Regressed = FALSE;
+    if (!(Record->Flags & HVL_TIMING_FLAG_FAILED)) {
+      for (Phase = 0; Phase < HVL_TIMING_PHASES; Phase++) {
+        SampleCount = 0;
+        for (Prior = Index; (Prior > 0) && (SampleCount < Window); Prior--) {
+          if (Records[Prior - 1]->Flags & HVL_TIMING_FLAG_FAILED) {
+            continue;
+          }
+
+          HvlTimingGetPhases(Records[Prior - 1], SamplePhases);
+          Samples[SampleCount++] = SamplePhases[Phase];
+        }
+
+        if (SampleCount < HVL_TIMING_MIN_SAMPLES) {
+          continue;
+        }
+
+        Baseline = HvlTimingMedian(Samples, SampleCount);
+        if ((((UINT64)Phases[Phase] * 100) >
+              ((UINT64)Baseline * (100 + Threshold))) &&
+            (Phases[Phase] - Baseline >= HVL_TIMING_MIN_DELTA_US)) {
+          printf("%s %s +%u us", Regressed ? "," : "  REGRESSION",
+            mHvlTimingPhaseNames[Phase],
+            Phases[Phase] - Baseline);
+
+          Regressed = TRUE;
+        }
+      }
+    }
+
+    printf("\n");
+    LastRegressed = Regressed;
+  }
+
+  free(Records);
+
+  return LastRegressed ? 2 : 0;
+}
+
+
+/**
+  HvlTimingReader entry point.
+
+  Usage: HvlTimingReader [-t threshold %] [-w window] [variable file]
+
+  @return 0 if the last boot has no regression, 2 if it has, 1 on error.
+**/
+int
+main (
+  int   argc,
+  char  **argv
+  )
+{
+
+  UINT8       *FileBuffer;
+  CONST CHAR8 *FilePath;
+  UINTN       FileSize;
+  int         Option;
+  int         Result;
+  EFI_STATUS  Status;
+  UINT32      Threshold;
+  UINTN       Window;
+
+  FilePath = HVL_TIMING_EFIVARFS_PATH;
+  Threshold = HVL_TIMING_DEF_THRESHOLD;
+  Window = HVL_TIMING_DEF_WINDOW;
+
+  while ((Option = getopt(argc, argv, "t:w:")) != -1) {
+    switch (Option) {
+    case 't':
+      Threshold = (UINT32)strtoul(optarg, NULL, 0);
+      break;
+
+    case 'w':
+      Window = strtoul(optarg, NULL, 0);
+      if ((Window == 0) || (Window > HVL_TIMING_MAX_WINDOW)) {
+        Window = HVL_TIMING_DEF_WINDOW;
+      }
+      break;
+
+    default:
+      fprintf(stderr,
+        "Usage: %s [-t threshold %%] [-w window] [variable file]\n",
+        argv[0]);
+
+      return 1;
+    }
+  }
+
+  if (optind < argc) {
+    FilePath = argv[optind];
+  }
+
+  Status = HvlTimingReadFile(FilePath, &FileBuffer, &FileSize);
+  if (EFI_ERROR(Status)) {
+    return 1;
+  }
+
+  if (FileSize < HVL_TIMING_EFIVARFS_PREFIX) {
+    fprintf(stderr, "Error: Malformed boot timing variable!\n");
+    free(FileBuffer);
+    return 1;
+  }
+
+  Result = HvlTimingReport(
+             (CONST HVL_TIMING_HISTORY *)
+               (FileBuffer + HVL_TIMING_EFIVARFS_PREFIX),
+             FileSize - HVL_TIMING_EFIVARFS_PREFIX,
+             Threshold,
+             Window
+             );
+
+  free(FileBuffer);
+
+  return Result;
+}